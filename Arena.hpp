@@ -0,0 +1,116 @@
+#ifndef _ARENA_HPP_
+#define _ARENA_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Bump allocator for things that all die at the same time, e.g. the argv
+// arrays and strings of one command line. Allocating is a pointer bump and
+// release() frees everything in one step. The first block is kept across
+// release() calls, so a line that fits in it doesn't touch malloc at all.
+class Arena
+{
+public:
+	explicit Arena( size_t blockSize = 8192 ) :
+		blocks( NULL ),
+		pos( NULL ),
+		end( NULL ),
+		blockSize( blockSize )
+	{
+	}
+
+	~Arena()
+	{
+		while( blocks != NULL )
+		{
+			Block *next = blocks->next;
+			free( blocks );
+			blocks = next;
+		}
+	}
+
+	// Returns size bytes aligned to align, which must be a power of two.
+	void *allocate( size_t size, size_t align = sizeof( void * ) )
+	{
+		char *p = (char *)( ( (size_t)pos + align - 1 ) & ~( align - 1 ) );
+		if( pos == NULL || p + size > end )
+		{
+			grow( size + align );
+			p = (char *)( ( (size_t)pos + align - 1 ) & ~( align - 1 ) );
+		}
+		pos = p + size;
+		return p;
+	}
+
+	// Array of count Ts, uninitialized.
+	template<typename T>
+	T *allocateArray( size_t count )
+	{
+		return (T *)allocate( count * sizeof( T ), alignof( T ) );
+	}
+
+	// NUL-terminated copy of length characters of str.
+	char *copy( const char *str, size_t length )
+	{
+		char *result = (char *)allocate( length + 1, 1 );
+		memcpy( result, str, length );
+		result[length] = '\0';
+		return result;
+	}
+
+	// Frees everything allocated so far. Pointers handed out before are no
+	// longer valid afterwards.
+	void release()
+	{
+		if( blocks == NULL )
+		{
+			return;
+		}
+		// Keep the oldest block, it's the one every line starts in.
+		while( blocks->next != NULL )
+		{
+			Block *next = blocks->next;
+			free( blocks );
+			blocks = next;
+		}
+		pos = (char *)( blocks + 1 );
+		end = pos + blocks->size;
+	}
+
+private:
+	// Header in front of each block of memory handed out.
+	struct Block
+	{
+		Block	*next;		// Block allocated before this one.
+		size_t	size;		// Usable bytes after the header.
+	};
+
+	// Start a new block with room for at least size bytes.
+	void grow( size_t size )
+	{
+		size_t bytes = size > blockSize ? size : blockSize;
+		Block *block = (Block *)malloc( sizeof( Block ) + bytes );
+		if( block == NULL )
+		{
+			throw std::bad_alloc();
+		}
+		block->next = blocks;
+		block->size = bytes;
+		blocks = block;
+		pos = (char *)( block + 1 );
+		end = pos + bytes;
+	}
+
+	Block	*blocks;	// Newest first.
+	char	*pos;		// Next free byte in the newest block.
+	char	*end;		// End of the newest block.
+	size_t	blockSize;
+
+	// Not copyable, that would free the blocks twice.
+	Arena( const Arena & );
+	Arena & operator=( const Arena & );
+};
+
+#endif
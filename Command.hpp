@@ -4,101 +4,68 @@
 #include <string>
 #include <cstring>
 #include <sys/types.h>
+#include <sched.h>
 
+// Where a stage runs, from its pin, nice and cgroup prefixes. Applied in the
+// child before it execs, so the shell itself is never moved.
+struct Placement
+{
+	const cpu_set_t	*cpus;		// CPUs it may run on (pin), NULL for any.
+	int				nice;		// Added to its nice value (nice), 0 for none.
+	const char		*cgroup;	// cgroup v2 group to run in (cgroup), "" for the shell's own.
+	const char		**limits;	// The group's file=value settings, e.g. memory.max=1G. NULL-terminated, or NULL for none.
+
+	Placement() :
+		cpus( NULL ),
+		nice( 0 ),
+		cgroup( "" ),
+		limits( NULL )
+	{
+	}
+
+	bool any() const
+	{
+		return cpus != NULL || nice != 0 || cgroup[0] != '\0';
+	}
+};
+
+// Everything a Command points to lives in the arena of the line it was parsed
+// from (see lineArena in utils.hpp), so a Command doesn't own or free any of
+// it. It can be moved around but not copied, which would just alias strings
+// that go away when the line's arena is released.
 struct Command
 {
-	std::string 	rawString;				// Command sent to Quash. (e.g. "ls -al | grep e > out" is two commands, "ls -al" and "grep e > out"
-	std::string		inputFilename;			// Input file (for redirected stdin). Empty string if redirect not speficied.
-	std::string		outputFilename;			// Ouput file (for redirected stdout). Empty string if redirect not specified.
+	const char		*rawString;				// Command sent to Quash. (e.g. "ls -al | grep e > out" is two commands, "ls -al" and "grep e > out"
+	const char		*inputFilename;			// Input file (for redirected stdin). Empty string if redirect not speficied.
+	const char		*outputFilename;		// Ouput file (for redirected stdout). Empty string if redirect not specified.
+	const char		**truncatedOutputs;		// Output files before the last, e.g. a in cmd > a > b, which are only created and truncated, as sh does. NULL-terminated, or NULL if there are none.
 	char			**argv;					// ARGV string to pass to execve().
 	bool			executeInBackground;	// Whether to run in background.
+	bool			timed;					// Whether to report what each stage used (time prefix).
+	int				pipeSize;				// Capacity of the pipeline's pipes in bytes (pipesize prefix), 0 for the shell's pipesize option.
+	double			timeout;				// Seconds the pipeline may run for (timeout prefix), 0 for no limit.
+	Placement		placement;				// CPUs, nice value and cgroup to run with.
 
 	// Default constructor
 	Command() :
 		rawString( "" ),
 		inputFilename( "" ),
 		outputFilename( "" ),
+		truncatedOutputs( NULL ),
 		argv( NULL ),
-		executeInBackground( false )
+		executeInBackground( false ),
+		timed( false ),
+		pipeSize( 0 ),
+		timeout( 0 )
 	{
 	}
 
-	// Copy constructor
-	Command( const Command & that ) :
-		rawString( that.rawString ),
-		inputFilename( that.inputFilename ),
-		outputFilename( that.outputFilename ),
-		executeInBackground( that.executeInBackground )
-	{
-		// Copy the argv array if it's not NULL.
-		if( that.argv != NULL )
-		{
-			unsigned int argc = 0;
-			for( argc = 0; that.argv[argc]; argc++ );
+	// Moving just hands over the pointers.
+	Command( Command && that ) = default;
+	Command & operator=( Command && that ) = default;
 
-			argv = new char*[argc + 1];
-			for( unsigned int i = 0; i < argc; i++ )
-			{
-				argv[i] = new char[strlen( that.argv[i] ) + 1];
-				strncpy( argv[i], that.argv[i], strlen( that.argv[i] ) );
-				argv[i][strlen( that.argv[i] )] = '\0';
-			}
-			argv[argc] = NULL;
-		}
-		else
-		{
-			argv = NULL;
-		}
-	}
-
-	~Command()
-	{
-		// Only need to explicitly destroy this, all other member variables
-		// have their own destructors.
-		if( argv != NULL )
-		{
-			for( unsigned int i = 0; argv[i]; i++ )
-			{
-				delete [] argv[i];
-			}
-			delete [] argv;
-		}
-	}
-
-	// Overloaded assignment operator. Makes passing Commands around possible
-	// without memory errors.
-	Command & operator=( const Command & that )
-	{
-		if( this != &that )
-		{
-			rawString = that.rawString;
-			inputFilename = that.inputFilename;
-			outputFilename = that.outputFilename;
-			executeInBackground = that.executeInBackground;
-
-			if( that.argv != NULL )
-			{
-				unsigned int argc = 0;
-				for( argc = 0; that.argv[argc]; argc++ );
-
-				argv = new char*[argc + 1];
-				for( unsigned int i = 0; i < argc; i++ )
-				{
-					argv[i] = new char[strlen( that.argv[i] ) + 1];
-					strncpy( argv[i], that.argv[i], strlen( that.argv[i] ) );
-					argv[i][strlen( that.argv[i] )] = '\0';
-				}
-				argv[argc] = NULL;
-			}
-			else
-			{
-				argv = NULL;
-			}
-		}
-
-		return *this;
-	}
+	Command( const Command & that ) = delete;
+	Command & operator=( const Command & that ) = delete;
 };
 
 #endif
-
@@ -0,0 +1,565 @@
+#include "CompiledScript.hpp"
+#include "lexer.hpp"
+#include "FileDescriptor.hpp"
+#include "Variables.hpp"
+#include "glob.hpp"
+#include <iostream>
+#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+using namespace std;
+
+// Bump this whenever the format, or what the parser makes of a line, changes,
+// so old cache files get ignored instead of misread.
+static const uint32_t FORMAT_VERSION = 9;
+
+CompiledScript::CompiledScript() :
+	mapping( NULL ),
+	mappingSize( 0 ),
+	compiling( false ),
+	header( NULL ),
+	lines( NULL ),
+	commands( NULL ),
+	args( NULL ),
+	strings( NULL )
+{
+	for( int i = 0; i < SECTION_COUNT; i++ )
+	{
+		sections[i].size = 0;
+	}
+}
+
+CompiledScript::~CompiledScript()
+{
+	reset();
+}
+
+void CompiledScript::reset()
+{
+	if( mapping != NULL )
+	{
+		munmap( mapping, mappingSize );
+		mapping = NULL;
+		mappingSize = 0;
+	}
+	stopCompiling();
+	header = NULL;
+	lines = NULL;
+	commands = NULL;
+	args = NULL;
+	strings = NULL;
+}
+
+// write() all of data to fd. Returns false on an error.
+static bool writeAll( int fd, const char *data, size_t length )
+{
+	while( length > 0 )
+	{
+		ssize_t written = write( fd, data, length );
+		if( written < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( written <= 0 )
+		{
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+// A section is written out once this much of it is pending.
+static const size_t SECTION_BUFFER = 65536;
+
+void CompiledScript::append( Section & section, const void *data, size_t length )
+{
+	const char *bytes = (const char *)data;
+	section.pending.insert( section.pending.end(), bytes, bytes + length );
+	section.size += length;
+	if( section.pending.size() < SECTION_BUFFER )
+	{
+		return;
+	}
+	if( !writeAll( section.fd.get(), section.pending.data(), section.pending.size() ) )
+	{
+		stopCompiling();
+		return;
+	}
+	section.pending.clear();
+}
+
+uint32_t CompiledScript::addString( const char *str, size_t length )
+{
+	Section & strings = sections[STRINGS];
+	uint32_t offset = strings.size;
+	append( strings, str, length );
+	append( strings, "", 1 );
+	return offset;
+}
+
+// Strings up to this long are looked up before they're added, and at most
+// this many are remembered, so the table stays small however big the script.
+static const size_t SHARED_STRING_LENGTH = 32;
+static const size_t SHARED_STRING_COUNT = 65536;
+
+// "" is always string 0, and a short one is only added the first time.
+uint32_t CompiledScript::shareString( const char *str, size_t length )
+{
+	if( length == 0 )
+	{
+		return 0;
+	}
+	if( length > SHARED_STRING_LENGTH )
+	{
+		return addString( str, length );
+	}
+	string key( str, length );
+	unordered_map<string, uint32_t>::const_iterator found = sharedStrings.find( key );
+	if( found != sharedStrings.end() )
+	{
+		return found->second;
+	}
+	uint32_t offset = addString( str, length );
+	if( sharedStrings.size() < SHARED_STRING_COUNT )
+	{
+		sharedStrings.insert( make_pair( key, offset ) );
+	}
+	return offset;
+}
+
+// Whether the command's text is nothing but its arguments, one space apart,
+// as is usual for a command without quotes or redirects.
+static bool isJoinedArgs( const Command & cmd )
+{
+	const char *raw = cmd.rawString;
+	if( cmd.argv[0] == NULL )
+	{
+		return false;
+	}
+	for( char **arg = cmd.argv; *arg != NULL; arg++ )
+	{
+		size_t length = strlen( *arg );
+		if( strncmp( raw, *arg, length ) != 0 )
+		{
+			return false;
+		}
+		raw += length;
+		if( arg[1] != NULL && *raw++ != ' ' )
+		{
+			return false;
+		}
+	}
+	return *raw == '\0';
+}
+
+// mkdir() that's happy if the directory is already there.
+static bool makeDirectory( const string & dir )
+{
+	return mkdir( dir.c_str(), 0700 ) == 0 || errno == EEXIST;
+}
+
+// Opens a file in dir that's gone as soon as it's closed, for a section to
+// be written to. Its name, if it has to have one, is based on name.
+static int openScratchFile( const string & dir, const string & name )
+{
+	int fd = open( dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+	if( fd >= 0 || ( errno != EOPNOTSUPP && errno != EISDIR ) )
+	{
+		return fd;
+	}
+	// Not every filesystem has O_TMPFILE.
+	fd = open( name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+	if( fd >= 0 )
+	{
+		unlink( name.c_str() );
+	}
+	return fd;
+}
+
+bool CompiledScript::startCompiling( const string & path, const struct stat & source )
+{
+	reset();
+	this->path = path;
+
+	compiledFile = cacheFile( path );
+	if( compiledFile.empty() )
+	{
+		return false;
+	}
+	// Make ~/.cache and ~/.cache/quash if need be.
+	string dir = compiledFile.substr( 0, compiledFile.rfind( '/' ) );
+	if( !makeDirectory( dir ) && !( makeDirectory( dir.substr( 0, dir.rfind( '/' ) ) ) && makeDirectory( dir ) ) )
+	{
+		return false;
+	}
+	for( int i = 0; i < SECTION_COUNT; i++ )
+	{
+		char suffix[32];
+		snprintf( suffix, sizeof( suffix ), ".%d.%d", (int)getpid(), i );
+		sections[i].fd.reset( openScratchFile( dir, compiledFile + suffix ) );
+		if( !sections[i].fd.valid() )
+		{
+			reset();
+			return false;
+		}
+		sections[i].pending.reserve( SECTION_BUFFER + 4096 );
+	}
+
+	memcpy( compiledHeader.magic, "QSHC", 4 );
+	compiledHeader.version = FORMAT_VERSION;
+	compiledHeader.sourceSize = source.st_size;
+	compiledHeader.sourceMtimeSec = source.st_mtim.tv_sec;
+	compiledHeader.sourceMtimeNsec = source.st_mtim.tv_nsec;
+	compiling = true;
+	addString( "", 0 );
+	addString( path.data(), path.length() );
+	return true;
+}
+
+void CompiledScript::compileLine( const char *text, size_t length, Arena & arena, vector<Command> & result )
+{
+	result.clear();
+	if( !compiling )
+	{
+		return;
+	}
+
+	// The parse errors get reported when the line is run, not now.
+	static ostream noErrors( NULL );
+	// What variables and patterns expand to can change from run to run.
+	bool expands = memchr( text, '$', length ) != NULL || mightGlob( text, length );
+	bool valid = !expands && parseLine( text, length, arena, result, noErrors );
+	// Like variables, placement and timeout prefixes are left for when the
+	// line runs: the format has no room for them, and they're rare in
+	// scripts.
+	for( unsigned int i = 0; valid && i < result.size(); i++ )
+	{
+		valid = !result[i].placement.any() && result[i].timeout == 0 && result[i].truncatedOutputs == NULL;
+	}
+	if( !valid )
+	{
+		result.clear();
+		if( length >= RAW_LINE )
+		{
+			stopCompiling();
+			return;
+		}
+		Line line;
+		line.first = addString( text, length );
+		line.count = RAW_LINE | length;
+		append( sections[LINES], &line, sizeof( line ) );
+	}
+	else if( result.size() > 0 )
+	{
+		Line line;
+		line.first = sections[COMMANDS].size / sizeof( CompiledCommand );
+		line.count = result.size();
+		append( sections[LINES], &line, sizeof( line ) );
+	}
+
+	for( unsigned int i = 0; i < result.size(); i++ )
+	{
+		const Command & cmd = result[i];
+		CompiledCommand compiled;
+		bool joined = isJoinedArgs( cmd );
+		compiled.rawString = joined ? 0 : shareString( cmd.rawString, strlen( cmd.rawString ) );
+		compiled.inputFilename = shareString( cmd.inputFilename, strlen( cmd.inputFilename ) );
+		compiled.outputFilename = shareString( cmd.outputFilename, strlen( cmd.outputFilename ) );
+		compiled.firstArg = sections[ARGS].size / sizeof( uint32_t );
+		compiled.argCount = 0;
+		compiled.flags = ( cmd.executeInBackground ? FLAG_BACKGROUND : 0 ) | ( cmd.timed ? FLAG_TIMED : 0 )
+			| ( joined ? FLAG_JOINED : 0 );
+		compiled.pipeSize = cmd.pipeSize;
+		for( char **arg = cmd.argv; *arg != NULL; arg++ )
+		{
+			uint32_t offset = shareString( *arg, strlen( *arg ) );
+			append( sections[ARGS], &offset, sizeof( offset ) );
+			compiled.argCount++;
+		}
+		append( sections[COMMANDS], &compiled, sizeof( compiled ) );
+	}
+
+	// Offsets are 32 bits, which is plenty for any sane script.
+	if( sections[STRINGS].size > UINT32_MAX || sections[ARGS].size / sizeof( uint32_t ) > UINT32_MAX )
+	{
+		stopCompiling();
+	}
+}
+
+// Copies size bytes from the start of infd to the end of outfd, in the
+// kernel.
+static bool copySection( int infd, uint64_t size, int outfd )
+{
+	loff_t offset = 0;
+	while( offset < (loff_t)size )
+	{
+		ssize_t copied = copy_file_range( infd, &offset, outfd, NULL, size - offset, 0 );
+		if( copied < 0 && ( errno == EXDEV || errno == ENOSYS || errno == EINVAL ) )
+		{
+			copied = sendfile( outfd, infd, &offset, size - offset );
+		}
+		if( copied < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( copied <= 0 )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CompiledScript::finishCompiling()
+{
+	if( !compiling )
+	{
+		return false;
+	}
+	for( int i = 0; i < SECTION_COUNT; i++ )
+	{
+		if( !writeAll( sections[i].fd.get(), sections[i].pending.data(), sections[i].pending.size() ) )
+		{
+			stopCompiling();
+			return false;
+		}
+		sections[i].pending.clear();
+	}
+	compiledHeader.lineCount = sections[LINES].size / sizeof( Line );
+	compiledHeader.commandCount = sections[COMMANDS].size / sizeof( CompiledCommand );
+	compiledHeader.argCount = sections[ARGS].size / sizeof( uint32_t );
+	compiledHeader.stringsSize = sections[STRINGS].size;
+
+	// Written beside it and renamed over it, so another quash running the
+	// same script never sees half a file.
+	char pid[32];
+	snprintf( pid, sizeof( pid ), ".%d", (int)getpid() );
+	string temporary = compiledFile + pid;
+	FileDescriptor fd( open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 ) );
+	bool written = fd.valid() && writeAll( fd.get(), (const char *)&compiledHeader, sizeof( compiledHeader ) );
+	for( int i = 0; written && i < SECTION_COUNT; i++ )
+	{
+		written = copySection( sections[i].fd.get(), sections[i].size, fd.get() );
+	}
+	fd.reset();
+	stopCompiling();
+
+	if( !written || rename( temporary.c_str(), compiledFile.c_str() ) < 0 )
+	{
+		unlink( temporary.c_str() );
+		return false;
+	}
+	return true;
+}
+
+void CompiledScript::stopCompiling()
+{
+	compiling = false;
+	for( int i = 0; i < SECTION_COUNT; i++ )
+	{
+		sections[i].fd.reset();
+		sections[i].size = 0;
+		vector<char>().swap( sections[i].pending );
+	}
+	unordered_map<string, uint32_t>().swap( sharedStrings );
+}
+
+bool CompiledScript::attach()
+{
+	char *data = (char *)mapping;
+	uint64_t size = mappingSize;
+
+	if( size < sizeof( Header ) )
+	{
+		return false;
+	}
+	const Header *head = (const Header *)data;
+	if( memcmp( head->magic, "QSHC", 4 ) != 0 || head->version != FORMAT_VERSION )
+	{
+		return false;
+	}
+	// 64 bit sums of 32 bit counts can't overflow.
+	uint64_t expected = sizeof( Header ) + (uint64_t)head->lineCount * sizeof( Line )
+		+ (uint64_t)head->commandCount * sizeof( CompiledCommand ) + (uint64_t)head->argCount * sizeof( uint32_t )
+		+ head->stringsSize;
+	if( expected != size || head->stringsSize == 0 || data[size - 1] != '\0' )
+	{
+		return false;
+	}
+
+	const Line *lineSection = (const Line *)( head + 1 );
+	const CompiledCommand *commandSection = (const CompiledCommand *)( lineSection + head->lineCount );
+	const uint32_t *argSection = (const uint32_t *)( commandSection + head->commandCount );
+	char *stringSection = (char *)( argSection + head->argCount );
+
+	// Check every offset once here, so getLine() can trust them. The strings
+	// themselves needn't be looked at: they can't run past the final NUL.
+	for( uint32_t i = 0; i < head->lineCount; i++ )
+	{
+		const Line & line = lineSection[i];
+		bool raw = ( line.count & RAW_LINE ) != 0;
+		if( (uint64_t)line.first + ( line.count & ~RAW_LINE ) >= ( raw ? head->stringsSize : head->commandCount + 1ULL ) )
+		{
+			return false;
+		}
+	}
+	for( uint32_t i = 0; i < head->commandCount; i++ )
+	{
+		const CompiledCommand & cmd = commandSection[i];
+		if( cmd.rawString >= head->stringsSize || cmd.inputFilename >= head->stringsSize
+			|| cmd.outputFilename >= head->stringsSize || (uint64_t)cmd.firstArg + cmd.argCount > head->argCount
+			|| ( ( cmd.flags & FLAG_JOINED ) && cmd.argCount == 0 ) )
+		{
+			return false;
+		}
+	}
+	for( uint32_t i = 0; i < head->argCount; i++ )
+	{
+		if( argSection[i] >= head->stringsSize )
+		{
+			return false;
+		}
+	}
+
+	header = head;
+	lines = lineSection;
+	commands = commandSection;
+	args = argSection;
+	strings = stringSection;
+	return true;
+}
+
+bool CompiledScript::load( const string & path, const struct stat & source )
+{
+	reset();
+	this->path = path;
+
+	string file = cacheFile( path );
+	if( file.empty() )
+	{
+		return false;
+	}
+	FileDescriptor fd( open( file.c_str(), O_RDONLY | O_CLOEXEC ) );
+	struct stat info;
+	if( !fd.valid() || fstat( fd.get(), &info ) < 0 || info.st_size == 0 )
+	{
+		return false;
+	}
+
+	// Private and writable only because argv is char **. Nothing writes to
+	// it, so no page ever actually gets copied.
+	void *data = mmap( NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd.get(), 0 );
+	fd.reset();
+	if( data == MAP_FAILED )
+	{
+		return false;
+	}
+	mapping = data;
+	mappingSize = info.st_size;
+
+	if( !attach() || header->sourceSize != (uint64_t)source.st_size
+		|| header->sourceMtimeSec != source.st_mtim.tv_sec || header->sourceMtimeNsec != source.st_mtim.tv_nsec
+		|| strcmp( strings + 1, path.c_str() ) != 0 )
+	{
+		reset();
+		return false;
+	}
+	return true;
+}
+
+size_t CompiledScript::lineCount() const
+{
+	return header != NULL ? header->lineCount : 0;
+}
+
+void CompiledScript::getLine( size_t i, Arena & arena, vector<Command> & result, const char *& raw, size_t & rawLength ) const
+{
+	const Line & line = lines[i];
+	result.clear();
+	if( line.count & RAW_LINE )
+	{
+		raw = strings + line.first;
+		rawLength = line.count & ~RAW_LINE;
+		return;
+	}
+	raw = strings;
+	rawLength = 0;
+
+	result.resize( line.count );
+	for( uint32_t c = 0; c < line.count; c++ )
+	{
+		const CompiledCommand & compiled = commands[line.first + c];
+		Command & cmd = result[c];
+		cmd.rawString = strings + compiled.rawString;
+		cmd.inputFilename = strings + compiled.inputFilename;
+		cmd.outputFilename = strings + compiled.outputFilename;
+		cmd.executeInBackground = ( compiled.flags & FLAG_BACKGROUND ) != 0;
+		cmd.timed = ( compiled.flags & FLAG_TIMED ) != 0;
+		cmd.pipeSize = compiled.pipeSize;
+		cmd.argv = arena.allocateArray<char *>( compiled.argCount + 1 );
+		for( uint32_t a = 0; a < compiled.argCount; a++ )
+		{
+			cmd.argv[a] = strings + args[compiled.firstArg + a];
+		}
+		cmd.argv[compiled.argCount] = NULL;
+
+		// Only the arguments were kept, so put the text back together.
+		if( compiled.flags & FLAG_JOINED )
+		{
+			size_t length = 0;
+			for( uint32_t a = 0; a < compiled.argCount; a++ )
+			{
+				length += strlen( cmd.argv[a] ) + 1;
+			}
+			char *text = arena.allocateArray<char>( length );
+			char *pos = text;
+			for( uint32_t a = 0; a < compiled.argCount; a++ )
+			{
+				size_t argLength = strlen( cmd.argv[a] );
+				memcpy( pos, cmd.argv[a], argLength );
+				pos += argLength;
+				*pos++ = ' ';
+			}
+			pos[-1] = '\0';
+			cmd.rawString = text;
+		}
+	}
+}
+
+string CompiledScript::cacheFile( const string & path )
+{
+	string dir;
+	const char *cacheHome = shellVariables.get( "XDG_CACHE_HOME" );
+	const char *home = shellVariables.get( "HOME" );
+	// The spec says to ignore a relative XDG_CACHE_HOME.
+	if( cacheHome != NULL && cacheHome[0] == '/' )
+	{
+		dir = cacheHome;
+	}
+	else if( home != NULL && home[0] != '\0' )
+	{
+		dir = string( home ) + "/.cache";
+	}
+	else
+	{
+		return "";
+	}
+
+	// 64 bit FNV-1a of the path.
+	uint64_t hash = 14695981039346656037ULL;
+	for( unsigned int i = 0; i < path.length(); i++ )
+	{
+		hash = ( hash ^ (unsigned char)path[i] ) * 1099511628211ULL;
+	}
+	char name[32];
+	snprintf( name, sizeof( name ), "%016llx", (unsigned long long)hash );
+	return dir + "/quash/" + name;
+}
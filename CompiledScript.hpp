@@ -0,0 +1,154 @@
+#ifndef _COMPILED_SCRIPT_HPP_
+#define _COMPILED_SCRIPT_HPP_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "Command.hpp"
+#include "Arena.hpp"
+#include "FileDescriptor.hpp"
+
+// A script that has been lexed and parsed once into a flat array of lines,
+// each a range of commands, each a range of argument strings, and cached in
+// a file. Every reference is an offset, never a pointer, so the file can be
+// mmap()ed and used as it is. Running a line from it is just pointing a
+// Command's fields into the strings; there's no lexing at all.
+//
+// The first time a script runs it's compiled a line at a time as each line
+// is reached, straight into the cache, so it starts right away and its
+// compiled form never has to be held in memory.
+class CompiledScript
+{
+public:
+	CompiledScript();
+	~CompiledScript();
+
+	// Starts compiling the script at path, which is source, for the cache.
+	// Returns false if there's nowhere to put it.
+	bool startCompiling( const std::string & path, const struct stat & source );
+	// Compiles the script's next line. When it compiles to commands they're
+	// left in result, from arena, so the line can be run without parsing it
+	// again. Otherwise result is left empty: the line is empty or a comment,
+	// or it's kept as its source text, to be parsed when it's reached. That's
+	// a line that doesn't parse, so it can be reported then like it would
+	// have been without compiling, or one with a $ in it, whose variables can
+	// only be expanded when it's run. If the script turns out to be too big
+	// for the format, or the cache can't be written, compiling stops there
+	// and result is always left empty.
+	void compileLine( const char *text, size_t length, Arena & arena, std::vector<Command> & result );
+	// Puts what was compiled in the cache, in place of any older version.
+	// Failing to is harmless, the script just gets compiled again next time.
+	bool finishCompiling();
+	// Maps the compiled form of the script at path from the cache, if there's
+	// one for this exact version of it (same size and mtime). Returns false,
+	// and leaves this empty, if not.
+	bool load( const std::string & path, const struct stat & source );
+
+	size_t lineCount() const;
+	// Fills result with the commands of line i, pointing into this script,
+	// with only their argv arrays allocated from arena. If the line wasn't
+	// compiled, result is left empty and its source text returned in raw.
+	void getLine( size_t i, Arena & arena, std::vector<Command> & result, const char *& raw, size_t & rawLength ) const;
+
+	// Where the compiled form of the script at path is cached:
+	// $XDG_CACHE_HOME/quash (~/.cache/quash by default), named after a hash
+	// of the script's absolute path. Empty if there's nowhere to put it.
+	static std::string cacheFile( const std::string & path );
+
+private:
+	// The file format. All of it is fixed size and little more than offsets
+	// into the strings at the end, which are all NUL terminated. String 0 is
+	// "" and the script's absolute path follows it, to catch hash collisions.
+	// Each string is only stored once where that's cheap to arrange: every
+	// empty one is string 0, short ones that come up again (command names,
+	// options) share one copy, and a command's text isn't stored at all when
+	// it's just its arguments with a space between each.
+	struct Header
+	{
+		char		magic[4];		// "QSHC"
+		uint32_t	version;
+		uint64_t	sourceSize;		// The script it was compiled from.
+		int64_t		sourceMtimeSec;
+		int64_t		sourceMtimeNsec;
+		uint32_t	lineCount;
+		uint32_t	commandCount;
+		uint32_t	argCount;
+		uint32_t	stringsSize;
+	};
+	struct Line
+	{
+		uint32_t	first;			// Its first command, or its source text if it wasn't compiled.
+		uint32_t	count;			// How many commands, or RAW_LINE | the text's length.
+	};
+	static const uint32_t RAW_LINE = 0x80000000;
+	struct CompiledCommand
+	{
+		uint32_t	rawString;
+		uint32_t	inputFilename;
+		uint32_t	outputFilename;
+		uint32_t	firstArg;
+		uint32_t	argCount;
+		uint32_t	flags;			// FLAG_* below.
+		uint32_t	pipeSize;
+	};
+	enum
+	{
+		FLAG_BACKGROUND	= 1,
+		FLAG_TIMED		= 2,
+		FLAG_JOINED		= 4		// rawString is the arguments joined by spaces.
+	};
+
+	// While compiling, each section of the file is written to a temporary
+	// file of its own, through a small buffer, and finishCompiling() puts
+	// them together after the header.
+	struct Section
+	{
+		FileDescriptor		fd;
+		std::vector<char>	pending;	// Not written yet.
+		uint64_t			size;		// Including what's pending.
+	};
+	enum
+	{
+		LINES,
+		COMMANDS,
+		ARGS,
+		STRINGS,
+		SECTION_COUNT
+	};
+
+	// Sets up the section pointers from the mapping, checking every offset is
+	// in bounds first. False if it's not a valid compiled script.
+	bool attach();
+	void reset();
+	// Adds to a section, writing it out when enough is pending. Stops
+	// compiling if that fails.
+	void append( Section & section, const void *data, size_t length );
+	// Appends str (and its NUL) to the strings, returning its offset.
+	uint32_t addString( const char *str, size_t length );
+	// addString() for a string that may well have been added already.
+	uint32_t shareString( const char *str, size_t length );
+	// Stops compiling, leaving the cache as it was.
+	void stopCompiling();
+
+	std::string		path;		// Absolute path of the script.
+	void			*mapping;	// The cache file, if load() mapped it.
+	size_t			mappingSize;
+
+	bool			compiling;
+	std::string		compiledFile;	// Where it's going, from cacheFile().
+	Header			compiledHeader;
+	Section			sections[SECTION_COUNT];
+	std::unordered_map<std::string, uint32_t>	sharedStrings;
+
+	const Header			*header;
+	const Line				*lines;
+	const CompiledCommand	*commands;
+	const uint32_t			*args;
+	char					*strings;
+};
+
+#endif
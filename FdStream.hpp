@@ -0,0 +1,84 @@
+#ifndef _FD_STREAM_HPP_
+#define _FD_STREAM_HPP_
+
+#include <ostream>
+#include <streambuf>
+#include <unistd.h>
+#include <errno.h>
+
+// Stream buffer that write()s to a file descriptor, so builtins can print
+// with << to whatever fd they were given instead of always to cout.
+class FdOutBuf : public std::streambuf
+{
+public:
+	explicit FdOutBuf( int fd ) :
+		fd( fd )
+	{
+		setp( buffer, buffer + sizeof( buffer ) );
+	}
+
+	~FdOutBuf()
+	{
+		sync();
+	}
+
+protected:
+	int overflow( int c )
+	{
+		if( sync() != 0 )
+		{
+			return traits_type::eof();
+		}
+		if( c != traits_type::eof() )
+		{
+			*pptr() = (char)c;
+			pbump( 1 );
+		}
+		return traits_type::not_eof( c );
+	}
+
+	// Write out everything buffered. Fails (e.g. with EPIPE once the reader of
+	// a pipe is gone) by returning -1, which sets the stream's badbit.
+	int sync()
+	{
+		const char *p = pbase();
+		while( p < pptr() )
+		{
+			ssize_t written = write( fd, p, pptr() - p );
+			if( written < 0 )
+			{
+				if( errno == EINTR )
+				{
+					continue;
+				}
+				setp( buffer, buffer + sizeof( buffer ) );
+				return -1;
+			}
+			p += written;
+		}
+		setp( buffer, buffer + sizeof( buffer ) );
+		return 0;
+	}
+
+private:
+	int		fd;
+	char	buffer[4096];
+};
+
+// std::ostream writing to a file descriptor. Flushes when destroyed; the fd
+// itself is left open.
+class FdOstream : public std::ostream
+{
+public:
+	explicit FdOstream( int fd ) :
+		std::ostream( NULL ),
+		buf( fd )
+	{
+		rdbuf( &buf );
+	}
+
+private:
+	FdOutBuf	buf;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "FileDescriptor.hpp"
+#include "trace.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <dirent.h>
+using namespace std;
+
+bool makePipe( FileDescriptor & readEnd, FileDescriptor & writeEnd )
+{
+	int pipefd[2];
+	if( pipe2( pipefd, O_CLOEXEC ) < 0 )
+	{
+		return false;
+	}
+	readEnd.reset( pipefd[0] );
+	writeEnd.reset( pipefd[1] );
+	return true;
+}
+
+bool fdCheck = false;
+
+// The shell's fd count as of the last checkShellFds().
+static int shellFds = -1;
+
+// Calls visit( fd ) for each of the process's open fds, not counting the one
+// reading the list or the trace file, which is always there when tracing.
+template<typename Visit>
+static void forEachFd( Visit visit )
+{
+	DIR *dir = opendir( "/proc/self/fd" );
+	if( dir == NULL )
+	{
+		return;
+	}
+	int listFd = dirfd( dir );
+	struct dirent *entry;
+	while( ( entry = readdir( dir ) ) != NULL )
+	{
+		if( entry->d_name[0] == '.' )
+		{
+			continue;
+		}
+		int fd = atoi( entry->d_name );
+		if( fd != listFd && fd != traceFileDescriptor() )
+		{
+			visit( fd );
+		}
+	}
+	closedir( dir );
+}
+
+static int countFds()
+{
+	int count = 0;
+	forEachFd( [&]( int ) { count++; } );
+	return count;
+}
+
+void initFdCheck()
+{
+	const char *value = getenv( "QUASH_FDCHECK" );
+	setFdCheck( value != NULL && value[0] != '\0' && value[0] != '0' );
+}
+
+void setFdCheck( bool on )
+{
+	fdCheck = on;
+	shellFds = on ? countFds() : -1;
+}
+
+void checkInheritedFds( const char *command )
+{
+	forEachFd( [&]( int fd )
+	{
+		if( fd > STDERR_FILENO && !( fcntl( fd, F_GETFD ) & FD_CLOEXEC ) )
+		{
+			char target[256];
+			char link[64];
+			snprintf( link, sizeof( link ), "/proc/self/fd/%d", fd );
+			ssize_t length = readlink( link, target, sizeof( target ) - 1 );
+			target[length > 0 ? length : 0] = '\0';
+			cerr << "quash: fdcheck: fd " << fd << " (" << target << ") is inherited by \"" << command << "\"" << endl;
+		}
+	} );
+}
+
+void checkShellFds( const char *line, size_t length )
+{
+	int count = countFds();
+	if( count > shellFds )
+	{
+		cerr << "quash: fdcheck: " << count << " fds open after \"";
+		cerr.write( line, length ) << "\", " << shellFds << " before" << endl;
+	}
+	shellFds = count;
+}
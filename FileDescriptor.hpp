@@ -0,0 +1,90 @@
+#ifndef _FILE_DESCRIPTOR_HPP_
+#define _FILE_DESCRIPTOR_HPP_
+
+#include <unistd.h>
+
+// Owns a file descriptor and closes it when it goes out of scope, so no path
+// through the shell can forget to. Move-only, like Command: there's only ever
+// one owner to do the closing. Every fd the shell opens for itself should be
+// O_CLOEXEC as well, so the only fds a child inherits are the STDIN and
+// STDOUT it's given.
+class FileDescriptor
+{
+public:
+	explicit FileDescriptor( int fd = -1 ) :
+		fd( fd )
+	{
+	}
+
+	FileDescriptor( FileDescriptor && other ) :
+		fd( other.release() )
+	{
+	}
+
+	FileDescriptor & operator=( FileDescriptor && other )
+	{
+		reset( other.release() );
+		return *this;
+	}
+
+	FileDescriptor( const FileDescriptor & ) = delete;
+	FileDescriptor & operator=( const FileDescriptor & ) = delete;
+
+	~FileDescriptor()
+	{
+		reset();
+	}
+
+	int get() const
+	{
+		return fd;
+	}
+
+	bool valid() const
+	{
+		return fd >= 0;
+	}
+
+	// Stops owning the fd and returns it.
+	int release()
+	{
+		int released = fd;
+		fd = -1;
+		return released;
+	}
+
+	// Closes the fd, if there is one, and owns newFd instead.
+	void reset( int newFd = -1 )
+	{
+		if( fd >= 0 )
+		{
+			close( fd );
+		}
+		fd = newFd;
+	}
+
+private:
+	int fd;
+};
+
+// Opens a pipe with both ends close-on-exec. Returns false if it couldn't.
+bool makePipe( FileDescriptor & readEnd, FileDescriptor & writeEnd );
+
+// Debugging aid for fd leaks, off unless QUASH_FDCHECK is set or turned on
+// with "set -o fdcheck=on". When it's on, every child reports any fd besides
+// STDIN, STDOUT and STDERR that it's about to keep, and the shell reports
+// whenever it has more fds open after a line than before it.
+extern bool fdCheck;
+// Reads $QUASH_FDCHECK. Call at Quash startup.
+void initFdCheck();
+// Turns checking on or off, counting the shell's fds afresh.
+void setFdCheck( bool on );
+// Reports every fd above STDERR that isn't close-on-exec, i.e. that exec()
+// would hand to command. Call in a child just before exec(), or in the shell
+// before posix_spawn(), which passes on the same fds.
+void checkInheritedFds( const char *command );
+// Reports if the shell has more fds open than when last checked. Call after
+// each line.
+void checkShellFds( const char *line, size_t length );
+
+#endif
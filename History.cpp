@@ -0,0 +1,230 @@
+#include "History.hpp"
+#include "Variables.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+History::History() :
+	fd( -1 ),
+	mapping( NULL ),
+	mappedSize( 0 ),
+	lastBlockLines( 0 ),
+	indexedEnd( 0 )
+{
+}
+
+History::~History()
+{
+	if( mapping != NULL )
+	{
+		munmap( mapping, mappedSize );
+	}
+	if( fd >= 0 )
+	{
+		close( fd );
+	}
+}
+
+void History::open()
+{
+	// HISTFILE= means no history file, the same as one that can't be opened.
+	string file;
+	const char *histfile = shellVariables.get( "HISTFILE" );
+	const char *home = shellVariables.get( "HOME" );
+	if( histfile != NULL )
+	{
+		file = histfile;
+	}
+	else if( home != NULL && home[0] != '\0' )
+	{
+		file = string( home ) + "/.quash_history";
+	}
+	if( !file.empty() )
+	{
+		fd = ::open( file.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600 );
+	}
+	// Without a file the same code works on one that only lives in memory.
+	if( fd < 0 )
+	{
+		fd = memfd_create( "quash-history", MFD_CLOEXEC );
+		if( fd >= 0 )
+		{
+			fcntl( fd, F_SETFL, O_APPEND );
+		}
+	}
+	refresh();
+}
+
+void History::refresh()
+{
+	struct stat info;
+	if( fd < 0 || fstat( fd, &info ) < 0 || (size_t)info.st_size == mappedSize )
+	{
+		return;
+	}
+	// Someone cut the file down to size: start the index again.
+	if( (size_t)info.st_size < mappedSize )
+	{
+		blockStarts.clear();
+		signatures.clear();
+		lastBlockLines = 0;
+		indexedEnd = 0;
+	}
+	if( mapping != NULL )
+	{
+		munmap( mapping, mappedSize );
+		mapping = NULL;
+		mappedSize = 0;
+	}
+	if( info.st_size == 0 )
+	{
+		return;
+	}
+	void *data = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if( data != MAP_FAILED )
+	{
+		mapping = (char *)data;
+		mappedSize = info.st_size;
+	}
+}
+
+void History::add( const string & line )
+{
+	if( fd < 0 || line.find_first_not_of( " \t" ) == string::npos )
+	{
+		return;
+	}
+	refresh();
+	size_t begin, end;
+	if( previous( mappedSize, begin, end ) && line.compare( 0, string::npos, mapping + begin, end - begin ) == 0 )
+	{
+		return;
+	}
+	// One write(), so the line goes in whole even with other sessions
+	// appending at the same time.
+	string entry = line + '\n';
+	while( write( fd, entry.data(), entry.length() ) < 0 && errno == EINTR );
+}
+
+bool History::previous( size_t offset, size_t & begin, size_t & end ) const
+{
+	if( offset == 0 || offset > mappedSize )
+	{
+		return false;
+	}
+	// The newest entry might not have its newline yet.
+	end = mapping[offset - 1] == '\n' ? offset - 1 : offset;
+	const char *newline = (const char *)memrchr( mapping, '\n', end );
+	begin = newline != NULL ? newline - mapping + 1 : 0;
+	return true;
+}
+
+bool History::next( size_t offset, size_t & begin, size_t & end ) const
+{
+	if( offset >= mappedSize )
+	{
+		return false;
+	}
+	const char *newline = (const char *)memchr( mapping + offset, '\n', mappedSize - offset );
+	if( newline == NULL || newline + 1 == mapping + mappedSize )
+	{
+		return false;
+	}
+	begin = newline - mapping + 1;
+	newline = (const char *)memchr( mapping + begin, '\n', mappedSize - begin );
+	end = newline != NULL ? newline - mapping : mappedSize;
+	return true;
+}
+
+unsigned int History::trigramBit( const char *p )
+{
+	uint32_t trigram = (unsigned char)p[0] | (unsigned char)p[1] << 8 | (unsigned char)p[2] << 16;
+	return ( trigram * 2654435761u ) >> ( 32 - 12 );
+}
+
+void History::index()
+{
+	// Only whole lines: the last one may still be being written.
+	while( indexedEnd < mappedSize )
+	{
+		const char *line = mapping + indexedEnd;
+		const char *newline = (const char *)memchr( line, '\n', mappedSize - indexedEnd );
+		if( newline == NULL )
+		{
+			return;
+		}
+		if( blockStarts.empty() || lastBlockLines == BLOCK_LINES )
+		{
+			blockStarts.push_back( indexedEnd );
+			signatures.resize( signatures.size() + SIGNATURE_WORDS, 0 );
+			lastBlockLines = 0;
+		}
+		uint64_t *signature = &signatures[signatures.size() - SIGNATURE_WORDS];
+		for( const char *p = line; p + 3 <= newline; p++ )
+		{
+			unsigned int bit = trigramBit( p );
+			signature[bit / 64] |= (uint64_t)1 << ( bit % 64 );
+		}
+		lastBlockLines++;
+		indexedEnd = newline + 1 - mapping;
+	}
+}
+
+bool History::search( const string & query, size_t offset, size_t & begin, size_t & end )
+{
+	if( query.empty() || mapping == NULL )
+	{
+		return false;
+	}
+	index();
+
+	// Looks through the entries in [rangeBegin, rangeEnd) that start before
+	// offset, newest first.
+	auto searchRange = [&]( size_t rangeBegin, size_t rangeEnd )
+	{
+		size_t at = min( rangeEnd, offset );
+		while( previous( at, begin, end ) && begin >= rangeBegin )
+		{
+			if( memmem( mapping + begin, end - begin, query.data(), query.length() ) != NULL )
+			{
+				return true;
+			}
+			at = begin;
+		}
+		return false;
+	};
+
+	// What isn't in the index yet is only ever a line or two.
+	if( offset > indexedEnd && searchRange( indexedEnd, mappedSize ) )
+	{
+		return true;
+	}
+
+	// A query too short to have a trigram has to look at every block.
+	vector<unsigned int> bits;
+	for( size_t i = 0; i + 3 <= query.length(); i++ )
+	{
+		bits.push_back( trigramBit( query.data() + i ) );
+	}
+	size_t block = upper_bound( blockStarts.begin(), blockStarts.end(), offset ) - blockStarts.begin();
+	while( block-- > 0 )
+	{
+		const uint64_t *signature = &signatures[block * SIGNATURE_WORDS];
+		bool candidate = true;
+		for( unsigned int i = 0; i < bits.size() && candidate; i++ )
+		{
+			candidate = ( signature[bits[i] / 64] >> ( bits[i] % 64 ) ) & 1;
+		}
+		size_t blockEnd = block + 1 < blockStarts.size() ? blockStarts[block + 1] : indexedEnd;
+		if( candidate && searchRange( blockStarts[block], blockEnd ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,72 @@
+#ifndef _HISTORY_HPP_
+#define _HISTORY_HPP_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+// The interactive shell's command history, kept in a file of one line per
+// entry ($HISTFILE, ~/.quash_history by default). The file is mmap()ed, not
+// read: entries are found by scanning back from wherever the line editor is,
+// so a history of a million lines costs nothing at startup. Each new entry is
+// appended with a single O_APPEND write(), so any number of sessions can add
+// to the same file at once without their lines getting mixed up, and each
+// one sees the others' lines as soon as it looks again.
+//
+// An entry is a byte range [begin, end) of the file, not counting its
+// newline. Offsets stay valid as the file grows.
+class History
+{
+public:
+	History();
+	~History();
+
+	// Opens and maps the history file, or keeps history in memory only if it
+	// can't be opened.
+	void open();
+	// Adds a line, unless it's blank or the same as the newest entry.
+	void add( const std::string & line );
+	// Remaps the file if it has grown, e.g. because another session added to
+	// it. Call before looking at the entries.
+	void refresh();
+
+	const char *data() const { return mapping; }
+	size_t size() const { return mappedSize; }
+	// The entry before the one starting at offset (size() for the newest).
+	// Returns false if there isn't one.
+	bool previous( size_t offset, size_t & begin, size_t & end ) const;
+	// The entry after the one starting at offset. Returns false if there isn't
+	// one, i.e. offset is the newest.
+	bool next( size_t offset, size_t & begin, size_t & end ) const;
+
+	// Finds the newest entry containing query that starts before offset.
+	// Returns false if there's none.
+	bool search( const std::string & query, size_t offset, size_t & begin, size_t & end );
+
+private:
+	// Ctrl-R has to stay interactive with a million entries, so searches go
+	// through a trigram index: the entries are split into blocks of
+	// BLOCK_LINES lines, and each block has a signature with a bit set for
+	// every (hashed) trigram in it. A block can only hold a match if its
+	// signature has every bit of the query's trigrams, so most of the history
+	// is never looked at. It's built the first time it's needed and after
+	// that only extended, like the file.
+	static const unsigned int BLOCK_LINES = 64;
+	static const unsigned int SIGNATURE_BITS = 4096;
+	static const unsigned int SIGNATURE_WORDS = SIGNATURE_BITS / 64;
+
+	// Brings the index up to date with the end of the file.
+	void index();
+	static unsigned int trigramBit( const char *p );
+
+	int						fd;
+	char					*mapping;		// NULL while the file is empty.
+	size_t					mappedSize;
+	std::vector<size_t>		blockStarts;	// Offset of each block's first entry.
+	std::vector<uint64_t>	signatures;		// SIGNATURE_WORDS per block.
+	unsigned int			lastBlockLines;	// Entries in the last block so far.
+	size_t					indexedEnd;		// Everything before this is in the index.
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "JobTable.hpp"
+#include "events.hpp"
+#include <sstream>
+#include <algorithm>
+#include <iomanip>
+using namespace std;
+
+JobTable backgroundJobs;
+
+// How many finished jobs' statuses are kept for wait.
+static const size_t MAX_COMPLETIONS = 4096;
+
+JobTable::JobTable() :
+	nextJobId( 0 )
+{
+}
+
+const Job & JobTable::add( const string & command, const vector<pid_t> & pids, bool quiet )
+{
+	Job job;
+	job.command = command;
+	job.jobId = nextJobId++;
+	job.pid = pids[0];
+	job.running = pids.size();
+	job.lastPid = pids.back();
+	job.status = 0;
+	job.quiet = quiet;
+	job.startTime = monotonicTime();
+
+	for( unsigned int i = 0; i < pids.size(); i++ )
+	{
+		pidIndex[pids[i]] = job.jobId;
+	}
+	return jobs[job.jobId] = job;
+}
+
+bool JobTable::childExited( pid_t pid, int status, const struct rusage & usage )
+{
+	unordered_map<pid_t, unsigned int>::iterator it = pidIndex.find( pid );
+	if( it == pidIndex.end() )
+	{
+		return false;
+	}
+	unsigned int jobId = it->second;
+	pidIndex.erase( it );
+
+	Job & job = jobs[jobId];
+	job.usage.add( usage );
+	if( pid == job.lastPid )
+	{
+		job.status = status;
+	}
+	if( --job.running == 0 )
+	{
+		job.usage.wallTime = monotonicTime() - job.startTime;
+		// Like timeout(1), a job that ran out of time has status 124.
+		bool timedOut = clearDeadline( job.pid );
+		if( timedOut )
+		{
+			job.status = 124 << 8;
+		}
+		if( !job.quiet )
+		{
+			ostringstream notice;
+			notice << "[" << job.jobId << "] " << job.pid << ( timedOut ? " timed out " : " finished " ) << job.command << " (";
+			job.usage.print( notice );
+			notice << ")";
+			notices.push_back( notice.str() );
+		}
+		completions.push_back( make_pair( jobId, job.status ) );
+		if( completions.size() > MAX_COMPLETIONS )
+		{
+			completions.pop_front();
+		}
+		jobs.erase( jobId );
+	}
+	return true;
+}
+
+const Job *JobTable::find( unsigned int jobId ) const
+{
+	unordered_map<unsigned int, Job>::const_iterator it = jobs.find( jobId );
+	return it == jobs.end() ? NULL : &it->second;
+}
+
+bool JobTable::takeCompletion( unsigned int jobId, int & status )
+{
+	for( deque< pair<unsigned int, int> >::iterator it = completions.begin(); it != completions.end(); ++it )
+	{
+		if( it->first == jobId )
+		{
+			status = it->second;
+			completions.erase( it );
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JobTable::takeAnyCompletion( unsigned int & jobId, int & status )
+{
+	if( completions.empty() )
+	{
+		return false;
+	}
+	jobId = completions.front().first;
+	status = completions.front().second;
+	completions.pop_front();
+	return true;
+}
+
+void JobTable::printNotices( ostream & os )
+{
+	for( unsigned int i = 0; i < notices.size(); i++ )
+	{
+		os << notices[i] << endl;
+	}
+	notices.clear();
+}
+
+void JobTable::print( ostream & os, bool longForm ) const
+{
+	// Output a table heading above the list to make it look nice.
+	if( jobs.size() > 0 )
+	{
+		os << "[JOBID]\tPID\t" << ( longForm ? "REAL\tUSER\tSYS\tMAXRSS\tCTXSW\t" : "" ) << "COMMAND" << endl;
+	}
+
+	// The hash table has no order, so sort by job id for output.
+	vector<unsigned int> ids;
+	ids.reserve( jobs.size() );
+	for( unordered_map<unsigned int, Job>::const_iterator it = jobs.begin(); it != jobs.end(); ++it )
+	{
+		ids.push_back( it->first );
+	}
+	sort( ids.begin(), ids.end() );
+
+	for( unsigned int i = 0; i < ids.size(); i++ )
+	{
+		const Job & job = jobs.find( ids[i] )->second;
+		os << "[" << job.jobId << "]\t" << job.pid << "\t";
+		if( longForm )
+		{
+			// CPU time and memory are only known for stages that have exited.
+			ios::fmtflags flags = os.flags();
+			streamsize precision = os.precision();
+			os << fixed << setprecision( 2 ) << monotonicTime() - job.startTime << "s\t" << job.usage.userTime << "s\t"
+			   << job.usage.systemTime << "s\t";
+			os.flags( flags );
+			os.precision( precision );
+			printKilobytes( os, job.usage.maxRss );
+			os << "\t" << job.usage.contextSwitches << "\t";
+		}
+		os << job.command << endl;
+	}
+}
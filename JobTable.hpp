@@ -0,0 +1,75 @@
+#ifndef _JOB_TABLE_HPP_
+#define _JOB_TABLE_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "ResourceUsage.hpp"
+
+// A job that will go in the list of background jobs.
+struct Job
+{
+	std::string		command;	// E.g. du /home/username | grep eecs | sort --numeric --reverse | head
+	unsigned int	jobId;		// Unique, assigned by quash.
+	pid_t			pid;		// Pid of first child process forked when running the job, also its process group.
+	unsigned int	running;	// Stages that haven't been reaped yet.
+	pid_t			lastPid;	// Pid of the last stage, whose status is the job's.
+	int				status;		// waitpid() status of the last stage, once it has been reaped.
+	bool			quiet;		// No "finished" notice, e.g. for jobs started by parallel.
+	double			startTime;	// monotonicTime() when it was started.
+	ResourceUsage	usage;		// Of the stages reaped so far, and the wall time once it has finished.
+};
+
+// The background jobs, indexed both by job id and by the pid of every stage,
+// so reaping a child is a hash lookup however many jobs there are. Only ever
+// touched in normal context; children are reaped from the SIGCHLD signalfd
+// (see events.hpp), never from a signal handler.
+class JobTable
+{
+public:
+	JobTable();
+
+	// Adds a job made of the given stage pids (the first one is the job's
+	// pid) and returns it with its new job id.
+	const Job & add( const std::string & command, const std::vector<pid_t> & pids, bool quiet = false );
+	// Records that a child exited, and what it used. Returns false if pid
+	// isn't part of any job. When the job's last stage is reaped the job is
+	// removed, and its status kept for wait and a notice that it finished
+	// queued, with what the whole job used.
+	bool childExited( pid_t pid, int status, const struct rusage & usage );
+	// NULL if there's no such job, or it has finished.
+	const Job *find( unsigned int jobId ) const;
+
+	// Statuses of finished jobs, for wait. Each can be taken once. The oldest
+	// are forgotten if nobody waits for them.
+	// Takes the status of the given job if it has finished.
+	bool takeCompletion( unsigned int jobId, int & status );
+	// Takes the status of whichever job finished first.
+	bool takeAnyCompletion( unsigned int & jobId, int & status );
+	// Forgets all of them.
+	void clearCompletions() { completions.clear(); }
+
+	// Prints and forgets the notices of jobs that finished since last time.
+	void printNotices( std::ostream & os );
+	// Prints the jobs table, in job id order. The long form (jobs -l) adds the
+	// time each job has been running and what its finished stages used.
+	void print( std::ostream & os, bool longForm = false ) const;
+	size_t size() const { return jobs.size(); }
+
+private:
+	std::unordered_map<unsigned int, Job>	jobs;		// By job id.
+	std::unordered_map<pid_t, unsigned int>	pidIndex;	// Stage pid -> job id.
+	std::vector<std::string>				notices;	// "finished" messages not printed yet.
+	std::deque< std::pair<unsigned int, int> >	completions;	// (job id, status), oldest first.
+	unsigned int							nextJobId;	// Assign this to background jobs.
+};
+
+// Make the list of running background jobs an extern global so it can be used
+// in multiple source files.
+extern JobTable backgroundJobs;
+
+#endif
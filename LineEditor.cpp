@@ -0,0 +1,515 @@
+#include "LineEditor.hpp"
+#include "events.hpp"
+#include "Variables.hpp"
+#include "completion.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+using namespace std;
+
+// Keys that arrive as escape sequences, numbered past any byte.
+enum
+{
+	KEY_UP = 256,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_DELETE,
+	KEY_ESCAPE
+};
+
+static inline int control( char c )
+{
+	return c & 0x1f;
+}
+
+// UTF-8 continuation bytes don't take up a column of their own.
+static inline bool isContinuation( char c )
+{
+	return ( c & 0xc0 ) == 0x80;
+}
+
+static size_t columns( const char *text, size_t length )
+{
+	size_t count = 0;
+	for( size_t i = 0; i < length; i++ )
+	{
+		count += !isContinuation( text[i] );
+	}
+	return count;
+}
+
+static void writeOut( const string & text )
+{
+	const char *p = text.data();
+	size_t left = text.length();
+	while( left > 0 )
+	{
+		ssize_t written = write( STDOUT_FILENO, p, left );
+		if( written < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( written <= 0 )
+		{
+			return;
+		}
+		p += written;
+		left -= written;
+	}
+}
+
+LineEditor::LineEditor( History & history ) :
+	history( history ),
+	cursor( 0 ),
+	inHistory( false ),
+	entry( 0 )
+{
+}
+
+bool LineEditor::supported()
+{
+	const char *term = shellVariables.get( "TERM" );
+	return isatty( STDIN_FILENO ) && isatty( STDOUT_FILENO ) && ( term == NULL || strcmp( term, "dumb" ) != 0 );
+}
+
+int LineEditor::readKey()
+{
+	while( true )
+	{
+		waitForInput( STDIN_FILENO );
+		unsigned char c;
+		ssize_t got = read( STDIN_FILENO, &c, 1 );
+		if( got == 1 )
+		{
+			return c;
+		}
+		if( got == 0 || errno != EINTR )
+		{
+			return -1;
+		}
+	}
+}
+
+int LineEditor::readEscape()
+{
+	// A lone ESC is the Escape key; a sequence follows straight away.
+	struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+	if( poll( &input, 1, 50 ) <= 0 )
+	{
+		return KEY_ESCAPE;
+	}
+	int c = readKey();
+	if( c != '[' && c != 'O' )
+	{
+		return 0;
+	}
+	// CSI: parameters, then a final byte.
+	int parameter = 0;
+	while( true )
+	{
+		c = readKey();
+		if( c < 0 )
+		{
+			return 0;
+		}
+		if( c < '0' || c > '?' )
+		{
+			break;
+		}
+		if( c >= '0' && c <= '9' )
+		{
+			parameter = parameter * 10 + c - '0';
+		}
+	}
+	switch( c )
+	{
+	case 'A':	return KEY_UP;
+	case 'B':	return KEY_DOWN;
+	case 'C':	return KEY_RIGHT;
+	case 'D':	return KEY_LEFT;
+	case 'H':	return KEY_HOME;
+	case 'F':	return KEY_END;
+	case '~':
+		switch( parameter )
+		{
+		case 1:
+		case 7:	return KEY_HOME;
+		case 4:
+		case 8:	return KEY_END;
+		case 3:	return KEY_DELETE;
+		}
+	}
+	return 0;
+}
+
+void LineEditor::refresh()
+{
+	struct winsize size;
+	size_t width = ioctl( STDOUT_FILENO, TIOCGWINSZ, &size ) == 0 && size.ws_col > 0 ? size.ws_col : 80;
+	size_t promptWidth = columns( prompt.data(), prompt.length() );
+	size_t room = width > promptWidth + 1 ? width - promptWidth - 1 : 1;
+
+	// Scroll so the cursor is on screen, then show as much as fits.
+	size_t start = 0;
+	while( columns( buffer.data() + start, cursor - start ) > room )
+	{
+		do
+		{
+			start++;
+		} while( start < cursor && isContinuation( buffer[start] ) );
+	}
+	size_t end = start;
+	for( size_t shown = 0; end < buffer.length(); end++ )
+	{
+		if( !isContinuation( buffer[end] ) && shown++ == room )
+		{
+			break;
+		}
+	}
+
+	string output = "\r" + prompt;
+	output.append( buffer, start, end - start );
+	output += "\x1b[K\r";
+	size_t column = promptWidth + columns( buffer.data() + start, cursor - start );
+	if( column > 0 )
+	{
+		char move[32];
+		snprintf( move, sizeof( move ), "\x1b[%zuC", column );
+		output += move;
+	}
+	writeOut( output );
+}
+
+void LineEditor::showEntry( size_t begin, size_t end )
+{
+	buffer.assign( history.data() + begin, end - begin );
+	cursor = buffer.length();
+	entry = begin;
+}
+
+int LineEditor::search()
+{
+	string saved = buffer;
+	size_t savedCursor = cursor;
+	string query;
+	size_t begin = 0, end = 0;
+	bool found = false;
+
+	while( true )
+	{
+		// The match, with the cursor where the query is in it.
+		string line = string( found || query.empty() ? "" : "failed " ) + "(reverse-i-search)`" + query + "': ";
+		size_t column = columns( line.data(), line.length() );
+		if( found )
+		{
+			const char *match = (const char *)memmem( history.data() + begin, end - begin, query.data(), query.length() );
+			column += columns( history.data() + begin, match - ( history.data() + begin ) );
+			line.append( history.data() + begin, end - begin );
+		}
+		char move[32];
+		snprintf( move, sizeof( move ), "\x1b[K\r\x1b[%zuC", column );
+		writeOut( "\r" + line + move );
+
+		int key = readKey();
+		if( key == 0x1b )
+		{
+			key = readEscape();
+		}
+		bool typed = key >= ' ' && key < 256;
+		if( key == control( 'R' ) || typed || key == control( 'H' ) )
+		{
+			history.refresh();
+			size_t from = history.size();
+			if( key == control( 'R' ) )
+			{
+				// The next older match.
+				from = found ? begin : from;
+			}
+			else if( key == 0x7f || key == control( 'H' ) )
+			{
+				if( !query.empty() )
+				{
+					query.erase( query.length() - 1 );
+				}
+			}
+			else
+			{
+				// A longer query can still match the current entry.
+				query += (char)key;
+				from = found ? min( end + 1, history.size() ) : from;
+			}
+			size_t newBegin, newEnd;
+			if( history.search( query, from, newBegin, newEnd ) )
+			{
+				begin = newBegin;
+				end = newEnd;
+				found = true;
+			}
+			else if( key != control( 'R' ) )
+			{
+				found = false;
+			}
+			continue;
+		}
+
+		// Ctrl-G and Escape give up and bring back the line as it was.
+		if( key == control( 'G' ) || key == KEY_ESCAPE )
+		{
+			buffer = saved;
+			cursor = savedCursor;
+			return 0;
+		}
+		// Anything else takes the match and then does what it usually does.
+		if( found )
+		{
+			showEntry( begin, end );
+			inHistory = true;
+		}
+		return key;
+	}
+}
+
+void LineEditor::listMatches( const Completion & completion )
+{
+	struct winsize size;
+	size_t width = ioctl( STDOUT_FILENO, TIOCGWINSZ, &size ) == 0 && size.ws_col > 0 ? size.ws_col : 80;
+	size_t widest = 1;
+	for( size_t i = 0; i < completion.matches.size(); i++ )
+	{
+		widest = max( widest, columns( completion.matches[i].data(), completion.matches[i].length() ) );
+	}
+
+	// Down the columns then across, like ls.
+	size_t columnWidth = widest + 2;
+	size_t perRow = max( width / columnWidth, (size_t)1 );
+	size_t rows = ( completion.matches.size() + perRow - 1 ) / perRow;
+	string output = "\r\n";
+	for( size_t row = 0; row < rows; row++ )
+	{
+		for( size_t i = row; i < completion.matches.size(); i += rows )
+		{
+			const string & match = completion.matches[i];
+			output += match;
+			if( i + rows < completion.matches.size() )
+			{
+				output.append( columnWidth - columns( match.data(), match.length() ), ' ' );
+			}
+		}
+		output += "\r\n";
+	}
+	if( completion.count > completion.matches.size() )
+	{
+		char more[64];
+		snprintf( more, sizeof( more ), "(%zu more)\r\n", completion.count - completion.matches.size() );
+		output += more;
+	}
+	writeOut( output );
+}
+
+bool LineEditor::readLine( const string & prompt, string & line )
+{
+	this->prompt = prompt;
+	buffer.clear();
+	cursor = 0;
+	inHistory = false;
+	cout.flush();
+
+	// Raw mode, but output processing stays on so \n is still a newline.
+	tcgetattr( STDIN_FILENO, &original );
+	struct termios raw = original;
+	raw.c_lflag &= ~( ICANON | ECHO | ISIG | IEXTEN );
+	raw.c_iflag &= ~( IXON | ICRNL );
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr( STDIN_FILENO, TCSADRAIN, &raw );
+
+	bool gotLine = true;
+	int previousKey = 0;
+	refresh();
+	for( int key = 0; true; previousKey = key )
+	{
+		key = readKey();
+		if( key == 0x1b )
+		{
+			key = readEscape();
+		}
+		if( key == control( 'R' ) )
+		{
+			key = search();
+		}
+
+		if( key < 0 )
+		{
+			gotLine = false;
+			break;
+		}
+		if( key == '\r' || key == '\n' )
+		{
+			break;
+		}
+		if( key == control( 'C' ) )
+		{
+			// Throw the line away and start again on a fresh one.
+			cursor = buffer.length();
+			refresh();
+			writeOut( "^C" );
+			buffer.clear();
+			break;
+		}
+		if( key == control( 'D' ) && buffer.empty() )
+		{
+			gotLine = false;
+			break;
+		}
+
+		switch( key )
+		{
+		case KEY_LEFT:
+		case 2:		// Ctrl-B
+			while( cursor > 0 && isContinuation( buffer[--cursor] ) );
+			break;
+		case KEY_RIGHT:
+		case 6:		// Ctrl-F
+			while( cursor < buffer.length() && isContinuation( buffer[++cursor] ) );
+			break;
+		case KEY_HOME:
+		case 1:		// Ctrl-A
+			cursor = 0;
+			break;
+		case KEY_END:
+		case 5:		// Ctrl-E
+			cursor = buffer.length();
+			break;
+		case 0x7f:
+		case 8:		// Backspace, Ctrl-H
+			if( cursor > 0 )
+			{
+				size_t end = cursor;
+				while( cursor > 0 && isContinuation( buffer[--cursor] ) );
+				buffer.erase( cursor, end - cursor );
+			}
+			break;
+		case KEY_DELETE:
+		case 4:		// Ctrl-D
+			if( cursor < buffer.length() )
+			{
+				size_t end = cursor + 1;
+				while( end < buffer.length() && isContinuation( buffer[end] ) )
+				{
+					end++;
+				}
+				buffer.erase( cursor, end - cursor );
+			}
+			break;
+		case 11:	// Ctrl-K
+			buffer.erase( cursor );
+			break;
+		case 21:	// Ctrl-U
+			buffer.erase( 0, cursor );
+			cursor = 0;
+			break;
+		case 23:	// Ctrl-W
+		{
+			size_t end = cursor;
+			while( cursor > 0 && buffer[cursor - 1] == ' ' )
+			{
+				cursor--;
+			}
+			while( cursor > 0 && buffer[cursor - 1] != ' ' )
+			{
+				cursor--;
+			}
+			buffer.erase( cursor, end - cursor );
+			break;
+		}
+		case 12:	// Ctrl-L
+			writeOut( "\x1b[H\x1b[2J" );
+			break;
+		case '\t':
+		{
+			// Fill in what all the matches share; if that's nothing, a
+			// second Tab shows them.
+			Completion completion;
+			complete( buffer, cursor, completion );
+			if( !completion.insert.empty() )
+			{
+				buffer.insert( cursor, completion.insert );
+				cursor += completion.insert.length();
+			}
+			else if( completion.count > 1 && previousKey == '\t' )
+			{
+				listMatches( completion );
+			}
+			break;
+		}
+		case KEY_UP:
+		case 16:	// Ctrl-P
+		{
+			history.refresh();
+			size_t begin, end;
+			if( history.previous( inHistory ? entry : history.size(), begin, end ) )
+			{
+				if( !inHistory )
+				{
+					newLine = buffer;
+				}
+				showEntry( begin, end );
+				inHistory = true;
+			}
+			break;
+		}
+		case KEY_DOWN:
+		case 14:	// Ctrl-N
+		{
+			size_t begin, end;
+			if( !inHistory )
+			{
+				break;
+			}
+			if( history.next( entry, begin, end ) )
+			{
+				showEntry( begin, end );
+			}
+			else
+			{
+				buffer = newLine;
+				cursor = buffer.length();
+				inHistory = false;
+			}
+			break;
+		}
+		default:
+			// Typing, including the bytes of UTF-8 characters. Other control
+			// characters do nothing.
+			if( key >= ' ' && key < 256 && key != 0x7f )
+			{
+				buffer.insert( cursor++, 1, (char)key );
+			}
+			break;
+		}
+		refresh();
+	}
+
+	// Leave the cursor after the whole line, then give the terminal back.
+	if( gotLine || !buffer.empty() )
+	{
+		cursor = buffer.length();
+		refresh();
+	}
+	writeOut( "\r\n" );
+	tcsetattr( STDIN_FILENO, TCSADRAIN, &original );
+
+	line = buffer;
+	if( gotLine )
+	{
+		history.add( line );
+	}
+	return gotLine;
+}
@@ -0,0 +1,53 @@
+#ifndef _LINE_EDITOR_HPP_
+#define _LINE_EDITOR_HPP_
+
+#include <string>
+#include <termios.h>
+#include "History.hpp"
+
+struct Completion;
+
+// Reads lines from the terminal with emacs-style editing, the way readline
+// does by default: arrows, Home/End, Ctrl-A/E/B/F/K/U/W/L, Up/Down (Ctrl-P/N)
+// through the history, Ctrl-R to search it and Tab to complete. The terminal
+// is only in raw mode while a line is being read, so commands get it back as
+// they expect. Children are still reaped while it waits for keys.
+class LineEditor
+{
+public:
+	LineEditor( History & history );
+
+	// Whether the terminal on STDIN can be edited on, i.e. isn't TERM=dumb.
+	static bool supported();
+
+	// Shows prompt and reads a line into line. Returns false at EOF (Ctrl-D
+	// on an empty line) or if the terminal goes away.
+	bool readLine( const std::string & prompt, std::string & line );
+
+private:
+	// Reads one byte from the terminal. Returns -1 at EOF or on an error.
+	int readKey();
+	// Reads what follows an ESC and turns it into one of the keys below, or
+	// 0 if it isn't one of them.
+	int readEscape();
+	// Redraws the line, scrolled sideways if it's wider than the terminal.
+	void refresh();
+	// Ctrl-R: searches the history as the query is typed. Returns the key
+	// that ended the search, which the caller handles as usual (e.g. Enter).
+	int search();
+	// Replaces the line with a history entry.
+	void showEntry( size_t begin, size_t end );
+	// Tab twice: lists the matches below the line, in columns.
+	void listMatches( const Completion & completion );
+
+	History			&history;
+	std::string		prompt;
+	std::string		buffer;
+	size_t			cursor;			// Byte offset into buffer.
+	bool			inHistory;		// Whether the line is a history entry rather than a new one.
+	size_t			entry;			// History offset of the entry being shown.
+	std::string		newLine;		// The line being typed before Up was pressed.
+	struct termios	original;
+};
+
+#endif
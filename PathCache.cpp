@@ -0,0 +1,242 @@
+#include "PathCache.hpp"
+#include "utils.hpp"
+#include "Variables.hpp"
+#include "builtins.hpp"
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+using namespace std;
+
+PathCache pathCache;
+
+PathCache::PathCache() :
+	built( false ),
+	hits( 0 ),
+	misses( 0 )
+{
+}
+
+// Returns the full path of the executable, or "" if it isn't anywhere in PATH.
+string PathCache::lookup( const string & name )
+{
+	// Something like "bin/ls" can't come from a directory listing, so do what
+	// execute() used to do and probe each PATH directory for it.
+	if( name.find( '/' ) != string::npos )
+	{
+		const char *path = shellVariables.get( "PATH" );
+		vector<string> PATH = split( path ? path : "", ':' );
+		for( unsigned int i = 0; i < PATH.size(); i++ )
+		{
+			string cmd = PATH[i] + "/" + name;
+			if( access( cmd.c_str(), F_OK ) == 0 )
+			{
+				return cmd;
+			}
+		}
+		return "";
+	}
+
+	sync();
+
+	// A hit only has to check that the directory it came from hasn't changed.
+	unordered_map<string, unsigned int>::const_iterator it = table.find( name );
+	if( it != table.end() )
+	{
+		if( !refreshDirectory( it->second ) )
+		{
+			hits++;
+			remembered[name]++;
+			return dirs[it->second].path + "/" + name;
+		}
+		rebuildTable();
+	}
+
+	// Otherwise make sure every directory is current and try again.
+	misses++;
+	refreshAll();
+	it = table.find( name );
+	if( it == table.end() )
+	{
+		return "";
+	}
+	remembered[name]++;
+	return dirs[it->second].path + "/" + name;
+}
+
+void PathCache::clear()
+{
+	pathString.clear();
+	built = false;
+	dirs.clear();
+	table.clear();
+	remembered.clear();
+	commands.clear();
+
+	// As far as completing them goes, builtins are commands too.
+	unsigned int count;
+	const Builtin *builtins = allBuiltins( count );
+	for( unsigned int i = 0; i < count; i++ )
+	{
+		commands.insert( builtins[i].name, strlen( builtins[i].name ) );
+	}
+}
+
+void PathCache::print( ostream & os ) const
+{
+	if( remembered.size() > 0 )
+	{
+		os << "HITS\tCOMMAND" << endl;
+	}
+	for( map<string, unsigned int>::const_iterator it = remembered.begin(); it != remembered.end(); ++it )
+	{
+		unordered_map<string, unsigned int>::const_iterator entry = table.find( it->first );
+		os << it->second << "\t";
+		if( entry != table.end() )
+		{
+			os << dirs[entry->second].path << "/";
+		}
+		os << it->first << endl;
+	}
+
+	os << hits << " hits, " << misses << " misses, " << table.size() << " executables in "
+	   << dirs.size() << " PATH directories." << endl;
+}
+
+size_t PathCache::complete( const string & prefix, string & common, vector<string> & matches, size_t limit )
+{
+	sync();
+	refreshAll();
+	return commands.complete( prefix, common, matches, limit );
+}
+
+// Re-read PATH if it changed since the table was built.
+void PathCache::sync()
+{
+	const char *path = shellVariables.get( "PATH" );
+	string current = path ? path : "";
+	if( built && current == pathString )
+	{
+		return;
+	}
+
+	clear();
+	pathString = current;
+	vector<string> PATH = split( pathString, ':' );
+	dirs.resize( PATH.size() );
+	for( unsigned int i = 0; i < PATH.size(); i++ )
+	{
+		dirs[i].path = PATH[i];
+		dirs[i].valid = false;
+		memset( &dirs[i].mtime, 0, sizeof( dirs[i].mtime ) );
+	}
+	built = true;
+	refreshAll();
+}
+
+// Stat the directory and rescan it if it changed since the last scan.
+bool PathCache::refreshDirectory( unsigned int index )
+{
+	Directory & dir = dirs[index];
+
+	struct stat st;
+	if( stat( dir.path.c_str(), &st ) != 0 || !S_ISDIR( st.st_mode ) )
+	{
+		// Directory went away (or never existed).
+		bool changed = dir.valid;
+		dir.valid = false;
+		updateCommands( dir.names, vector<string>() );
+		dir.names.clear();
+		return changed;
+	}
+	if( dir.valid && st.st_mtim.tv_sec == dir.mtime.tv_sec && st.st_mtim.tv_nsec == dir.mtime.tv_nsec )
+	{
+		return false;
+	}
+
+	vector<string> before;
+	before.swap( dir.names );
+	DIR *d = opendir( dir.path.c_str() );
+	if( d == NULL )
+	{
+		bool changed = dir.valid;
+		dir.valid = false;
+		updateCommands( before, dir.names );
+		return changed;
+	}
+	struct dirent *entry;
+	while( ( entry = readdir( d ) ) != NULL )
+	{
+		// Subdirectories can't be executed, skip them (and "." and "..").
+		if( entry->d_type == DT_DIR )
+		{
+			continue;
+		}
+		dir.names.push_back( entry->d_name );
+	}
+	closedir( d );
+	sort( dir.names.begin(), dir.names.end() );
+	updateCommands( before, dir.names );
+
+	dir.mtime = st.st_mtim;
+	dir.valid = true;
+	return true;
+}
+
+// Both lists are sorted, so what changed falls out of one pass over them.
+void PathCache::updateCommands( const vector<string> & before, const vector<string> & after )
+{
+	vector<string>::const_iterator old = before.begin(), now = after.begin();
+	while( old != before.end() || now != after.end() )
+	{
+		if( now == after.end() || ( old != before.end() && *old < *now ) )
+		{
+			commands.remove( old->data(), old->length() );
+			++old;
+		}
+		else if( old == before.end() || *now < *old )
+		{
+			commands.insert( now->data(), now->length() );
+			++now;
+		}
+		else
+		{
+			++old;
+			++now;
+		}
+	}
+}
+
+// Stat every directory, rescan the changed ones, and rebuild if needed.
+void PathCache::refreshAll()
+{
+	bool changed = false;
+	for( unsigned int i = 0; i < dirs.size(); i++ )
+	{
+		if( refreshDirectory( i ) )
+		{
+			changed = true;
+		}
+	}
+	if( changed || table.empty() )
+	{
+		rebuildTable();
+	}
+}
+
+// Rebuild the name -> directory table. The first PATH directory that has a
+// name wins, the same order execute() used to search in.
+void PathCache::rebuildTable()
+{
+	table.clear();
+	for( unsigned int i = 0; i < dirs.size(); i++ )
+	{
+		for( unsigned int j = 0; j < dirs[i].names.size(); j++ )
+		{
+			table.insert( make_pair( dirs[i].names[j], i ) );
+		}
+	}
+}
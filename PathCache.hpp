@@ -0,0 +1,71 @@
+#ifndef _PATH_CACHE_HPP_
+#define _PATH_CACHE_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <ctime>
+#include "Trie.hpp"
+
+// Parent-side table of where each command lives in $PATH, like bash's "hash".
+// Built by reading each PATH directory once instead of probing every directory
+// with access() on every launch. A directory is scanned again when its mtime
+// changes, and everything is thrown away when PATH itself changes. The same
+// names are kept in a trie for completing command names; a rescan only adds
+// and removes the names that changed.
+class PathCache
+{
+public:
+	PathCache();
+
+	// Returns the full path of the executable named name, or the empty string
+	// if it isn't found in any of the directories in PATH. Names containing a
+	// '/' are looked up relative to each PATH directory but never remembered.
+	std::string lookup( const std::string & name );
+	// Forget everything, e.g. after PATH has been changed with set.
+	void clear();
+	// Print the remembered commands and the hit/miss counters.
+	void print( std::ostream & os ) const;
+	// Completes a command name from every executable in PATH, after
+	// rescanning any directory that changed. See Trie::complete().
+	size_t complete( const std::string & prefix, std::string & common, std::vector<std::string> & matches, size_t limit );
+
+private:
+	// One directory from PATH along with the names found in it.
+	struct Directory
+	{
+		std::string					path;
+		struct timespec				mtime;		// mtime when names was last read.
+		bool						valid;		// False if the directory couldn't be read.
+		std::vector<std::string>	names;		// Sorted.
+	};
+
+	// Re-read PATH if it changed since the table was built.
+	void sync();
+	// Stat the given directory and rescan it if it changed. Returns true if
+	// the directory's contents changed.
+	bool refreshDirectory( unsigned int index );
+	// Stat every directory, rescan the changed ones, and rebuild the table if
+	// anything changed.
+	void refreshAll();
+	// Rebuild table from the names of all directories, earliest PATH entry wins.
+	void rebuildTable();
+	// Brings commands up to date with a directory whose names were before.
+	void updateCommands( const std::vector<std::string> & before, const std::vector<std::string> & after );
+
+	std::string									pathString;	// PATH the table was built from.
+	bool										built;
+	std::vector<Directory>						dirs;
+	std::unordered_map<std::string, unsigned int>	table;		// Command name -> index into dirs.
+	std::map<std::string, unsigned int>			remembered;	// Command name -> hits, for printing.
+	Trie										commands;	// Every name in every directory.
+	unsigned long								hits;
+	unsigned long								misses;
+};
+
+// One table for the whole shell.
+extern PathCache pathCache;
+
+#endif
@@ -0,0 +1,81 @@
+#include "ResourceUsage.hpp"
+#include <iomanip>
+#include <time.h>
+using namespace std;
+
+static double seconds( const struct timeval & tv )
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void ResourceUsage::add( const struct rusage & usage )
+{
+	userTime += seconds( usage.ru_utime );
+	systemTime += seconds( usage.ru_stime );
+	// Stages that run side by side don't add up, only the biggest matters.
+	if( usage.ru_maxrss > maxRss )
+	{
+		maxRss = usage.ru_maxrss;
+	}
+	contextSwitches += usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+void ResourceUsage::add( const ResourceUsage & usage )
+{
+	userTime += usage.userTime;
+	systemTime += usage.systemTime;
+	if( usage.maxRss > maxRss )
+	{
+		maxRss = usage.maxRss;
+	}
+	contextSwitches += usage.contextSwitches;
+}
+
+void ResourceUsage::difference( const struct rusage & before, const struct rusage & after )
+{
+	userTime = seconds( after.ru_utime ) - seconds( before.ru_utime );
+	systemTime = seconds( after.ru_stime ) - seconds( before.ru_stime );
+	// Only the shell's own peak is known, which is a fair upper bound.
+	maxRss = after.ru_maxrss;
+	contextSwitches = ( after.ru_nvcsw + after.ru_nivcsw ) - ( before.ru_nvcsw + before.ru_nivcsw );
+}
+
+void ResourceUsage::print( ostream & os ) const
+{
+	ios::fmtflags flags = os.flags();
+	streamsize precision = os.precision();
+	os << fixed << setprecision( 2 );
+	os << "real " << wallTime << "s user " << userTime << "s sys " << systemTime << "s maxrss ";
+	printKilobytes( os, maxRss );
+	os << " ctxsw " << contextSwitches;
+	os.flags( flags );
+	os.precision( precision );
+}
+
+double monotonicTime()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void printKilobytes( ostream & os, long kilobytes )
+{
+	ios::fmtflags flags = os.flags();
+	streamsize precision = os.precision();
+	os << fixed << setprecision( 1 );
+	if( kilobytes < 1024 )
+	{
+		os << kilobytes << "K";
+	}
+	else if( kilobytes < 1024 * 1024 )
+	{
+		os << kilobytes / 1024.0 << "M";
+	}
+	else
+	{
+		os << kilobytes / ( 1024.0 * 1024.0 ) << "G";
+	}
+	os.flags( flags );
+	os.precision( precision );
+}
@@ -0,0 +1,43 @@
+#ifndef _RESOURCE_USAGE_HPP_
+#define _RESOURCE_USAGE_HPP_
+
+#include <iostream>
+#include <sys/resource.h>
+
+// What a stage, or a whole job, cost: the figures wait4() gives back for a
+// child, plus how long it took by the wall clock.
+struct ResourceUsage
+{
+	double	wallTime;			// Seconds, from starting it to reaping it.
+	double	userTime;			// CPU seconds.
+	double	systemTime;
+	long	maxRss;				// Kilobytes, the largest of any stage.
+	long	contextSwitches;	// Voluntary and involuntary.
+
+	ResourceUsage() :
+		wallTime( 0 ),
+		userTime( 0 ),
+		systemTime( 0 ),
+		maxRss( 0 ),
+		contextSwitches( 0 )
+	{
+	}
+
+	// Adds in a child's rusage (everything but the wall time).
+	void add( const struct rusage & usage );
+	// Adds in another stage's figures.
+	void add( const ResourceUsage & usage );
+	// Sets this to what was used between two getrusage() calls, for a builtin
+	// that ran inside the shell.
+	void difference( const struct rusage & before, const struct rusage & after );
+
+	// E.g. "real 1.20s user 0.85s sys 0.10s maxrss 12.5M ctxsw 143".
+	void print( std::ostream & os ) const;
+};
+
+// Seconds on the monotonic clock, for wall times.
+double monotonicTime();
+// Prints a size in kilobytes the short way, e.g. 980K, 12.5M, 2.1G.
+void printKilobytes( std::ostream & os, long kilobytes );
+
+#endif
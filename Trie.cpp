@@ -0,0 +1,181 @@
+#include "Trie.hpp"
+using namespace std;
+
+Trie::Trie()
+{
+	clear();
+}
+
+void Trie::clear()
+{
+	nodes.clear();
+	Node root = { 0, 0, 0, 0, '\0', false };
+	nodes.push_back( root );
+}
+
+size_t Trie::size() const
+{
+	return nodes[0].names;
+}
+
+uint32_t Trie::child( uint32_t node, char c ) const
+{
+	for( uint32_t i = nodes[node].child; i != 0; i = nodes[i].sibling )
+	{
+		if( nodes[i].c == c )
+		{
+			return i;
+		}
+		if( (unsigned char)nodes[i].c > (unsigned char)c )
+		{
+			break;
+		}
+	}
+	return 0;
+}
+
+uint32_t Trie::child( uint32_t node, char c, bool create )
+{
+	uint32_t previous = 0;
+	uint32_t i = nodes[node].child;
+	for( ; i != 0 && (unsigned char)nodes[i].c < (unsigned char)c; i = nodes[i].sibling )
+	{
+		previous = i;
+	}
+	if( i != 0 && nodes[i].c == c )
+	{
+		return i;
+	}
+	if( !create )
+	{
+		return 0;
+	}
+	// Kept in order, so names come out sorted.
+	uint32_t added = nodes.size();
+	Node fresh = { 0, i, 0, 0, c, false };
+	nodes.push_back( fresh );
+	if( previous == 0 )
+	{
+		nodes[node].child = added;
+	}
+	else
+	{
+		nodes[previous].sibling = added;
+	}
+	return added;
+}
+
+void Trie::insert( const char *name, size_t length, bool directory )
+{
+	uint32_t node = 0;
+	for( size_t i = 0; i < length; i++ )
+	{
+		node = child( node, name[i], true );
+	}
+	nodes[node].directory = directory;
+	if( nodes[node].count++ > 0 )
+	{
+		return;
+	}
+	// A new name: one more below everything on its way down.
+	node = 0;
+	nodes[0].names++;
+	for( size_t i = 0; i < length; i++ )
+	{
+		node = child( node, name[i] );
+		nodes[node].names++;
+	}
+}
+
+void Trie::remove( const char *name, size_t length )
+{
+	uint32_t node = 0;
+	for( size_t i = 0; i < length; i++ )
+	{
+		node = child( node, name[i] );
+		if( node == 0 )
+		{
+			return;
+		}
+	}
+	if( nodes[node].count == 0 || --nodes[node].count > 0 )
+	{
+		return;
+	}
+	node = 0;
+	nodes[0].names--;
+	for( size_t i = 0; i < length; i++ )
+	{
+		node = child( node, name[i] );
+		nodes[node].names--;
+	}
+}
+
+void Trie::collect( uint32_t node, string & name, vector<string> & matches, size_t limit ) const
+{
+	if( matches.size() >= limit )
+	{
+		return;
+	}
+	if( nodes[node].count > 0 )
+	{
+		matches.push_back( nodes[node].directory ? name + '/' : name );
+	}
+	for( uint32_t i = nodes[node].child; i != 0; i = nodes[i].sibling )
+	{
+		if( nodes[i].names > 0 )
+		{
+			name.push_back( nodes[i].c );
+			collect( i, name, matches, limit );
+			name.pop_back();
+		}
+	}
+}
+
+size_t Trie::complete( const string & prefix, string & common, vector<string> & matches, size_t limit ) const
+{
+	uint32_t node = 0;
+	for( size_t i = 0; i < prefix.length(); i++ )
+	{
+		node = child( node, prefix[i] );
+		if( node == 0 )
+		{
+			return 0;
+		}
+	}
+	size_t count = nodes[node].names;
+	if( count == 0 )
+	{
+		return 0;
+	}
+
+	// Follow the only way down for as long as there's only one.
+	uint32_t end = node;
+	while( nodes[end].count == 0 )
+	{
+		uint32_t only = 0;
+		unsigned int live = 0;
+		for( uint32_t i = nodes[end].child; i != 0 && live < 2; i = nodes[i].sibling )
+		{
+			if( nodes[i].names > 0 )
+			{
+				only = i;
+				live++;
+			}
+		}
+		if( live != 1 )
+		{
+			break;
+		}
+		common.push_back( nodes[only].c );
+		end = only;
+	}
+	if( count == 1 && nodes[end].directory )
+	{
+		common.push_back( '/' );
+	}
+
+	string name = prefix;
+	collect( node, name, matches, limit );
+	return count;
+}
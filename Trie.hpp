@@ -0,0 +1,56 @@
+#ifndef _TRIE_HPP_
+#define _TRIE_HPP_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// A set of names kept as a trie, for completing a prefix: finding where it
+// is takes one step per character, and each node knows how many names are
+// below it, so neither the count nor the common part of tens of thousands of
+// matches needs them all to be looked at. Names are counted, so the same name
+// from two places (e.g. two PATH directories) can be added and removed
+// independently, and removing one doesn't need the trie rebuilt.
+class Trie
+{
+public:
+	Trie();
+
+	// Adds a name, marking it as a directory if it's one.
+	void insert( const char *name, size_t length, bool directory = false );
+	// Takes back one insert() of name. Does nothing if it isn't there.
+	void remove( const char *name, size_t length );
+	void clear();
+	// How many different names there are.
+	size_t size() const;
+
+	// Completes prefix: returns how many names start with it, appends what
+	// every one of them has after prefix to common, and appends up to limit
+	// of them, in order, to matches. Directories get a '/' on the end in
+	// matches, and in common if there's only the one name.
+	size_t complete( const std::string & prefix, std::string & common, std::vector<std::string> & matches, size_t limit ) const;
+
+private:
+	// Children are a sorted list through sibling, so nodes are small and
+	// a whole trie is one vector. Nodes of removed names stay, with no names
+	// below them, until clear().
+	struct Node
+	{
+		uint32_t	child;		// First child, 0 for none (the root is never a child).
+		uint32_t	sibling;	// Next child of the same parent, 0 for none.
+		uint32_t	names;		// Names ending at or below this node.
+		uint16_t	count;		// Times the name ending here was added.
+		char		c;
+		bool		directory;
+	};
+
+	// The child of node for c, or 0. With create, adds it if it's missing.
+	uint32_t child( uint32_t node, char c, bool create );
+	uint32_t child( uint32_t node, char c ) const;
+	// Appends the names below node to matches, each starting with name.
+	void collect( uint32_t node, std::string & name, std::vector<std::string> & matches, size_t limit ) const;
+
+	std::vector<Node>	nodes;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "Variables.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <cctype>
+using namespace std;
+
+Variables shellVariables;
+
+extern char **environ;
+
+Variables::Variables() :
+	stale( true ),
+	status( 0 )
+{
+	for( char **entry = environ; *entry != NULL; entry++ )
+	{
+		const char *equals = strchr( *entry, '=' );
+		if( equals != NULL )
+		{
+			Variable & variable = table[string( *entry, equals - *entry )];
+			variable.value = equals + 1;
+			variable.exported = true;
+		}
+	}
+}
+
+const char *Variables::get( const string & name ) const
+{
+	map<string, Variable>::const_iterator found = table.find( name );
+	return found != table.end() ? found->second.value.c_str() : NULL;
+}
+
+bool Variables::set( const string & name, const string & value )
+{
+	if( !validName( name.data(), name.length() ) )
+	{
+		return false;
+	}
+	map<string, Variable>::iterator found = table.find( name );
+	if( found == table.end() )
+	{
+		Variable variable = { value, false };
+		table.insert( make_pair( name, variable ) );
+		return true;
+	}
+	if( found->second.exported && found->second.value != value )
+	{
+		stale = true;
+	}
+	found->second.value = value;
+	return true;
+}
+
+bool Variables::exportVariable( const string & name )
+{
+	if( !validName( name.data(), name.length() ) )
+	{
+		return false;
+	}
+	Variable & variable = table[name];
+	if( !variable.exported )
+	{
+		variable.exported = true;
+		stale = true;
+	}
+	return true;
+}
+
+void Variables::unset( const string & name )
+{
+	map<string, Variable>::iterator found = table.find( name );
+	if( found != table.end() )
+	{
+		stale = stale || found->second.exported;
+		table.erase( found );
+	}
+}
+
+char **Variables::environment()
+{
+	if( stale )
+	{
+		environmentStrings.clear();
+		for( map<string, Variable>::const_iterator i = table.begin(); i != table.end(); ++i )
+		{
+			if( i->second.exported )
+			{
+				environmentStrings.push_back( i->first + "=" + i->second.value );
+			}
+		}
+		// Only now that the strings have stopped moving.
+		environmentPointers.clear();
+		for( unsigned int i = 0; i < environmentStrings.size(); i++ )
+		{
+			environmentPointers.push_back( &environmentStrings[i][0] );
+		}
+		environmentPointers.push_back( NULL );
+		stale = false;
+	}
+	return environmentPointers.data();
+}
+
+void Variables::print( ostream & os, bool exportedOnly ) const
+{
+	for( map<string, Variable>::const_iterator i = table.begin(); i != table.end(); ++i )
+	{
+		if( exportedOnly && !i->second.exported )
+		{
+			continue;
+		}
+		if( exportedOnly )
+		{
+			os << "export ";
+		}
+		os << i->first << "='" << replaceAll( i->second.value, "'", "'\\''" ) << "'" << endl;
+	}
+}
+
+bool Variables::validName( const char *name, size_t length )
+{
+	if( length == 0 || isdigit( (unsigned char)name[0] ) )
+	{
+		return false;
+	}
+	for( size_t i = 0; i < length; i++ )
+	{
+		if( !isalnum( (unsigned char)name[i] ) && name[i] != '_' )
+		{
+			return false;
+		}
+	}
+	return true;
+}
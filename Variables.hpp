@@ -0,0 +1,64 @@
+#ifndef _VARIABLES_HPP_
+#define _VARIABLES_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+// The shell's variables, exported or not. Starts out as a copy of the
+// environment quash was given. Children get only the exported ones, from an
+// envp array that's built once and then reused for every launch until an
+// exported variable changes, so running a command never has to look at the
+// environment again. The lexer expands $NAME and ${NAME} from here.
+class Variables
+{
+public:
+	// Fills the table from environ.
+	Variables();
+
+	// The variable's value, or NULL if it isn't set.
+	const char *get( const std::string & name ) const;
+	// Sets a variable, which stays exported if it was. Returns false if name
+	// isn't a valid name.
+	bool set( const std::string & name, const std::string & value );
+	// Marks a variable to be passed on to children, setting it to "" first
+	// if it isn't set. Returns false if name isn't a valid name.
+	bool exportVariable( const std::string & name );
+	void unset( const std::string & name );
+
+	// NULL-terminated "NAME=value" strings of the exported variables, for
+	// execve() and posix_spawn(). Good until a variable is next changed.
+	char **environment();
+
+	// Exit status of the last line, which $? expands to.
+	int lastStatus() const { return status; }
+	void setLastStatus( int lastStatus ) { status = lastStatus; }
+
+	// Prints them, one per line, as NAME='value', or as export NAME='value'
+	// and only the exported ones if exportedOnly.
+	void print( std::ostream & os, bool exportedOnly ) const;
+
+	// Letters, digits and underscores, not starting with a digit.
+	static bool validName( const char *name, size_t length );
+
+private:
+	struct Variable
+	{
+		std::string	value;
+		bool		exported;
+	};
+
+	// Sorted, so printing them needs no sort.
+	std::map<std::string, Variable>	table;
+	// envp and the strings it points to, rebuilt when stale is set.
+	std::vector<std::string>		environmentStrings;
+	std::vector<char *>				environmentPointers;
+	bool							stale;
+	int								status;
+};
+
+// One table for the whole shell.
+extern Variables shellVariables;
+
+#endif
@@ -0,0 +1,279 @@
+// Micro-benchmarks of quash's hot paths, run by "make bench". Prints one JSON
+// object per line: the benchmark's name, nanoseconds per operation and heap
+// allocations per operation (counted by the operator new below). With
+// --check, as run by "make check", it only runs the parsing ones, and fails
+// if parsing a line allocates at all once it's warmed up.
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <time.h>
+#include "utils.hpp"
+#include "lexer.hpp"
+#include "builtins.hpp"
+#include "PathCache.hpp"
+#include "Variables.hpp"
+#include "History.hpp"
+#include "Trie.hpp"
+#include "completion.hpp"
+#include <unistd.h>
+using namespace std;
+
+// Every heap allocation in the process, so a benchmark can say how many it
+// makes per operation.
+static unsigned long allocations = 0;
+
+void *operator new( size_t size )
+{
+	allocations++;
+	void *p = malloc( size ? size : 1 );
+	if( p == NULL )
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[]( size_t size )
+{
+	return operator new( size );
+}
+
+void operator delete( void *p ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void *p ) noexcept
+{
+	free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void *p, size_t ) noexcept
+{
+	free( p );
+}
+
+// Results have to go somewhere the optimizer can't see through.
+static volatile size_t sink;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Runs body iterations times, after a warm-up run, and prints the result.
+// Returns how many allocations it made, warm-up aside.
+template<typename Body>
+static unsigned long bench( const char *name, unsigned long iterations, Body body )
+{
+	body();
+
+	unsigned long allocationsBefore = allocations;
+	double start = now();
+	for( unsigned long i = 0; i < iterations; i++ )
+	{
+		body();
+	}
+	double elapsed = now() - start;
+	unsigned long allocated = allocations - allocationsBefore;
+
+	printf( "{\"suite\":\"micro\",\"bench\":\"%s\",\"shell\":\"quash\",\"value\":%.1f,\"unit\":\"ns/op\",\"allocs_per_op\":%.2f}\n",
+		name, elapsed / iterations, (double)allocated / iterations );
+	fflush( stdout );
+	return allocated;
+}
+
+// A typical line, with a pipe, quotes and a redirect.
+static const char *LINE = "ls -al \"/home/user/My Documents\" | grep -v '.txt' | sort -k 5 -n > listing.out";
+
+int main( int argc, char **argv )
+{
+	// Enough for a stable number without making make bench slow.
+	bool check = argc > 1 && strcmp( argv[1], "--check" ) == 0;
+	unsigned long iterations = argc > 1 && !check ? strtoul( argv[1], NULL, 10 ) : 200000;
+	string line = LINE;
+	vector<Command> commandList;
+	commandList.reserve( 8 );
+
+	unsigned long parseAllocations = bench( "parseLine", iterations, [&]()
+	{
+		commandList.clear();
+		lineArena.release();
+		parseLine( line.data(), line.length(), lineArena, commandList );
+		sink = commandList.size();
+	} );
+
+	// The same line with variables to expand.
+	shellVariables.set( "DIR", "/home/user/My Documents" );
+	shellVariables.set( "PATTERN", ".txt" );
+	string variableLine = "ls -al \"$DIR\" | grep -v ${PATTERN} | sort -k 5 -n > listing.out";
+	parseAllocations += bench( "parseLine $VAR", iterations, [&]()
+	{
+		commandList.clear();
+		lineArena.release();
+		parseLine( variableLine.data(), variableLine.length(), lineArena, commandList );
+		sink = commandList.size();
+	} );
+
+	// getInput() reads from a stream; give it one long enough for every
+	// iteration, built up front.
+	string lines;
+	for( unsigned long i = 0; i <= iterations; i++ )
+	{
+		lines += line;
+		lines += '\n';
+	}
+	istringstream input( lines );
+	parseAllocations += bench( "getInput", iterations, [&]()
+	{
+		commandList.clear();
+		lineArena.release();
+		getInput( input, commandList );
+		sink = commandList.size();
+	} );
+
+	// Once the arena and the command list have grown to fit, a line is
+	// parsed without touching the heap.
+	if( check )
+	{
+		if( parseAllocations != 0 )
+		{
+			fprintf( stderr, "check failed: parsing made %lu allocations after warming up, expected 0.\n",
+				parseAllocations );
+			return 1;
+		}
+		return 0;
+	}
+
+	bench( "split", iterations, [&]()
+	{
+		sink = split( line, ' ' ).size();
+	} );
+
+	bench( "replaceAll", iterations, [&]()
+	{
+		sink = replaceAll( line, "|", " | " ).length();
+	} );
+
+	bench( "createArgv", iterations, [&]()
+	{
+		char **args = createArgv( line );
+		size_t count = 0;
+		for( ; args[count] != NULL; count++ )
+		{
+			delete[] args[count];
+		}
+		delete[] args;
+		sink = count;
+	} );
+
+	// Commands can't be copied any more, only moved; this is what used to be
+	// the copy into the job list and the pipeline.
+	commandList.clear();
+	lineArena.release();
+	parseLine( line.data(), line.length(), lineArena, commandList );
+	vector<Command> moved;
+	moved.reserve( 8 );
+	bench( "Command move", iterations, [&]()
+	{
+		for( unsigned int i = 0; i < commandList.size(); i++ )
+		{
+			moved.push_back( move( commandList[i] ) );
+		}
+		commandList.clear();
+		for( unsigned int i = 0; i < moved.size(); i++ )
+		{
+			commandList.push_back( move( moved[i] ) );
+		}
+		moved.clear();
+		sink = commandList.size();
+	} );
+
+	const char *names[] = { "cd", "ls", "jobs", "grep", "exit", "parallel" };
+	unsigned long n = 0;
+	bench( "findBuiltin", iterations, [&]()
+	{
+		sink = findBuiltin( names[n++ % 6] ) != NULL;
+	} );
+
+	bench( "PATH lookup", iterations, [&]()
+	{
+		sink = pathCache.lookup( "ls" ).length();
+	} );
+
+	// Tab on a PATH the size of ours, 50k names, for a prefix a few hundred
+	// of them share. Then the real thing on this machine's PATH.
+	Trie executables;
+	char name[64];
+	for( unsigned int i = 0; i < 50000; i++ )
+	{
+		static const char *stems[] = { "git-%u", "x86_64-linux-gnu-tool%u", "py%u", "lib%u-config", "k%u" };
+		int length = snprintf( name, sizeof( name ), stems[i % 5], i );
+		executables.insert( name, length );
+	}
+	string common;
+	vector<string> matches;
+	string prefix = "git-1";
+	bench( "Trie complete (50k)", iterations / 10 + 1, [&]()
+	{
+		common.clear();
+		matches.clear();
+		sink = executables.complete( prefix, common, matches, MAX_MATCHES );
+	} );
+	Completion completion;
+	string typed = "gi";
+	bench( "complete command", iterations / 10 + 1, [&]()
+	{
+		complete( typed, typed.length(), completion );
+		sink = completion.count;
+	} );
+
+	// Ctrl-R through a million entries, for one only the oldest has, and for
+	// the newest match of a common one. Timed after the index is built.
+	char historyFile[] = "/tmp/quash-bench-historyXXXXXX";
+	int historyFd = mkstemp( historyFile );
+	if( historyFd >= 0 )
+	{
+		string entries = "ssh deploy@build-server\n";
+		char entry[128];
+		for( unsigned int i = 1; i < 1000000; i++ )
+		{
+			static const char *commands[] = { "git commit -m 'change %u'", "make -j%u", "ls -l /usr/lib/%u", "grep -rn item%u src" };
+			snprintf( entry, sizeof( entry ), commands[i % 4], i );
+			entries += entry;
+			entries += '\n';
+		}
+		bool written = write( historyFd, entries.data(), entries.length() ) == (ssize_t)entries.length();
+		close( historyFd );
+		shellVariables.set( "HISTFILE", historyFile );
+		History history;
+		history.open();
+		size_t begin, end;
+		string oldest = "deploy@build", common = "make";
+		sink = written && history.search( oldest, history.size(), begin, end );
+		bench( "History search (1M, oldest)", iterations / 2000 + 1, [&]()
+		{
+			sink = history.search( oldest, history.size(), begin, end );
+		} );
+		bench( "History search (1M, newest)", iterations, [&]()
+		{
+			sink = history.search( common, history.size(), begin, end );
+		} );
+		unlink( historyFile );
+	}
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+#!/bin/sh
+# End-to-end benchmarks, run by "make bench" after the micro-benchmarks.
+# Each one runs the same script under quash and, if they're installed, dash
+# and bash, and prints a JSON object per result to stdout in the same form as
+# quash-bench. A summary table goes to stderr.
+#
+# Sizes can be turned down for a quick run, e.g.
+#   BENCH_LAUNCHES=200 BENCH_PIPE_MB=64 BENCH_LINES=10000 BENCH_JOBS=1000 \
+#   BENCH_GLOB_FILES=10000 make bench
+#
+# bench.sh --check, run by "make check", only runs the fd leak check below,
+# and fails if it finds any.
+
+QUASH=${QUASH:-./quash}
+LAUNCHES=${BENCH_LAUNCHES:-2000}
+PIPE_MB=${BENCH_PIPE_MB:-1024}
+LINES=${BENCH_LINES:-100000}
+JOBS=${BENCH_JOBS:-10000}
+GLOB_FILES=${BENCH_GLOB_FILES:-1000000}
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/quash-bench.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+# Keep the compiled script cache out of the user's own.
+XDG_CACHE_HOME=$WORK/cache
+export XDG_CACHE_HOME
+
+SHELLS="quash"
+for other in dash bash; do
+	if command -v $other > /dev/null 2>&1; then
+		SHELLS="$SHELLS $other"
+	fi
+done
+
+shell_path()
+{
+	if [ "$1" = quash ]; then
+		echo "$QUASH"
+	else
+		command -v "$1"
+	fi
+}
+
+nanoseconds()
+{
+	date +%s%N
+}
+
+# result <bench> <shell> <value> <unit>
+result()
+{
+	printf '{"suite":"e2e","bench":"%s","shell":"%s","value":%s,"unit":"%s"}\n' "$1" "$2" "$3" "$4"
+	printf '%-28s %-8s %14s %s\n' "$1" "$2" "$3" "$4" >&2
+}
+
+# Not a speed test: a regression check that the shell's fd count stays flat
+# over a long script of redirects and pipes, and that no child inherits a
+# stray fd. Prints how many fdcheck reports quash made, which should be 0.
+fd_leaks()
+{
+	lines $((LINES / 4)) "echo line %d > \"$WORK/fd1\"\ncat \"$WORK/fd1\" > \"$WORK/fd2\"\ntee \"$WORK/fd3\" < \"$WORK/fd2\" > /dev/null\necho x | true" > "$WORK/fds.sh"
+	env QUASH_FDCHECK=1 "$QUASH" "$WORK/fds.sh" 2>&1 | grep -c "fdcheck"
+}
+
+# Runs "<shell> <args>" with stdout thrown away and prints how long it took
+# in nanoseconds.
+run_timed()
+{
+	start=$(nanoseconds)
+	"$@" > /dev/null 2>&1
+	end=$(nanoseconds)
+	echo $((end - start))
+}
+
+# Divides two integers to one decimal place.
+divide()
+{
+	awk -v a="$1" -v b="$2" 'BEGIN { printf "%.1f", a / b }'
+}
+
+# lines <count> <format>: prints the printf format count times, with the line
+# number for any %d in it.
+lines()
+{
+	awk -v n="$1" -v format="$2\n" 'BEGIN { for( i = 0; i < n; i++ ) printf format, i }'
+}
+
+if [ "$1" = --check ]; then
+	reports=$(fd_leaks)
+	if [ "$reports" -ne 0 ]; then
+		echo "check failed: $reports fdcheck reports in ${LINES} lines, expected 0." >&2
+		exit 1
+	fi
+	exit 0
+fi
+
+printf '%-28s %-8s %14s %s\n' BENCHMARK SHELL VALUE UNIT >&2
+
+# Time to start and wait for a command: a script of nothing but /bin/true.
+lines "$LAUNCHES" '/bin/true' > "$WORK/launch.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/launch.sh")
+	result "launch /bin/true" "$sh" "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+done
+for backend in fork spawn; do
+	ns=$(run_timed env QUASH_LAUNCH=$backend "$QUASH" "$WORK/launch.sh")
+	result "launch /bin/true ($backend)" quash "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+done
+
+# The same, setting a variable before each launch and passing it on, with
+# 100 more exported for children to inherit.
+lines 100 'export BENCH_VARIABLE_%d=value' > "$WORK/variables.sh"
+lines "$LAUNCHES" 'COUNT=%d\n/bin/true "$COUNT"' >> "$WORK/variables.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/variables.sh")
+	result "launch with variables" "$sh" "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+done
+
+# Pipeline throughput: PIPE_MB megabytes through three cats.
+PIPELINE="head -c ${PIPE_MB}M /dev/zero | cat | cat | cat > /dev/null"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" -c "$PIPELINE")
+	result "cat|cat|cat ${PIPE_MB}MB" "$sh" "$(divide $((PIPE_MB * 1000000000)) "$ns")" "MB/s"
+done
+# The same with 1M pipes (set -o pipesize), which quash alone can do.
+ns=$(run_timed "$QUASH" -c "pipesize 1M $PIPELINE")
+result "cat|cat|cat ${PIPE_MB}MB (1M pipes)" quash "$(divide $((PIPE_MB * 1000000000)) "$ns")" "MB/s"
+
+# Fan-out: PIPE_MB megabytes copied to two files and stdout by tee, which is
+# quash's splice() builtin or coreutils for the others.
+FANOUT="head -c ${PIPE_MB}M /dev/zero | tee \"$WORK/tee1\" \"$WORK/tee2\" > /dev/null"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" -c "$FANOUT")
+	result "tee fan-out ${PIPE_MB}MB" "$sh" "$(divide $((PIPE_MB * 1000000000)) "$ns")" "MB/s"
+done
+rm -f "$WORK/tee1" "$WORK/tee2"
+
+# Copying a 1MB file with cat, which quash does itself with copy_file_range().
+head -c 1M /dev/urandom > "$WORK/copy.src"
+lines "$LAUNCHES" "cat \"$WORK/copy.src\" > \"$WORK/copy.out\"" > "$WORK/copy.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/copy.sh")
+	result "cat 1MB file > file" "$sh" "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+done
+
+# A long script of cheap builtins, so it's mostly reading and parsing. quash
+# is run cold (nothing cached) and warm (compiled script cached).
+lines "$LINES" "cd \"$WORK\" # line %d" > "$WORK/lines.sh"
+for sh in $SHELLS; do
+	if [ "$sh" = quash ]; then
+		rm -rf "$XDG_CACHE_HOME"
+		ns=$(run_timed "$QUASH" "$WORK/lines.sh")
+		result "${LINES}-line script (cold)" quash "$(divide "$ns" 1000000)" "ms"
+		ns=$(run_timed "$QUASH" "$WORK/lines.sh")
+		result "${LINES}-line script (warm)" quash "$(divide "$ns" 1000000)" "ms"
+	else
+		ns=$(run_timed "$(shell_path $sh)" "$WORK/lines.sh")
+		result "${LINES}-line script" "$sh" "$(divide "$ns" 1000000)" "ms"
+	fi
+done
+
+# A script of the utilities quash has built in, so nothing needs forking.
+lines $((LINES / 4)) 'echo line %d\ntest -d / -a -n "x"\nprintf "%%s %%d\\n" a 1\ntrue' > "$WORK/builtins.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/builtins.sh")
+	result "${LINES}-line builtin script" "$sh" "$(divide "$ns" 1000000)" "ms"
+done
+
+reports=$(fd_leaks)
+result "fd leaks in ${LINES} lines" quash "$reports" "reports"
+
+# Passing one command's output to another through a temporary file, the way
+# scripts had to before quash had $(...), against passing it through a
+# substitution, which quash reads from a pipe. Two launches per line either way.
+lines "$LAUNCHES" "/bin/echo line %d > \"$WORK/substitution.tmp\"\nwc -c < \"$WORK/substitution.tmp\"" > "$WORK/tempfile.sh"
+lines "$LAUNCHES" 'echo "$(/bin/echo line %d)" | wc -c' > "$WORK/substitution.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/tempfile.sh")
+	result "output via temp file" "$sh" "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/substitution.sh")
+	result "output via \$(...)" "$sh" "$(divide "$ns" $((LAUNCHES * 1000)))" "us/op"
+done
+# Four independent substitutions of a 100ms sleep: 100ms if they run at once,
+# which quash only does when asked to.
+printf 'echo $(sleep 0.1) $(sleep 0.1) $(sleep 0.1) $(sleep 0.1)\n' > "$WORK/sleeps.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/sleeps.sh")
+	result "4 x \$(sleep 0.1)" "$sh" "$(divide "$ns" 1000000)" "ms"
+done
+printf 'set -o substitutions=parallel\n' | cat - "$WORK/sleeps.sh" > "$WORK/parallel-sleeps.sh"
+ns=$(run_timed "$QUASH" "$WORK/parallel-sleeps.sh")
+result "4 x \$(sleep 0.1), parallel" quash "$(divide "$ns" 1000000)" "ms"
+
+# Expanding *.log in a directory of GLOB_FILES entries, a tenth of them .log,
+# then a line with it twice, which quash lists the directory once for.
+mkdir "$WORK/glob"
+lines "$GLOB_FILES" 'f%d.dat' | (cd "$WORK/glob" && xargs touch)
+lines $((GLOB_FILES / 10)) 'f%d.log' | (cd "$WORK/glob" && xargs touch)
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" -c "echo $WORK/glob/*.log")
+	result "glob *.log in ${GLOB_FILES}" "$sh" "$(divide "$ns" 1000000)" "ms"
+	ns=$(run_timed "$(shell_path $sh)" -c "echo $WORK/glob/*.log $WORK/glob/*.log")
+	result "glob *.log twice in ${GLOB_FILES}" "$sh" "$(divide "$ns" 1000000)" "ms"
+done
+rm -rf "$WORK/glob"
+
+# Starting, reaping and waiting for lots of background jobs.
+lines "$JOBS" '/bin/true &' > "$WORK/jobs.sh"
+echo wait >> "$WORK/jobs.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/jobs.sh")
+	result "${JOBS} background jobs" "$sh" "$(divide "$ns" 1000000)" "ms"
+done
+
+# timeout: quash's prefix keeps the deadline on one timerfd, the others run
+# coreutils' timeout, a process in between for every command. Then a job
+# that ignores SIGTERM, which lasts until the SIGKILL after the grace period.
+lines "$JOBS" 'timeout 10 /bin/true' > "$WORK/timeout.sh"
+for sh in $SHELLS; do
+	ns=$(run_timed "$(shell_path $sh)" "$WORK/timeout.sh")
+	result "${JOBS} x timeout 10 /bin/true" "$sh" "$(divide "$ns" 1000000)" "ms"
+	# Same 2s grace as quash's.
+	grace="-k 2"
+	if [ "$sh" = quash ]; then
+		grace=""
+	fi
+	ns=$(run_timed "$(shell_path $sh)" -c "timeout $grace 0.1 sh -c 'trap \"\" TERM; sleep 10'")
+	result "timeout 0.1 of a job ignoring SIGTERM" "$sh" "$(divide "$ns" 1000000)" "ms"
+done
+
+# quash -d: requests through quashc, one client at a time and four at once,
+# against starting quash for each one. LAUNCHES/10 of those, as sh has to
+# fork and exec it.
+QUASHC=${QUASHC:-./quashc}
+"$QUASH" -d "$WORK/quashd.sock" &
+daemon=$!
+while [ ! -S "$WORK/quashd.sock" ]; do sleep 0.01; done
+for clients in 1 4; do
+	for command in true /bin/true; do
+		set -- $("$QUASHC" -s "$WORK/quashd.sock" -n "$LAUNCHES" -j $clients "$command")
+		result "quashd $command x$clients" quash "$1" "req/s"
+		result "quashd $command x$clients p50" quash "$2" "us"
+		result "quashd $command x$clients p99" quash "$3" "us"
+	done
+done
+kill $daemon
+wait $daemon 2> /dev/null
+start=$(nanoseconds)
+i=0
+while [ $i -lt $((LAUNCHES / 10)) ]; do
+	"$QUASH" -c /bin/true
+	i=$((i + 1))
+done
+end=$(nanoseconds)
+result "quash -c /bin/true per call" quash "$(divide $((end - start)) $((LAUNCHES / 10 * 1000)))" "us/op"
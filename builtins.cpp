@@ -0,0 +1,177 @@
+#include "builtins.hpp"
+#include "utils.hpp"
+#include "utilities.hpp"
+#include "trace.hpp"
+#include "FileDescriptor.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+using namespace std;
+
+// The registry. Adding a builtin is adding a line here; the hash below is
+// recomputed for the new set of names at compile time.
+static constexpr Builtin builtins[] =
+{
+	{ "exit", exitBuiltin },
+	{ "quit", exitBuiltin },
+	{ "cd", cd },
+	{ "set", ::set },
+	{ "jobs", jobs },
+	{ "kill", kill },
+	{ "help", help },
+	{ "hash", ::hash },
+	{ "wait", wait },
+	{ "parallel", parallel },
+	{ "echo", echoBuiltin },
+	{ "printf", printfBuiltin },
+	{ "test", testBuiltin },
+	{ "[", bracketBuiltin },
+	{ "true", trueBuiltin },
+	{ "false", falseBuiltin },
+	{ "pwd", pwdBuiltin },
+	{ "sleep", sleepBuiltin },
+	{ "tee", teeBuiltin },
+	{ "export", exportBuiltin },
+	{ "unset", unset },
+};
+
+static constexpr unsigned int BUILTIN_COUNT = sizeof( builtins ) / sizeof( builtins[0] );
+// Power of two, comfortably bigger than the number of builtins.
+static constexpr unsigned int TABLE_BITS = 6;
+static constexpr unsigned int TABLE_SIZE = 1u << TABLE_BITS;
+static_assert( BUILTIN_COUNT < TABLE_SIZE, "Builtin hash table is too small." );
+
+// FNV-1a, with a seed mixed in so different hash functions can be tried.
+static constexpr unsigned int hashName( const char *name, unsigned int seed )
+{
+	unsigned int h = 2166136261u ^ seed;
+	for( ; *name; name++ )
+	{
+		h ^= (unsigned char)*name;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// The slot comes from the top bits. The low bits of FNV-1a only depend on the
+// low bits of the seed, so they'd give just TABLE_SIZE different hashes to
+// choose from.
+static constexpr unsigned int slotOf( const char *name, unsigned int seed )
+{
+	return hashName( name, seed ) >> ( 32 - TABLE_BITS );
+}
+
+// True if no two builtin names land in the same slot with this seed.
+static constexpr bool isPerfect( unsigned int seed )
+{
+	bool used[TABLE_SIZE] = {};
+	for( unsigned int i = 0; i < BUILTIN_COUNT; i++ )
+	{
+		unsigned int slot = slotOf( builtins[i].name, seed );
+		if( used[slot] )
+		{
+			return false;
+		}
+		used[slot] = true;
+	}
+	return true;
+}
+
+static constexpr unsigned int findSeed()
+{
+	for( unsigned int seed = 0; seed < 100000; seed++ )
+	{
+		if( isPerfect( seed ) )
+		{
+			return seed;
+		}
+	}
+	return ~0u;
+}
+
+static constexpr unsigned int SEED = findSeed();
+static_assert( SEED != ~0u, "No perfect hash found for the builtin names." );
+
+// Slot -> index into builtins, -1 for empty slots.
+struct SlotTable
+{
+	signed char	index[TABLE_SIZE];
+};
+
+static constexpr SlotTable buildSlotTable()
+{
+	SlotTable table = {};
+	for( unsigned int i = 0; i < TABLE_SIZE; i++ )
+	{
+		table.index[i] = -1;
+	}
+	for( unsigned int i = 0; i < BUILTIN_COUNT; i++ )
+	{
+		table.index[slotOf( builtins[i].name, SEED )] = (signed char)i;
+	}
+	return table;
+}
+
+static constexpr SlotTable slots = buildSlotTable();
+
+const Builtin *findBuiltin( const char *name )
+{
+	if( name == NULL )
+	{
+		return NULL;
+	}
+	int i = slots.index[slotOf( name, SEED )];
+	if( i < 0 || strcmp( builtins[i].name, name ) != 0 )
+	{
+		return NULL;
+	}
+	return &builtins[i];
+}
+
+const Builtin *allBuiltins( unsigned int & count )
+{
+	count = BUILTIN_COUNT;
+	return builtins;
+}
+
+int runBuiltin( const Builtin *builtin, const Command & command, int infd, int outfd )
+{
+	// File redirects replace the given fds for the builtin's own use; they're
+	// opened here rather than dup2()'d over the shell's STDIN/STDOUT.
+	FileDescriptor inputFile;
+	FileDescriptor outputFile;
+	long long start = tracing() ? traceTime() : 0;
+	if( command.inputFilename[0] != '\0' )
+	{
+		inputFile.reset( open( command.inputFilename, O_RDONLY | O_CLOEXEC ) );
+		if( !inputFile.valid() )
+		{
+			cerr << "Couldn't open \"" << command.inputFilename << "\"." << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if( truncateOutputs( command.truncatedOutputs ) != 0 )
+	{
+		return EXIT_FAILURE;
+	}
+	if( command.outputFilename[0] != '\0' )
+	{
+		outputFile.reset( open( command.outputFilename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 ) );
+		if( !outputFile.valid() )
+		{
+			cerr << "Couldn't open \"" << command.outputFilename << "\"." << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if( inputFile.valid() || outputFile.valid() )
+	{
+		traceSpan( "redirect", start, command.rawString );
+	}
+
+	TraceSpan span( "builtin", command.argv[0] );
+	return builtin->handler( command.argv, inputFile.valid() ? inputFile.get() : infd,
+		outputFile.valid() ? outputFile.get() : outfd );
+}
@@ -0,0 +1,27 @@
+#ifndef _BUILTINS_HPP_
+#define _BUILTINS_HPP_
+
+#include "Command.hpp"
+
+// Every builtin takes its argv plus the fds to use as its STDIN and STDOUT,
+// which may be pipes or redirected files, and returns an exit status.
+typedef int (*BuiltinHandler)( char **argv, int infd, int outfd );
+
+struct Builtin
+{
+	const char		*name;
+	BuiltinHandler	handler;
+};
+
+// Looks up a builtin by command name with one hash and one strcmp(). The hash
+// is perfect for the registry's names, found at compile time. Returns NULL
+// if name isn't a builtin.
+const Builtin *findBuiltin( const char *name );
+// The whole registry, count entries long, e.g. for completing command names.
+const Builtin *allBuiltins( unsigned int & count );
+
+// Runs a builtin inside the shell, reading infd and writing outfd unless the
+// command redirects its STDIN or STDOUT to a file. Returns its exit status.
+int runBuiltin( const Builtin *builtin, const Command & command, int infd, int outfd );
+
+#endif
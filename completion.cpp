@@ -0,0 +1,131 @@
+#include "completion.hpp"
+#include "PathCache.hpp"
+#include "Variables.hpp"
+#include "Trie.hpp"
+#include <map>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+using namespace std;
+
+// A directory's names as of its mtime. Dot files are kept apart, as they're
+// only completed when the word starts with a dot.
+struct Listing
+{
+	struct timespec	mtime;
+	Trie			names;
+	Trie			hidden;
+};
+
+// Directories that have been completed in, newest contents only.
+static map<string, Listing> listings;
+static const size_t MAX_LISTINGS = 64;
+
+// The listing of dir, read again only if the directory changed since.
+static const Listing *listing( const string & dir )
+{
+	struct stat info;
+	if( stat( dir.c_str(), &info ) < 0 || !S_ISDIR( info.st_mode ) )
+	{
+		return NULL;
+	}
+	map<string, Listing>::iterator it = listings.find( dir );
+	if( it != listings.end() && it->second.mtime.tv_sec == info.st_mtim.tv_sec
+		&& it->second.mtime.tv_nsec == info.st_mtim.tv_nsec )
+	{
+		return &it->second;
+	}
+
+	DIR *d = opendir( dir.c_str() );
+	if( d == NULL )
+	{
+		return NULL;
+	}
+	if( it == listings.end() )
+	{
+		if( listings.size() >= MAX_LISTINGS )
+		{
+			listings.clear();
+		}
+		it = listings.insert( make_pair( dir, Listing() ) ).first;
+	}
+	Listing & result = it->second;
+	result.mtime = info.st_mtim;
+	result.names.clear();
+	result.hidden.clear();
+	struct dirent *entry;
+	while( ( entry = readdir( d ) ) != NULL )
+	{
+		const char *name = entry->d_name;
+		if( strcmp( name, "." ) == 0 || strcmp( name, ".." ) == 0 )
+		{
+			continue;
+		}
+		// Links to directories complete like directories.
+		bool directory = entry->d_type == DT_DIR;
+		struct stat target;
+		if( ( entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN ) && fstatat( dirfd( d ), name, &target, 0 ) == 0 )
+		{
+			directory = S_ISDIR( target.st_mode );
+		}
+		( name[0] == '.' ? result.hidden : result.names ).insert( name, strlen( name ), directory );
+	}
+	closedir( d );
+	return &result;
+}
+
+// Characters that end a word, as the lexer sees them.
+static bool separates( char c )
+{
+	return c == ' ' || c == '\t' || c == '|' || c == '<' || c == '>' || c == '&' || c == ';';
+}
+
+void complete( const string & line, size_t cursor, Completion & result )
+{
+	result.insert.clear();
+	result.count = 0;
+	result.matches.clear();
+
+	size_t start = cursor;
+	while( start > 0 && !separates( line[start - 1] ) )
+	{
+		start--;
+	}
+	string word = line.substr( start, cursor - start );
+	size_t before = start;
+	while( before > 0 && ( line[before - 1] == ' ' || line[before - 1] == '\t' ) )
+	{
+		before--;
+	}
+	bool command = before == 0 || line[before - 1] == '|' || line[before - 1] == '&' || line[before - 1] == ';';
+
+	size_t slash = word.rfind( '/' );
+	if( command && slash == string::npos )
+	{
+		result.count = pathCache.complete( word, result.insert, result.matches, MAX_MATCHES );
+	}
+	else
+	{
+		// Look in the directory the word names so far, the current one if none.
+		string dir = slash == string::npos ? "." : word.substr( 0, slash + 1 );
+		string base = slash == string::npos ? word : word.substr( slash + 1 );
+		const char *home = shellVariables.get( "HOME" );
+		if( dir.compare( 0, 2, "~/" ) == 0 && home != NULL )
+		{
+			dir = home + dir.substr( 1 );
+		}
+		const Listing *names = listing( dir );
+		if( names != NULL )
+		{
+			const Trie & trie = base.length() > 0 && base[0] == '.' ? names->hidden : names->names;
+			result.count = trie.complete( base, result.insert, result.matches, MAX_MATCHES );
+		}
+	}
+
+	// A whole name is followed by a space, unless it's a directory to go on into.
+	if( result.count == 1 && ( result.insert.empty() || result.insert[result.insert.length() - 1] != '/' ) )
+	{
+		result.insert += ' ';
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef _COMPLETION_HPP_
+#define _COMPLETION_HPP_
+
+#include <string>
+#include <vector>
+
+// What Tab can do with the word before the cursor.
+struct Completion
+{
+	std::string					insert;		// What every match adds to the word.
+	size_t						count;		// How many matches there are.
+	std::vector<std::string>	matches;	// The first MAX_MATCHES of them, in order.
+};
+
+// The most matches listed at once.
+const size_t MAX_MATCHES = 100;
+
+// Completes the word that ends at cursor in line: a command name (builtins
+// and everything in PATH) for the first word of a command, a file name
+// otherwise, or for anything with a '/' in it. Both come from tries: PATH's
+// kept up to date by pathCache, and those of recently completed directories
+// made again only when the directory's mtime says it changed.
+void complete( const std::string & line, size_t cursor, Completion & result );
+
+#endif
@@ -0,0 +1,438 @@
+#include "daemon.hpp"
+#include "script.hpp"
+#include "PathCache.hpp"
+#include "Variables.hpp"
+#include "FileDescriptor.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+using namespace std;
+
+// The most a client can send in one batch.
+static const size_t MAX_BATCH = 16 << 20;
+// The most output sent in one frame; more just takes more frames.
+static const uint32_t MAX_FRAME = 1 << 30;
+// Workers kept forked ahead of the connections they'll serve.
+static const unsigned int SPARE_WORKERS = 2;
+
+// Set by SIGINT and SIGTERM.
+static volatile sig_atomic_t stopping = 0;
+
+static void stop( int )
+{
+	stopping = 1;
+}
+
+string defaultSocketPath()
+{
+	const char *socket = shellVariables.get( "QUASHD_SOCKET" );
+	const char *runtime = shellVariables.get( "XDG_RUNTIME_DIR" );
+	if( socket != NULL && socket[0] != '\0' )
+	{
+		return socket;
+	}
+	if( runtime != NULL && runtime[0] == '/' )
+	{
+		return string( runtime ) + "/quashd.sock";
+	}
+	char path[64];
+	snprintf( path, sizeof( path ), "/tmp/quashd-%d.sock", (int)getuid() );
+	return path;
+}
+
+static bool writeAll( int fd, const char *data, size_t length )
+{
+	while( length > 0 )
+	{
+		ssize_t written = write( fd, data, length );
+		if( written < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( written <= 0 )
+		{
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+static bool readAll( int fd, char *data, size_t length )
+{
+	while( length > 0 )
+	{
+		ssize_t got = read( fd, data, length );
+		if( got < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( got <= 0 )
+		{
+			return false;
+		}
+		data += got;
+		length -= got;
+	}
+	return true;
+}
+
+bool writeFrame( int fd, FrameType type, const void *payload, uint32_t length )
+{
+	FrameHeader header = { (uint8_t)type, { 0, 0, 0 }, length };
+	// Small frames, like every status, go in one write().
+	char buffer[4096];
+	if( length <= sizeof( buffer ) - sizeof( header ) )
+	{
+		memcpy( buffer, &header, sizeof( header ) );
+		memcpy( buffer + sizeof( header ), payload, length );
+		return writeAll( fd, buffer, sizeof( header ) + length );
+	}
+	return writeAll( fd, (const char *)&header, sizeof( header ) ) && writeAll( fd, (const char *)payload, length );
+}
+
+bool readFrame( int fd, FrameHeader & header, string & payload )
+{
+	if( !readAll( fd, (char *)&header, sizeof( header ) ) )
+	{
+		return false;
+	}
+	payload.resize( header.length );
+	return readAll( fd, &payload[0], header.length );
+}
+
+// Sends what a line wrote to the memfd fd, straight from the page cache with
+// sendfile(), then empties it for the next line. Its children share the
+// file's offset, so that goes back to the start too.
+static bool sendCaptured( int client, FrameType type, int fd )
+{
+	struct stat info;
+	if( fstat( fd, &info ) < 0 )
+	{
+		return false;
+	}
+	off_t offset = 0;
+	while( offset < info.st_size )
+	{
+		uint32_t length = min( (off_t)MAX_FRAME, info.st_size - offset );
+		FrameHeader header = { (uint8_t)type, { 0, 0, 0 }, length };
+		if( !writeAll( client, (const char *)&header, sizeof( header ) ) )
+		{
+			return false;
+		}
+		for( off_t end = offset + length; offset < end; )
+		{
+			ssize_t sent = sendfile( client, fd, &offset, end - offset );
+			if( sent < 0 && errno == EINTR )
+			{
+				continue;
+			}
+			if( sent <= 0 )
+			{
+				return false;
+			}
+		}
+	}
+	return ftruncate( fd, 0 ) == 0 && lseek( fd, 0, SEEK_SET ) == 0;
+}
+
+// Where a worker's lines go, for finishing a batch that ran exit.
+static int batchClient = -1;
+static int batchOutput = -1;
+static int batchErrors = -1;
+
+// Sends a line's output and then its status.
+static bool sendLine( int status )
+{
+	cout.flush();
+	uint32_t code = status;
+	return sendCaptured( batchClient, FRAME_STDOUT, batchOutput ) && sendCaptured( batchClient, FRAME_STDERR, batchErrors )
+		&& writeFrame( batchClient, FRAME_STATUS, &code, sizeof( code ) );
+}
+
+// exit ends the batch, but the client still hears how its line went.
+static void sendExitStatus( int status, void * )
+{
+	sendLine( status );
+}
+
+// Runs a client's batch, in a worker of its own. Every line is run as if it
+// were a line of a script, with STDOUT and STDERR going to memfds that are
+// sent back as soon as the line is done.
+static void serveBatch( int client )
+{
+	// All of it comes first, so a slow client can't stall its own lines.
+	string batch;
+	char buffer[65536];
+	while( batch.size() <= MAX_BATCH )
+	{
+		ssize_t got = read( client, buffer, sizeof( buffer ) );
+		if( got < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( got < 0 )
+		{
+			return;
+		}
+		if( got == 0 )
+		{
+			break;
+		}
+		batch.append( buffer, got );
+	}
+	if( batch.size() > MAX_BATCH )
+	{
+		return;
+	}
+
+	FileDescriptor nothing( open( "/dev/null", O_RDONLY | O_CLOEXEC ) );
+	FileDescriptor output( memfd_create( "quashd-stdout", MFD_CLOEXEC ) );
+	FileDescriptor errors( memfd_create( "quashd-stderr", MFD_CLOEXEC ) );
+	if( !nothing.valid() || !output.valid() || !errors.valid() )
+	{
+		return;
+	}
+	dup2( nothing.get(), STDIN_FILENO );
+	dup2( output.get(), STDOUT_FILENO );
+	dup2( errors.get(), STDERR_FILENO );
+	batchClient = client;
+	batchOutput = output.get();
+	batchErrors = errors.get();
+	on_exit( sendExitStatus, NULL );
+
+	int status = 0;
+	const char *begin = batch.data();
+	const char *end = begin + batch.size();
+	while( begin < end )
+	{
+		const char *newline = (const char *)memchr( begin, '\n', end - begin );
+		const char *lineEnd = newline ? newline : end;
+		status = runLine( begin, lineEnd - begin, status );
+		if( !sendLine( status ) )
+		{
+			return;
+		}
+		begin = lineEnd + 1;
+	}
+}
+
+// Passes fd over the control socket.
+static bool sendFd( int control, int fd )
+{
+	char byte = 0;
+	struct iovec data = { &byte, 1 };
+	char space[CMSG_SPACE( sizeof( int ) )];
+	memset( space, 0, sizeof( space ) );
+	struct msghdr message;
+	memset( &message, 0, sizeof( message ) );
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = space;
+	message.msg_controllen = sizeof( space );
+	struct cmsghdr *controlMessage = CMSG_FIRSTHDR( &message );
+	controlMessage->cmsg_level = SOL_SOCKET;
+	controlMessage->cmsg_type = SCM_RIGHTS;
+	controlMessage->cmsg_len = CMSG_LEN( sizeof( int ) );
+	memcpy( CMSG_DATA( controlMessage ), &fd, sizeof( int ) );
+	ssize_t sent;
+	while( ( sent = sendmsg( control, &message, MSG_NOSIGNAL ) ) < 0 && errno == EINTR );
+	return sent == 1;
+}
+
+// Receives an fd passed with sendFd(). Returns -1 once the daemon is gone.
+static int receiveFd( int control )
+{
+	char byte;
+	struct iovec data = { &byte, 1 };
+	char space[CMSG_SPACE( sizeof( int ) )];
+	struct msghdr message;
+	memset( &message, 0, sizeof( message ) );
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = space;
+	message.msg_controllen = sizeof( space );
+	ssize_t got;
+	while( ( got = recvmsg( control, &message, MSG_CMSG_CLOEXEC ) ) < 0 && errno == EINTR );
+	struct cmsghdr *controlMessage = CMSG_FIRSTHDR( &message );
+	if( got <= 0 || controlMessage == NULL || controlMessage->cmsg_type != SCM_RIGHTS )
+	{
+		return -1;
+	}
+	int fd;
+	memcpy( &fd, CMSG_DATA( controlMessage ), sizeof( int ) );
+	return fd;
+}
+
+// A spare worker: waits for a connection, has the zygote fork another spare
+// to take its place, then serves it.
+static void runWorker( int control, int notify )
+{
+	int client = receiveFd( control );
+	if( client >= 0 )
+	{
+		char byte = 0;
+		while( write( notify, &byte, 1 ) < 0 && errno == EINTR );
+	}
+	close( notify );
+	close( control );
+	if( client >= 0 )
+	{
+		// Workers run pipelines, and wait for them as usual.
+		signal( SIGCHLD, SIG_DFL );
+		serveBatch( client );
+		cout.flush();
+	}
+	_exit( 0 );
+}
+
+// The zygote: keeps SPARE_WORKERS workers forked and waiting on the control
+// socket, so a connection is never kept waiting for a fork().
+static void runZygote( int control )
+{
+	// Nobody needs a worker's exit status, so they reap themselves.
+	signal( SIGCHLD, SIG_IGN );
+	int notify[2];
+	if( pipe2( notify, O_CLOEXEC ) < 0 )
+	{
+		_exit( 1 );
+	}
+	for( unsigned int spares = 0; true; spares-- )
+	{
+		for( ; spares < SPARE_WORKERS; spares++ )
+		{
+			if( fork() == 0 )
+			{
+				close( notify[0] );
+				runWorker( control, notify[1] );
+			}
+		}
+		// A worker took a connection, or the daemon went away.
+		struct pollfd events[2] = { { notify[0], POLLIN, 0 }, { control, 0, 0 } };
+		while( poll( events, 2, -1 ) < 0 && errno == EINTR );
+		char byte;
+		if( ( events[1].revents & POLLHUP ) || read( notify[0], &byte, 1 ) != 1 )
+		{
+			_exit( 0 );
+		}
+	}
+}
+
+// Forks a zygote, leaving control as the daemon's end of the socket to it.
+static pid_t startZygote( int listener, FileDescriptor & control )
+{
+	int ends[2];
+	if( socketpair( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, ends ) < 0 )
+	{
+		return -1;
+	}
+	FileDescriptor daemonEnd( ends[0] ), zygoteEnd( ends[1] );
+	pid_t pid = fork();
+	if( pid == 0 )
+	{
+		signal( SIGINT, SIG_DFL );
+		signal( SIGTERM, SIG_DFL );
+		close( listener );
+		daemonEnd.reset();
+		runZygote( zygoteEnd.get() );
+	}
+	if( pid > 0 )
+	{
+		control = move( daemonEnd );
+	}
+	return pid;
+}
+
+int runDaemon( const string & path )
+{
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if( path.length() >= sizeof( address.sun_path ) )
+	{
+		cerr << "quash: socket path too long: " << path << endl;
+		return 1;
+	}
+	memcpy( address.sun_path, path.c_str(), path.length() + 1 );
+
+	// Someone answering is another daemon. Nobody answering is one that died
+	// and left its socket behind.
+	FileDescriptor probe( socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) );
+	if( connect( probe.get(), (struct sockaddr *)&address, sizeof( address ) ) == 0 )
+	{
+		cerr << "quash: a daemon is already running on " << path << endl;
+		return 1;
+	}
+	if( errno == ECONNREFUSED )
+	{
+		unlink( path.c_str() );
+	}
+	probe.reset();
+
+	// Only the user who started it can connect.
+	FileDescriptor listener( socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) );
+	mode_t mask = umask( 077 );
+	bool bound = listener.valid() && bind( listener.get(), (struct sockaddr *)&address, sizeof( address ) ) == 0;
+	umask( mask );
+	if( !bound || listen( listener.get(), SOMAXCONN ) < 0 )
+	{
+		cerr << "quash: " << path << ": " << strerror( errno ) << endl;
+		return 1;
+	}
+
+	// Scan PATH once now, so no worker ever has to.
+	pathCache.lookup( "sh" );
+
+	FileDescriptor control;
+	pid_t zygote = startZygote( listener.get(), control );
+	if( zygote < 0 )
+	{
+		cerr << "quash: can't start the zygote: " << strerror( errno ) << endl;
+		unlink( path.c_str() );
+		return 1;
+	}
+
+	// No SA_RESTART, so accept() gives up when one arrives.
+	struct sigaction action;
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = stop;
+	sigaction( SIGINT, &action, NULL );
+	sigaction( SIGTERM, &action, NULL );
+
+	while( !stopping )
+	{
+		FileDescriptor client( accept4( listener.get(), NULL, NULL, SOCK_CLOEXEC ) );
+		if( !client.valid() )
+		{
+			continue;
+		}
+		// If the zygote died (the OOM killer, say), start another.
+		if( !sendFd( control.get(), client.get() ) )
+		{
+			waitpid( zygote, NULL, WNOHANG );
+			zygote = startZygote( listener.get(), control );
+			if( zygote < 0 || !sendFd( control.get(), client.get() ) )
+			{
+				cerr << "quash: lost the zygote: " << strerror( errno ) << endl;
+			}
+		}
+	}
+
+	// Closing control lets the zygote go; running batches finish on their own.
+	unlink( path.c_str() );
+	return 0;
+}
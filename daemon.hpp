@@ -0,0 +1,51 @@
+#ifndef _DAEMON_HPP_
+#define _DAEMON_HPP_
+
+#include <string>
+#include <stdint.h>
+
+// quash -d: a command server on a Unix domain socket, for callers that run
+// lots of short pipelines and shouldn't pay for starting a shell each time.
+//
+// A client connects, sends a batch of command lines and shuts down its side
+// of the socket. Each line is run the way quash runs a script's lines, with
+// its STDOUT and STDERR captured, and as soon as it's done the client gets
+// back frames of its output, its error output and its exit status, in that
+// order. Commands read /dev/null.
+//
+// The daemon itself only accepts connections, and passes each one on to a
+// worker to run the batch. Workers are forked ahead of time by a zygote, a
+// copy of quash made before the daemon has grown: fork() costs in proportion
+// to the parent's memory, so a small zygote keeps that cheap, and forking
+// ahead keeps it out of a request's latency. Batches run side by side.
+
+// A frame is a type, a length and that many bytes of payload.
+enum FrameType
+{
+	FRAME_STDOUT = 'o',		// Output of the line so far.
+	FRAME_STDERR = 'e',		// Error output of the line so far.
+	FRAME_STATUS = 's'		// The line's exit status, 4 bytes: its output is all sent.
+};
+
+struct FrameHeader
+{
+	uint8_t		type;
+	uint8_t		padding[3];
+	uint32_t	length;
+};
+
+// The socket used when none is given: $QUASHD_SOCKET, otherwise quashd.sock in
+// $XDG_RUNTIME_DIR, otherwise /tmp/quashd-<uid>.sock.
+std::string defaultSocketPath();
+
+// Runs the daemon on the socket at path until SIGINT or SIGTERM. Refuses to
+// start if another daemon is answering there. Returns an exit status.
+int runDaemon( const std::string & path );
+
+// Writes one frame. Returns false if the other side has gone away.
+bool writeFrame( int fd, FrameType type, const void *payload, uint32_t length );
+// Reads one frame's header and its payload into payload. Returns false at
+// the end of the stream or if it's cut short.
+bool readFrame( int fd, FrameHeader & header, std::string & payload );
+
+#endif
@@ -0,0 +1,344 @@
+#include "events.hpp"
+#include "JobTable.hpp"
+#include "ResourceUsage.hpp"
+#include <iostream>
+#include <unordered_map>
+#include <set>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
+using namespace std;
+
+// Readable whenever SIGCHLD is pending.
+static int sigchldFd = -1;
+// Readable whenever SIGINT is pending, if catchInterrupts() was called.
+static int sigintFd = -1;
+// A child reapChildren() found that isn't part of a background job.
+struct StrayChild
+{
+	int				status;
+	struct rusage	usage;
+	double			reaped;	// monotonicTime() when it was.
+};
+// Kept until waitForChild() asks for them.
+static unordered_map<pid_t, StrayChild> strayChildren;
+
+// Readable once the soonest deadline has passed. Opened with the first one,
+// by timerOwner.
+static int timerFd = -1;
+static pid_t timerOwner = -1;
+// A process group's deadline. Once it's been sent SIGTERM, when is the time
+// for SIGKILL instead.
+struct Deadline
+{
+	double	when;		// monotonicTime() to signal it at.
+	bool	terminated;	// Sent SIGTERM.
+	bool	killed;		// Sent SIGKILL, so there's nothing left to do.
+};
+static unordered_map<pid_t, Deadline> deadlines;
+// (when, group) of the deadlines still to be acted on, soonest first.
+static set< pair<double, pid_t> > deadlineQueue;
+
+static bool pollWithSigchld( int fd, int timeout = -1 );
+
+// A forked copy of the shell (a nested substitution's) shares the timer with
+// the shell it came from, and setting it would move the shell's. Its own
+// children are all it has to keep deadlines for, so it starts again.
+static void dropInheritedDeadlines()
+{
+	if( timerFd >= 0 && timerOwner != getpid() )
+	{
+		close( timerFd );
+		timerFd = -1;
+		deadlines.clear();
+		deadlineQueue.clear();
+	}
+}
+
+void initZombieReaping()
+{
+	sigset_t mask;
+	sigemptyset( &mask );
+	sigaddset( &mask, SIGCHLD );
+	if( sigprocmask( SIG_BLOCK, &mask, NULL ) == -1 )
+	{
+		cerr << "Failure in sigprocmask() call." << endl;
+		exit( 1 );
+	}
+
+	sigchldFd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC );
+	if( sigchldFd == -1 )
+	{
+		cerr << "Failure in signalfd() call." << endl;
+		exit( 1 );
+	}
+}
+
+void catchInterrupts()
+{
+	sigset_t mask;
+	sigemptyset( &mask );
+	sigaddset( &mask, SIGINT );
+	sigprocmask( SIG_BLOCK, &mask, NULL );
+	sigintFd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC );
+}
+
+int interruptFd()
+{
+	return sigintFd;
+}
+
+void forgetEventLoop()
+{
+	sigchldFd = -1;
+	sigintFd = -1;
+	timerFd = -1;
+	deadlines.clear();
+	deadlineQueue.clear();
+	strayChildren.clear();
+}
+
+// Empties a signalfd. Any number of SIGCHLDs can collapse into one read,
+// which is why reapChildren() loops until waitpid() runs out of children.
+// Returns false if there was nothing in it.
+static bool drainSignalFd( int fd )
+{
+	struct signalfd_siginfo info[16];
+	bool drained = false;
+	while( read( fd, info, sizeof( info ) ) > 0 )
+	{
+		drained = true;
+	}
+	return drained;
+}
+
+void reapChildren()
+{
+	// No SIGCHLD since the last time means no child has exited since then
+	// that hasn't already been reaped, so don't bother asking waitpid().
+	if( sigchldFd >= 0 && !drainSignalFd( sigchldFd ) )
+	{
+		return;
+	}
+
+	pid_t pid;
+	StrayChild child;
+	while( ( pid = wait4( -1, &child.status, WNOHANG, &child.usage ) ) > 0 )
+	{
+		child.reaped = monotonicTime();
+		if( !backgroundJobs.childExited( pid, child.status, child.usage ) )
+		{
+			strayChildren[pid] = child;
+		}
+	}
+}
+
+bool waitForChild( pid_t pid, int & status, struct rusage *usage, double *reaped )
+{
+	dropInheritedDeadlines();
+	for( ;; )
+	{
+		// It may have been reaped already, by reapChildren() or while
+		// waiting for another child.
+		unordered_map<pid_t, StrayChild>::iterator it = strayChildren.find( pid );
+		if( it != strayChildren.end() )
+		{
+			status = it->second.status;
+			if( usage != NULL )
+			{
+				*usage = it->second.usage;
+			}
+			if( reaped != NULL )
+			{
+				*reaped = it->second.reaped;
+			}
+			strayChildren.erase( it );
+			return true;
+		}
+
+		// Block in wait4() for whichever child exits first, so each one's
+		// time is taken when it goes, unless there are deadlines to keep
+		// meanwhile: then wait for SIGCHLD or the timer, whichever comes
+		// first.
+		int options = deadlineQueue.empty() ? 0 : WNOHANG;
+		StrayChild child;
+		pid_t waited = wait4( -1, &child.status, options, &child.usage );
+		if( waited > 0 )
+		{
+			child.reaped = monotonicTime();
+			if( !backgroundJobs.childExited( waited, child.status, child.usage ) )
+			{
+				strayChildren[waited] = child;
+			}
+			continue;
+		}
+		if( waited < 0 && errno != EINTR )
+		{
+			return false;
+		}
+		if( waited == 0 )
+		{
+			pollWithSigchld( -1 );
+		}
+	}
+}
+
+// Sets the timer for the soonest deadline, or stops it if there are none.
+static void armTimer()
+{
+	struct itimerspec spec;
+	memset( &spec, 0, sizeof( spec ) );
+	if( !deadlineQueue.empty() )
+	{
+		double when = deadlineQueue.begin()->first;
+		spec.it_value.tv_sec = (time_t)when;
+		spec.it_value.tv_nsec = (long)( ( when - floor( when ) ) * 1e9 );
+		// All zeros would stop it instead.
+		spec.it_value.tv_nsec += spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0 ? 1 : 0;
+	}
+	timerfd_settime( timerFd, TFD_TIMER_ABSTIME, &spec, NULL );
+}
+
+int deadlineTimerFd()
+{
+	dropInheritedDeadlines();
+	return timerFd;
+}
+
+// Signals every group whose deadline has passed, then sets the timer for
+// the next one.
+void enforceDeadlines()
+{
+	uint64_t expirations;
+	while( read( timerFd, &expirations, sizeof( expirations ) ) > 0 );
+
+	double now = monotonicTime();
+	while( !deadlineQueue.empty() && deadlineQueue.begin()->first <= now )
+	{
+		pid_t pgid = deadlineQueue.begin()->second;
+		deadlineQueue.erase( deadlineQueue.begin() );
+		Deadline & deadline = deadlines[pgid];
+		if( !deadline.terminated )
+		{
+			killpg( pgid, SIGTERM );
+			killpg( pgid, SIGCONT );
+			deadline.terminated = true;
+			deadline.when = now + KILL_GRACE;
+			deadlineQueue.insert( make_pair( deadline.when, pgid ) );
+		}
+		else
+		{
+			killpg( pgid, SIGKILL );
+			deadline.killed = true;
+		}
+	}
+	armTimer();
+}
+
+void setDeadline( pid_t pgid, double seconds )
+{
+	dropInheritedDeadlines();
+	if( timerFd < 0 )
+	{
+		timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+		if( timerFd < 0 )
+		{
+			cerr << "Failure in timerfd_create() call." << endl;
+			return;
+		}
+		timerOwner = getpid();
+	}
+	clearDeadline( pgid );
+	Deadline deadline = { monotonicTime() + seconds, false, false };
+	deadlines[pgid] = deadline;
+	deadlineQueue.insert( make_pair( deadline.when, pgid ) );
+	armTimer();
+}
+
+bool clearDeadline( pid_t pgid )
+{
+	unordered_map<pid_t, Deadline>::iterator it = deadlines.find( pgid );
+	if( it == deadlines.end() )
+	{
+		return false;
+	}
+	bool passed = it->second.terminated;
+	if( !it->second.killed )
+	{
+		deadlineQueue.erase( make_pair( it->second.when, pgid ) );
+	}
+	deadlines.erase( it );
+	armTimer();
+	return passed;
+}
+
+// Polls fd (if it's not -1) along with the signalfd and the deadline timer,
+// for up to timeout milliseconds (-1 for no limit). Returns true once fd is
+// readable, reaping and enforcing deadlines in the meantime.
+static bool pollWithSigchld( int fd, int timeout )
+{
+	// Without the signalfd, wait for a child to exit without reaping it, so
+	// reapChildren() still gets to.
+	dropInheritedDeadlines();
+	if( sigchldFd < 0 && fd < 0 && timeout < 0 )
+	{
+		siginfo_t info;
+		waitid( P_ALL, 0, &info, WEXITED | WNOWAIT );
+		reapChildren();
+		return false;
+	}
+
+	// poll() skips the signalfd and the timer while they're -1.
+	struct pollfd fds[3];
+	fds[0].fd = sigchldFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = timerFd;
+	fds[1].events = POLLIN;
+	fds[2].fd = fd;
+	fds[2].events = POLLIN;
+	int count = fd >= 0 ? 3 : 2;
+
+	if( poll( fds, count, timeout ) < 0 )
+	{
+		return errno != EINTR;
+	}
+	if( ( fds[0].revents & POLLIN ) || sigchldFd < 0 )
+	{
+		reapChildren();
+	}
+	if( fds[1].revents & POLLIN )
+	{
+		enforceDeadlines();
+	}
+	return count == 3 && fds[2].revents != 0;
+}
+
+void waitForInput( int fd )
+{
+	while( !pollWithSigchld( fd ) );
+}
+
+bool waitForInput( int fd, double seconds )
+{
+	return pollWithSigchld( fd, (int)ceil( seconds * 1000 ) );
+}
+
+bool takeInterrupt()
+{
+	return sigintFd >= 0 && drainSignalFd( sigintFd );
+}
+
+void waitForChildEvent( double seconds )
+{
+	// Rounded up, so it doesn't wake just before the time is up.
+	pollWithSigchld( -1, seconds < 0 ? -1 : (int)ceil( seconds * 1000 ) );
+}
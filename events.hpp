@@ -0,0 +1,64 @@
+#ifndef _EVENTS_HPP_
+#define _EVENTS_HPP_
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Quash never handles SIGCHLD in a signal handler. It stays blocked, and its
+// arrival is read from a signalfd by the event loop below, so children are
+// reaped (and the job table updated) in normal context.
+
+// Blocks SIGCHLD and opens the signalfd for it. Call at Quash startup.
+void initZombieReaping();
+// For an interactive shell, which mustn't be killed by Ctrl-C but has to
+// notice it while a builtin like sleep runs in it: blocks SIGINT and opens a
+// signalfd for it, readable from interruptFd() while one is pending
+// (otherwise -1). takeInterrupt() clears them, returning whether there were
+// any. Children get SIGINT back as it was, like everything else the shell
+// blocks.
+void catchInterrupts();
+int interruptFd();
+bool takeInterrupt();
+// For a forked builtin, whose copies of the signalfd and deadline timer were
+// closed with everything else that's close-on-exec, and which has SIGCHLD
+// unblocked. Waiting falls back to blocking on the children themselves.
+void forgetEventLoop();
+// Reaps every child that has exited, without blocking. Background job stages
+// are handed to the job table; the status of anything else, i.e. a foreground
+// stage, is kept for waitForChild().
+void reapChildren();
+// Waits for one particular child and stores its waitpid() status, what it
+// used if usage isn't NULL, and the monotonicTime() it was reaped at if
+// reaped isn't NULL. Children that exit meanwhile are reaped as they go, so
+// that's about when it exited, not when it was asked about. Returns false if
+// it isn't a child of quash.
+bool waitForChild( pid_t pid, int & status, struct rusage *usage = NULL, double *reaped = NULL );
+// Blocks until fd has something to read, reaping children whenever SIGCHLD
+// arrives in the meantime.
+void waitForInput( int fd );
+// The same, but gives up after seconds, returning false, or sooner if a child
+// exits. fd can be -1, to only wait for that.
+bool waitForInput( int fd, double seconds );
+// Blocks until SIGCHLD arrives, then reaps. For waiting on background jobs.
+// Gives up after seconds, if that isn't negative. Deadlines are kept
+// meanwhile either way.
+void waitForChildEvent( double seconds = -1 );
+
+// Deadlines for process groups, e.g. timeout's. They're all kept on one
+// timerfd that's waited on with the SIGCHLD signalfd above, so they're
+// enforced wherever the shell waits, with no process of their own. When a
+// group's deadline passes it gets SIGTERM (and SIGCONT, in case it's
+// stopped), then SIGKILL if it hasn't finished KILL_GRACE seconds later.
+const double KILL_GRACE = 2;
+// Sets the deadline of the group seconds from now.
+void setDeadline( pid_t pgid, double seconds );
+// Forgets the group's deadline, once it's done. Returns true if it had
+// passed, i.e. the group was signalled.
+bool clearDeadline( pid_t pgid );
+// For loops that poll fds of their own: the timer's fd, -1 until there's
+// been a deadline, and what to call when it's readable.
+int deadlineTimerFd();
+void enforceDeadlines();
+
+#endif
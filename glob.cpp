@@ -0,0 +1,435 @@
+#include "glob.hpp"
+#include "FileDescriptor.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+using namespace std;
+
+// Room to leave for the first getdents64() on a directory. Each call after
+// that gets at least as much as all of the calls before it, so a directory
+// of a million entries takes a handful of calls, not thousands.
+static const size_t FIRST_BATCH = 64 * 1024;
+
+const vector<char> & DirectoryCache::list( const string & path )
+{
+	map<string, vector<char> >::iterator found = listings.find( path );
+	if( found != listings.end() )
+	{
+		return found->second;
+	}
+	vector<char> & entries = listings[path];
+	FileDescriptor fd( open( path.empty() ? "." : path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) );
+	if( !fd.valid() )
+	{
+		return entries;
+	}
+	size_t used = 0;
+	for( ;; )
+	{
+		if( entries.size() - used < FIRST_BATCH )
+		{
+			entries.resize( max( entries.size() * 2, used + FIRST_BATCH ) );
+		}
+		long got = syscall( SYS_getdents64, fd.get(), &entries[used], entries.size() - used );
+		if( got <= 0 )
+		{
+			break;
+		}
+		used += got;
+	}
+	entries.resize( used );
+	return entries;
+}
+
+// The character classes that can go in a bracket expression, e.g. [[:digit:]].
+static const struct
+{
+	const char	*name;
+	int			(*test)( int );
+} characterClasses[] =
+{
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+	{ "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+	{ "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+// If p starts a [:class:] inside a bracket expression, the : of its :], or
+// NULL if it doesn't.
+static const char *classEnd( const char *p, const char *end )
+{
+	if( p + 1 >= end || p[0] != '[' || p[1] != ':' )
+	{
+		return NULL;
+	}
+	for( const char *q = p + 2; q + 1 < end; q++ )
+	{
+		if( q[0] == ':' && q[1] == ']' )
+		{
+			return q;
+		}
+	}
+	return NULL;
+}
+
+// The ] closing the bracket expression that starts with the [ at p, or NULL
+// if there isn't one, in which case the [ is just a [. A ] straight after
+// the [ (or [! or [^) is one of the characters, not the end, and neither is
+// the ] of a [:class:].
+static const char *bracketEnd( const char *p, const char *end )
+{
+	const char *q = p + 1;
+	if( q < end && ( *q == '!' || *q == '^' ) )
+	{
+		q++;
+	}
+	if( q < end && *q == ']' )
+	{
+		q++;
+	}
+	while( q < end && *q != ']' )
+	{
+		const char *colon = classEnd( q, end );
+		q = colon != NULL ? colon + 2 : q + ( *q == '\\' && q + 1 < end ? 2 : 1 );
+	}
+	return q < end ? q : NULL;
+}
+
+// Whether c is in the class named by the length characters at name. One
+// that isn't a class has nothing in it.
+static bool inClass( const char *name, size_t length, unsigned char c )
+{
+	for( unsigned int i = 0; i < sizeof( characterClasses ) / sizeof( characterClasses[0] ); i++ )
+	{
+		if( strlen( characterClasses[i].name ) == length && memcmp( characterClasses[i].name, name, length ) == 0 )
+		{
+			return characterClasses[i].test( c ) != 0;
+		}
+	}
+	return false;
+}
+
+// Matches c against the pattern's next character, ?, or [...], and moves p
+// past it.
+static bool matchCharacter( const char *& p, const char *end, unsigned char c )
+{
+	if( *p == '?' )
+	{
+		p++;
+		return true;
+	}
+	const char *close = *p == '[' ? bracketEnd( p, end ) : NULL;
+	if( close != NULL )
+	{
+		const char *q = p + 1;
+		bool negate = *q == '!' || *q == '^';
+		q += negate ? 1 : 0;
+		bool found = false;
+		while( q < close )
+		{
+			// A class, one character or a range, e.g. [:digit:], x or a-z.
+			const char *colon = classEnd( q, close );
+			if( colon != NULL )
+			{
+				found = found || inClass( q + 2, colon - ( q + 2 ), c );
+				q = colon + 2;
+				continue;
+			}
+			q += *q == '\\' && q + 1 < close ? 1 : 0;
+			unsigned char low = *q++;
+			unsigned char high = low;
+			if( q + 1 < close && *q == '-' )
+			{
+				q += q[1] == '\\' && q + 2 < close ? 2 : 1;
+				high = *q++;
+			}
+			found = found || ( c >= low && c <= high );
+		}
+		p = close + 1;
+		return found != negate;
+	}
+	if( *p == '\\' && p + 1 < end )
+	{
+		p++;
+	}
+	return (unsigned char)*p++ == c;
+}
+
+// Whether name matches the pattern component [p, end). A leading dot has to
+// be matched by a dot in the pattern, so * doesn't match hidden files.
+static bool matchName( const char *p, const char *end, const char *name )
+{
+	if( name[0] == '.' && !( p < end && ( *p == '.' || ( *p == '\\' && p + 1 < end && p[1] == '.' ) ) ) )
+	{
+		return false;
+	}
+	// On a mismatch after a *, go back and let the * take one more character.
+	const char *star = NULL;
+	const char *starName = NULL;
+	while( *name != '\0' )
+	{
+		if( p < end && *p == '*' )
+		{
+			while( p < end && *p == '*' )
+			{
+				p++;
+			}
+			star = p;
+			starName = name;
+			continue;
+		}
+		const char *next = p;
+		if( p < end && matchCharacter( next, end, *name ) )
+		{
+			p = next;
+			name++;
+			continue;
+		}
+		if( star == NULL )
+		{
+			return false;
+		}
+		p = star;
+		name = ++starName;
+	}
+	while( p < end && *p == '*' )
+	{
+		p++;
+	}
+	return p == end;
+}
+
+bool isPattern( const char *pattern, size_t length )
+{
+	const char *end = pattern + length;
+	for( const char *p = pattern; p < end; p++ )
+	{
+		if( *p == '\\' )
+		{
+			p++;
+		}
+		else if( *p == '*' || *p == '?' || ( *p == '[' && bracketEnd( p, end ) != NULL ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t unescapePattern( const char *pattern, size_t length, char *out )
+{
+	char *start = out;
+	const char *end = pattern + length;
+	for( const char *p = pattern; p < end; p++ )
+	{
+		if( *p == '\\' && p + 1 < end )
+		{
+			p++;
+		}
+		*out++ = *p;
+	}
+	return out - start;
+}
+
+bool mightGlob( const char *line, size_t length )
+{
+	for( size_t i = 0; i < length; i++ )
+	{
+		char c = line[i];
+		if( c == '*' || c == '?' ||
+			( c == '[' && i + 1 < length && line[i + 1] != ' ' && line[i + 1] != '\t' && line[i + 1] != '\r' ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace
+{
+	// One /-separated part of a pattern.
+	struct Component
+	{
+		const char	*begin;
+		const char	*end;
+		bool		pattern;	// Has a *, ? or [...], so it needs the directory listed.
+		bool		recursive;	// It's **.
+	};
+
+	// What one expansion works with while it walks the directories.
+	struct Walk
+	{
+		vector<Component>	components;
+		DirectoryCache		&cache;
+		vector<string>		&matches;
+
+		Walk( DirectoryCache & cache, vector<string> & matches ) :
+			cache( cache ),
+			matches( matches )
+		{
+		}
+	};
+}
+
+// prefix/name, where prefix is "" for the current directory.
+static string join( const string & prefix, const char *name, size_t length )
+{
+	string path = prefix;
+	if( !path.empty() && path[path.length() - 1] != '/' )
+	{
+		path += '/';
+	}
+	path.append( name, length );
+	return path;
+}
+
+// Whether an entry of the directory at prefix is a directory itself, not a
+// link to one. Most filesystems say in the entry, the others need a stat.
+static bool isDirectory( const string & prefix, const struct dirent64 *entry )
+{
+	if( entry->d_type != DT_UNKNOWN )
+	{
+		return entry->d_type == DT_DIR;
+	}
+	struct stat info;
+	string path = join( prefix, entry->d_name, strlen( entry->d_name ) );
+	return lstat( path.c_str(), &info ) == 0 && S_ISDIR( info.st_mode );
+}
+
+// Matches the components from index on against what's under the directory
+// prefix, which every path matched so far starts with.
+static void walk( Walk & state, const string & prefix, size_t index )
+{
+	if( index == state.components.size() )
+	{
+		state.matches.push_back( prefix );
+		return;
+	}
+	const Component & component = state.components[index];
+	bool last = index + 1 == state.components.size();
+
+	// A trailing / only matches directories, and keeps the /.
+	if( component.begin == component.end )
+	{
+		struct stat info;
+		if( stat( prefix.c_str(), &info ) == 0 && S_ISDIR( info.st_mode ) )
+		{
+			state.matches.push_back( prefix + "/" );
+		}
+		return;
+	}
+
+	// No need to read a directory for a plain name, only to see if it's there
+	// at the end.
+	if( !component.pattern )
+	{
+		string name( component.end - component.begin, '\0' );
+		name.resize( unescapePattern( component.begin, component.end - component.begin, &name[0] ) );
+		string path = join( prefix, name.data(), name.length() );
+		struct stat info;
+		if( !last )
+		{
+			walk( state, path, index + 1 );
+		}
+		else if( lstat( path.c_str(), &info ) == 0 )
+		{
+			state.matches.push_back( path );
+		}
+		return;
+	}
+
+	// ** matches no directories at all, as well as any under this one.
+	if( component.recursive )
+	{
+		walk( state, prefix, index + 1 );
+	}
+	const vector<char> & entries = state.cache.list( prefix );
+	for( size_t offset = 0; offset < entries.size(); )
+	{
+		const struct dirent64 *entry = (const struct dirent64 *)&entries[offset];
+		offset += entry->d_reclen;
+		const char *name = entry->d_name;
+		if( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) )
+		{
+			continue;
+		}
+		if( component.recursive )
+		{
+			// Hidden directories and links are left out, which also keeps a
+			// link back up the tree from going round forever.
+			if( name[0] != '.' && isDirectory( prefix, entry ) )
+			{
+				walk( state, join( prefix, name, strlen( name ) ), index );
+			}
+			continue;
+		}
+		if( !matchName( component.begin, component.end, name ) )
+		{
+			continue;
+		}
+		if( last )
+		{
+			state.matches.push_back( join( prefix, name, strlen( name ) ) );
+		}
+		else if( entry->d_type == DT_DIR || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN )
+		{
+			// Listing a link to a file just comes up empty.
+			walk( state, join( prefix, name, strlen( name ) ), index + 1 );
+		}
+	}
+}
+
+bool expandGlob( const char *pattern, size_t length, DirectoryCache & cache, vector<string> & matches )
+{
+	if( !isPattern( pattern, length ) )
+	{
+		return false;
+	}
+
+	// Split it at slashes. Repeated ones count as one, and a leading one
+	// starts from /, but a trailing one is kept as an empty last component
+	// since it means only directories match.
+	Walk state( cache, matches );
+	const char *end = pattern + length;
+	const char *p = pattern;
+	string prefix = *p == '/' ? "/" : "";
+	while( p < end )
+	{
+		const char *slash = (const char *)memchr( p, '/', end - p );
+		Component component;
+		component.begin = p;
+		component.end = slash != NULL ? slash : end;
+		component.pattern = isPattern( component.begin, component.end - component.begin );
+		component.recursive = component.end - component.begin == 2 && memcmp( component.begin, "**", 2 ) == 0;
+		if( component.begin < component.end )
+		{
+			state.components.push_back( component );
+		}
+		p = slash != NULL ? slash + 1 : end;
+	}
+	// A ** at the end is everything under the directory: **/*.
+	static const char everything[] = "*";
+	if( state.components.back().recursive )
+	{
+		Component component = { everything, everything + 1, true, false };
+		state.components.push_back( component );
+	}
+	if( end[-1] == '/' )
+	{
+		Component component = { end, end, false, false };
+		state.components.push_back( component );
+	}
+
+	size_t first = matches.size();
+	walk( state, prefix, 0 );
+	if( matches.size() == first )
+	{
+		return false;
+	}
+	sort( matches.begin() + first, matches.end() );
+	return true;
+}
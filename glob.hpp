@@ -0,0 +1,46 @@
+#ifndef _GLOB_HPP_
+#define _GLOB_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+// Filename generation. A word with an unquoted *, ? or [...] in it is a
+// pattern, and is replaced by the paths it matches, sorted, or left as it is
+// if there are none. [...] can have POSIX classes in it, e.g. [[:digit:]].
+// *, ? and [...] never match a / or a leading dot, and a ** on its own
+// between slashes matches any number of directories, except hidden ones and
+// links, so src/**/*.c is every .c file under src. In a pattern a \ takes
+// the next character literally: that's how the lexer marks the quoted parts
+// of a word.
+
+// Every directory that one line's patterns have read, so words globbing the
+// same one (e.g. cp *.c *.h dest) read it only once. A listing is what
+// getdents64() returns, read in big batches straight into one buffer, so a
+// huge directory doesn't cost an allocation per entry.
+class DirectoryCache
+{
+public:
+	// The dirent64 records of the directory at path ("" for the current
+	// one), one after another. Empty if it can't be read.
+	const std::vector<char> & list( const std::string & path );
+
+private:
+	std::map<std::string, std::vector<char> >	listings;
+};
+
+// Whether the length characters at pattern have an unescaped *, ? or [...].
+bool isPattern( const char *pattern, size_t length );
+// Adds the paths matching pattern to matches, sorted. Returns false without
+// adding anything if it isn't a pattern or nothing matches.
+bool expandGlob( const char *pattern, size_t length, DirectoryCache & cache, std::vector<std::string> & matches );
+// Copies pattern to out without its \ escapes, for a word that's used as it
+// is. out needs room for length characters. Returns how many it wrote.
+size_t unescapePattern( const char *pattern, size_t length, char *out );
+// Whether a line might have a pattern in it, going by its characters alone:
+// a * or ?, or a [ that isn't a word of its own like test's. For the compiled
+// script cache, which leaves those lines to be expanded when they run.
+bool mightGlob( const char *line, size_t length );
+
+#endif
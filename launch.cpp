@@ -0,0 +1,443 @@
+#include "launch.hpp"
+#include "utils.hpp"
+#include "trace.hpp"
+#include "events.hpp"
+#include "FileDescriptor.hpp"
+#include "Variables.hpp"
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <mntent.h>
+#include <sys/stat.h>
+using namespace std;
+
+static LaunchBackend initialLaunchBackend()
+{
+	LaunchBackend backend = LAUNCH_FORK;
+	const char *name = getenv( "QUASH_LAUNCH" );
+	if( name != NULL && !parseLaunchBackend( name, backend ) )
+	{
+		cerr << "Unknown QUASH_LAUNCH \"" << name << "\", using fork." << endl;
+	}
+	return backend;
+}
+
+LaunchBackend launchBackend = initialLaunchBackend();
+
+bool parseLaunchBackend( const string & name, LaunchBackend & backend )
+{
+	if( name == "fork" )
+	{
+		backend = LAUNCH_FORK;
+		return true;
+	}
+	if( name == "spawn" )
+	{
+		backend = LAUNCH_SPAWN;
+		return true;
+	}
+	return false;
+}
+
+const char *launchBackendName( LaunchBackend backend )
+{
+	return backend == LAUNCH_SPAWN ? "spawn" : "fork";
+}
+
+// Sets up a freshly forked child: process group, signals, and STDIN/STDOUT
+// including the command's own redirects. Exits the child if that fails.
+//
+// Children always leave with _exit(), never exit(): exit() would flush the
+// stdio buffers they inherited, and rewind the input offset they share with
+// the shell to where its buffered reading left off, so a shell reading a
+// script from STDIN would read lines over again.
+static void setUpChild( const Command & command, int inputfd, int outputfd, pid_t pgid )
+{
+	if( pgid >= 0 )
+	{
+		// Put child in the pipeline's process group. The parent does
+		// the same so it doesn't matter who gets there first.
+		setpgid( 0, pgid );
+	}
+
+	// Undo what the shell blocks and ignores for itself.
+	sigset_t empty;
+	sigemptyset( &empty );
+	sigprocmask( SIG_SETMASK, &empty, NULL );
+	signal( SIGTTOU, SIG_DFL );
+	signal( SIGPIPE, SIG_DFL );
+	signal( SIGINT, SIG_DFL );
+	signal( SIGQUIT, SIG_DFL );
+
+	// Rename STDIN and STDOUT to the given fds, e.g. pipe ends.
+	if( inputfd != STDIN_FILENO )
+	{
+		dup2( inputfd, STDIN_FILENO );
+		close( inputfd );
+	}
+	if( outputfd != STDOUT_FILENO )
+	{
+		dup2( outputfd, STDOUT_FILENO );
+		close( outputfd );
+	}
+
+	if( command.inputFilename[0] == '\0' && command.outputFilename[0] == '\0' )
+	{
+		return;
+	}
+	TraceSpan span( "redirect" );
+	if( redirectStdIn( command.inputFilename ) != 0 )
+	{
+		_exit( EXIT_FAILURE );
+	}
+	if( truncateOutputs( command.truncatedOutputs ) != 0 || redirectStdOut( command.outputFilename ) != 0 )
+	{
+		_exit( EXIT_FAILURE );
+	}
+}
+
+// Where the cgroup v2 hierarchy is mounted: /sys/fs/cgroup on most systems,
+// /sys/fs/cgroup/unified on hybrid ones. Looked up the first time it's needed.
+static const string & cgroupRoot()
+{
+	static string root;
+	if( root.empty() )
+	{
+		root = "/sys/fs/cgroup";
+		FILE *mounts = setmntent( "/proc/self/mounts", "re" );
+		struct mntent *mount;
+		while( mounts != NULL && ( mount = getmntent( mounts ) ) != NULL )
+		{
+			if( strcmp( mount->mnt_type, "cgroup2" ) == 0 )
+			{
+				root = mount->mnt_dir;
+				break;
+			}
+		}
+		if( mounts != NULL )
+		{
+			endmntent( mounts );
+		}
+	}
+	return root;
+}
+
+// The directory of a cgroup, which is written the way /proc/<pid>/cgroup has
+// it (/jobs/batch), relative to that (jobs/batch), or as its full path.
+static string cgroupDirectory( const char *group )
+{
+	if( group[0] == '\0' )
+	{
+		return "";
+	}
+	const string & root = cgroupRoot();
+	if( strncmp( group, root.c_str(), root.length() ) == 0 && group[root.length()] == '/' )
+	{
+		return group;
+	}
+	return root + ( group[0] == '/' ? "" : "/" ) + group;
+}
+
+// Writes value to the file. Returns false if it can't, with errno saying
+// why.
+static bool writeFile( const string & path, const char *value )
+{
+	int fd = open( path.c_str(), O_WRONLY | O_CLOEXEC );
+	if( fd < 0 )
+	{
+		return false;
+	}
+	size_t length = strlen( value );
+	bool written = write( fd, value, length ) == (ssize_t)length;
+	int error = errno;
+	close( fd );
+	errno = error;
+	return written;
+}
+
+// Gets a command's cgroup ready for it, in the shell before it forks: makes
+// the group if it isn't there yet, then applies the command's limits, e.g.
+// memory.max=1G. Returns false after saying why if a limit can't be set, so
+// the command doesn't run unconstrained.
+//
+// A limit's file only exists once its controller is enabled in the parent's
+// cgroup.subtree_control. That's the parent's configuration, not quash's, so
+// it's only changed for a group quash has just made, and only to add a
+// controller that's missing. A group that was already there is used as its
+// owner set it up.
+static bool prepareCgroup( const string & cgroupDir, const char **limits )
+{
+	bool made = mkdir( cgroupDir.c_str(), 0755 ) == 0;
+	if( !made && errno != EEXIST )
+	{
+		cerr << "cgroup: can't make " << cgroupDir << ": " << strerror( errno ) << endl;
+		return false;
+	}
+	string subtreeControl = cgroupDir.substr( 0, cgroupDir.rfind( '/' ) ) + "/cgroup.subtree_control";
+	for( ; limits != NULL && *limits != NULL; limits++ )
+	{
+		const char *equals = strchr( *limits, '=' );
+		string file( *limits, equals - *limits );
+		string path = cgroupDir + "/" + file;
+		if( made && access( path.c_str(), F_OK ) < 0 )
+		{
+			string controller = "+" + file.substr( 0, file.find( '.' ) );
+			writeFile( subtreeControl, controller.c_str() );
+		}
+		if( !writeFile( path, equals + 1 ) )
+		{
+			cerr << "cgroup: can't set " << file << " of " << cgroupDir << ": "
+				 << ( errno == ENOENT ? "no such file, or its controller isn't available" : strerror( errno ) ) << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Puts a freshly forked child where the command's placement says, before it
+// execs. Its own children go with it, so a whole job can be capped by its
+// cgroup's cpu.max and memory.max. Like taskset, a child that can't be pinned
+// or moved doesn't run at all; like nice(1), one that can't be reniced only
+// says so.
+static void placeChild( const Placement & placement, const string & cgroupDir )
+{
+	// prepareCgroup() has made the group. 0 is whoever writes it.
+	if( !cgroupDir.empty() )
+	{
+		string procs = cgroupDir + "/cgroup.procs";
+		int fd = open( procs.c_str(), O_WRONLY | O_CLOEXEC );
+		if( fd < 0 || write( fd, "0", 1 ) != 1 )
+		{
+			cerr << "cgroup: can't join " << cgroupDir << ": " << strerror( errno ) << endl;
+			_exit( 126 );
+		}
+		close( fd );
+	}
+	if( placement.cpus != NULL && sched_setaffinity( 0, sizeof( cpu_set_t ), placement.cpus ) < 0 )
+	{
+		cerr << "pin: " << strerror( errno ) << endl;
+		_exit( 126 );
+	}
+	errno = 0;
+	if( placement.nice != 0 && nice( placement.nice ) == -1 && errno != 0 )
+	{
+		cerr << "nice: " << strerror( errno ) << endl;
+	}
+}
+
+// A forked builtin never exec()s, so close what exec() would have, e.g. the
+// shell's ends of other pipes, or a reader of this one might never see EOF.
+static void closeOnExecFds()
+{
+	DIR *dir = opendir( "/proc/self/fd" );
+	if( dir == NULL )
+	{
+		return;
+	}
+	int dirfd_ = dirfd( dir );
+	struct dirent *entry;
+	while( ( entry = readdir( dir ) ) != NULL )
+	{
+		int fd = atoi( entry->d_name );
+		// The trace file stays open so the builtin can still be traced.
+		if( fd > STDERR_FILENO && fd != dirfd_ && fd != traceFileDescriptor() && ( fcntl( fd, F_GETFD ) & FD_CLOEXEC ) )
+		{
+			close( fd );
+		}
+	}
+	closedir( dir );
+}
+
+// fork() backend. Everything between fork() and exec() happens in the child,
+// which is also where errors get reported.
+static pid_t forkCommand( const Command & command, const string & path, int inputfd, int outputfd, pid_t pgid )
+{
+	// Built (if it's changed at all) before forking, so it's only ever
+	// built once.
+	char **envp = shellVariables.environment();
+	string cgroupDir = cgroupDirectory( command.placement.cgroup );
+	if( !cgroupDir.empty() && !prepareCgroup( cgroupDir, command.placement.limits ) )
+	{
+		return -1;
+	}
+	long long start = tracing() ? traceTime() : 0;
+	pid_t pid = fork();
+	if( pid < 0 )
+	{
+		cerr << "Fork failed." << endl;
+		return -1;
+	}
+	if( pid == 0 )
+	{
+		// Everything from here to exec() is the child's, under its own pid.
+		start = tracing() ? traceTime() : 0;
+		traceProcessName( command.rawString );
+		setUpChild( command, inputfd, outputfd, pgid );
+		placeChild( command.placement, cgroupDir );
+		if( fdCheck )
+		{
+			checkInheritedFds( command.rawString );
+		}
+		traceSpan( "child setup", start, command.rawString );
+		int status = execute( command.argv, path, envp );
+		// Only gets here if exec() didn't happen.
+		traceSpan( "exec failed", start, command.argv[0] );
+		_exit( status );
+	}
+	traceSpan( "fork", start, command.rawString );
+
+	return pid;
+}
+
+// posix_spawn() backend. The child can't print anything before exec(), so the
+// checks execute() would have made in the child are made here instead.
+static pid_t spawnCommand( const Command & command, const string & path, int inputfd, int outputfd, pid_t pgid )
+{
+	char **argv = command.argv;
+	string file;
+	if( argv[0][0] == '/' )
+	{
+		file = argv[0];
+	}
+	else if( strncmp( argv[0], "./", 2 ) == 0 )
+	{
+		file = &argv[0][2];
+	}
+	else if( path.length() > 0 )
+	{
+		file = path;
+	}
+	else
+	{
+		cerr << "Executable named \"" << argv[0] << "\" does not exist in any of the directories in PATH." << endl;
+		return -1;
+	}
+	if( executableExists( file ) != 0 )
+	{
+		return -1;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init( &actions );
+	if( inputfd != STDIN_FILENO )
+	{
+		posix_spawn_file_actions_adddup2( &actions, inputfd, STDIN_FILENO );
+		posix_spawn_file_actions_addclose( &actions, inputfd );
+	}
+	if( outputfd != STDOUT_FILENO )
+	{
+		posix_spawn_file_actions_adddup2( &actions, outputfd, STDOUT_FILENO );
+		posix_spawn_file_actions_addclose( &actions, outputfd );
+	}
+	if( command.inputFilename[0] != '\0' )
+	{
+		posix_spawn_file_actions_addopen( &actions, STDIN_FILENO, command.inputFilename, O_RDONLY, 0 );
+	}
+	// Each output file is opened on STDOUT in turn, so all but the last are
+	// just created and truncated.
+	for( const char **earlier = command.truncatedOutputs; earlier != NULL && *earlier != NULL; earlier++ )
+	{
+		posix_spawn_file_actions_addopen( &actions, STDOUT_FILENO, *earlier, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+	}
+	if( command.outputFilename[0] != '\0' )
+	{
+		posix_spawn_file_actions_addopen( &actions, STDOUT_FILENO, command.outputFilename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+	}
+
+	// Undo what the shell blocks and ignores for itself.
+	posix_spawnattr_t attr;
+	posix_spawnattr_init( &attr );
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	sigset_t empty, defaults;
+	sigemptyset( &empty );
+	sigemptyset( &defaults );
+	sigaddset( &defaults, SIGTTOU );
+	sigaddset( &defaults, SIGPIPE );
+	sigaddset( &defaults, SIGINT );
+	sigaddset( &defaults, SIGQUIT );
+	posix_spawnattr_setsigmask( &attr, &empty );
+	posix_spawnattr_setsigdefault( &attr, &defaults );
+	if( pgid >= 0 )
+	{
+		flags |= POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup( &attr, pgid );
+	}
+	posix_spawnattr_setflags( &attr, flags );
+
+	// The child starts with whatever the shell has open that isn't
+	// close-on-exec, so that's what gets checked.
+	if( fdCheck )
+	{
+		checkInheritedFds( command.rawString );
+	}
+
+	pid_t pid;
+	long long start = tracing() ? traceTime() : 0;
+	int error = posix_spawn( &pid, file.c_str(), &actions, &attr, argv, shellVariables.environment() );
+	traceSpan( "posix_spawn", start, command.rawString );
+	posix_spawnattr_destroy( &attr );
+	posix_spawn_file_actions_destroy( &actions );
+	if( error != 0 )
+	{
+		cerr << "Couldn't start \"" << file << "\", errno = " << error << "." << endl;
+		return -1;
+	}
+
+	return pid;
+}
+
+pid_t launchCommand( const Command & command, const string & path, int inputfd, int outputfd, pid_t pgid )
+{
+	// posix_spawn() can't pin, renice or move the child before it execs.
+	if( launchBackend == LAUNCH_SPAWN && !command.placement.any() )
+	{
+		return spawnCommand( command, path, inputfd, outputfd, pgid );
+	}
+	return forkCommand( command, path, inputfd, outputfd, pgid );
+}
+
+pid_t launchBuiltin( const Builtin *builtin, const Command & command, int inputfd, int outputfd, pid_t pgid )
+{
+	string cgroupDir = cgroupDirectory( command.placement.cgroup );
+	if( !cgroupDir.empty() && !prepareCgroup( cgroupDir, command.placement.limits ) )
+	{
+		return -1;
+	}
+	long long start = tracing() ? traceTime() : 0;
+	pid_t pid = fork();
+	if( pid < 0 )
+	{
+		cerr << "Fork failed." << endl;
+		return -1;
+	}
+	if( pid == 0 )
+	{
+		start = tracing() ? traceTime() : 0;
+		traceProcessName( command.rawString );
+		setUpChild( command, inputfd, outputfd, pgid );
+		placeChild( command.placement, cgroupDir );
+		closeOnExecFds();
+		forgetEventLoop();
+		if( fdCheck )
+		{
+			checkInheritedFds( command.rawString );
+		}
+		traceSpan( "child setup", start, command.rawString );
+		start = tracing() ? traceTime() : 0;
+		int status = builtin->handler( command.argv, STDIN_FILENO, STDOUT_FILENO );
+		cout.flush();
+		traceSpan( "builtin", start, command.argv[0] );
+		_exit( status );
+	}
+	traceSpan( "fork", start, command.rawString );
+
+	return pid;
+}
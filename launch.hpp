@@ -0,0 +1,41 @@
+#ifndef _LAUNCH_HPP_
+#define _LAUNCH_HPP_
+
+#include <string>
+#include <sys/types.h>
+#include "Command.hpp"
+#include "builtins.hpp"
+
+// How child processes get started. fork() copies the shell's page tables, so
+// its cost grows with the shell's memory; posix_spawn() doesn't.
+enum LaunchBackend
+{
+	LAUNCH_FORK,	// fork(), set up fds in the child, then execute().
+	LAUNCH_SPAWN	// posix_spawn() with file actions for the same fd setup.
+};
+
+// Backend used by launchCommand(). Starts out as $QUASH_LAUNCH if that's set,
+// changed at runtime with "set -o launch=fork|spawn".
+extern LaunchBackend launchBackend;
+
+// Parses "fork" or "spawn". Returns false for anything else.
+bool parseLaunchBackend( const std::string & name, LaunchBackend & backend );
+// Name of the backend, for "set -o".
+const char *launchBackendName( LaunchBackend backend );
+
+// Starts one command. inputfd and outputfd become the child's STDIN and
+// STDOUT (pass STDIN_FILENO/STDOUT_FILENO to leave them alone), then the
+// command's own file redirects are applied on top. pgid is the process group
+// to put the child in: -1 leaves it in the shell's group, 0 makes it the
+// leader of a new group, anything else joins that group. path is what
+// resolveExecutable() returned for the command. Children always start with
+// no blocked signals and default job control signals, whatever the shell has.
+// The child is pinned, reniced and moved into a cgroup as the command's
+// placement says, which always takes a fork(), whatever the backend.
+// Returns the child's pid, or -1 if it couldn't be started.
+pid_t launchCommand( const Command & command, const std::string & path, int inputfd, int outputfd, pid_t pgid );
+// Same as launchCommand(), but the child runs the given builtin instead of
+// exec()ing anything. Always forks, whatever the backend.
+pid_t launchBuiltin( const Builtin *builtin, const Command & command, int inputfd, int outputfd, pid_t pgid );
+
+#endif
@@ -0,0 +1,789 @@
+#include "lexer.hpp"
+#include <iostream>
+#include <cstring>
+#include <climits>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include "utils.hpp"
+#include "glob.hpp"
+using namespace std;
+
+// Characters that end an unquoted word.
+static inline bool isDelimiter( char c )
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '|' || c == '<' || c == '>' || c == '&';
+}
+
+// Characters that mean a word can't just be a view into the line.
+static inline bool needsUnquoting( char c )
+{
+	return c == '\'' || c == '"' || c == '\\' || c == '$';
+}
+
+// Characters that make an unquoted word a pattern.
+static inline bool isGlobCharacter( char c )
+{
+	return c == '*' || c == '?' || c == '[';
+}
+
+// Characters that can be in a variable's name (but not start it, for digits).
+static inline bool isNameCharacter( char c )
+{
+	return isalnum( (unsigned char)c ) || c == '_';
+}
+
+Lexer::Lexer( const char *line, size_t length, Arena & arena ) :
+	line( line ),
+	pos( line ),
+	end( line + length ),
+	arena( arena ),
+	scratch( NULL ),
+	scratchPos( NULL ),
+	scratchEnd( NULL ),
+	escapes( 0 )
+{
+}
+
+void Lexer::reserve( char *& word, size_t extra )
+{
+	size_t needed = extra + ( end - pos );
+	if( (size_t)( scratchEnd - scratchPos ) >= needed )
+	{
+		return;
+	}
+	size_t used = scratchPos - word;
+	char *bigger = arena.allocateArray<char>( used + needed );
+	memcpy( bigger, word, used );
+	word = bigger;
+	scratchPos = bigger + used;
+	scratchEnd = scratchPos + needed;
+}
+
+void Lexer::appendLiteral( char *& word, const char *text, size_t length, bool fromLine )
+{
+	size_t specials = 0;
+	for( size_t i = 0; i < length; i++ )
+	{
+		specials += isGlobCharacter( text[i] ) || text[i] == '\\';
+	}
+	// Text from the line already has room, but not the escapes.
+	if( !fromLine || specials > 0 )
+	{
+		reserve( word, ( fromLine ? 0 : length ) + specials );
+	}
+	if( specials == 0 )
+	{
+		memcpy( scratchPos, text, length );
+		scratchPos += length;
+		return;
+	}
+	for( size_t i = 0; i < length; i++ )
+	{
+		if( isGlobCharacter( text[i] ) || text[i] == '\\' )
+		{
+			*scratchPos++ = '\\';
+		}
+		*scratchPos++ = text[i];
+	}
+	escapes += specials;
+}
+
+bool Lexer::expand( char *& word )
+{
+	const char *name = pos;
+	size_t nameLength = 0;
+	if( pos < end && *pos == '{' )
+	{
+		const char *close = (const char *)memchr( pos, '}', end - pos );
+		if( close == NULL )
+		{
+			errorMessage = "Error parsing input command: missing closing }.";
+			return false;
+		}
+		name = pos + 1;
+		nameLength = close - name;
+		if( !( nameLength == 1 && *name == '?' ) && !Variables::validName( name, nameLength ) )
+		{
+			errorMessage = "Error parsing input command: bad substitution \"${" + string( name, nameLength ) + "}\".";
+			return false;
+		}
+		pos = close + 1;
+	}
+	else if( pos < end && *pos == '(' )
+	{
+		const char *close = findSubstitutionEnd( pos + 1, end );
+		if( close == NULL )
+		{
+			errorMessage = "Error parsing input command: missing closing ).";
+			return false;
+		}
+		const string & output = substitutions.output( line, end, pos + 1, close );
+		pos = close + 1;
+		appendLiteral( word, output.data(), output.length(), false );
+		return true;
+	}
+	else if( pos < end && *pos == '?' )
+	{
+		nameLength = 1;
+		pos++;
+	}
+	else if( pos < end && isNameCharacter( *pos ) && !isdigit( (unsigned char)*pos ) )
+	{
+		while( pos < end && isNameCharacter( *pos ) )
+		{
+			pos++;
+		}
+		nameLength = pos - name;
+	}
+	else
+	{
+		// A lone $ is just a $.
+		*scratchPos++ = '$';
+		return true;
+	}
+
+	char status[16];
+	const char *value;
+	if( nameLength == 1 && *name == '?' )
+	{
+		snprintf( status, sizeof( status ), "%d", shellVariables.lastStatus() );
+		value = status;
+	}
+	else
+	{
+		value = shellVariables.get( string( name, nameLength ) );
+	}
+	if( value != NULL )
+	{
+		appendLiteral( word, value, strlen( value ), false );
+	}
+	return true;
+}
+
+bool Lexer::next( Token & token )
+{
+	// Skip whitespace between tokens.
+	while( pos < end && ( *pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n' ) )
+	{
+		pos++;
+	}
+
+	token.source = pos;
+	token.begin = pos;
+	token.length = 0;
+	token.pattern = false;
+
+	// A '#' at the start of a word comments out the rest of the line.
+	if( pos == end || *pos == '#' )
+	{
+		pos = end;
+		token.type = TOKEN_END;
+		token.sourceEnd = pos;
+		return true;
+	}
+
+	// Operators.
+	switch( *pos )
+	{
+		case '|': token.type = TOKEN_PIPE; break;
+		case '<': token.type = TOKEN_LESS; break;
+		case '>': token.type = TOKEN_GREATER; break;
+		case '&': token.type = TOKEN_AMPERSAND; break;
+		default: token.type = TOKEN_WORD; break;
+	}
+	if( token.type != TOKEN_WORD )
+	{
+		token.length = 1;
+		token.sourceEnd = ++pos;
+		return true;
+	}
+
+	// Most words have no quotes or escapes, so first look for the end of the
+	// word hoping to hand back a view into the line.
+	const char *start = pos;
+	while( pos < end && !isDelimiter( *pos ) && !needsUnquoting( *pos ) )
+	{
+		pos++;
+	}
+	bool pattern = false;
+	for( const char *p = start; p < pos && !pattern; p++ )
+	{
+		pattern = isGlobCharacter( *p );
+	}
+	if( pos == end || isDelimiter( *pos ) )
+	{
+		token.length = pos - start;
+		token.sourceEnd = pos;
+		token.pattern = pattern;
+		return true;
+	}
+
+	// Otherwise build the unquoted word in the scratch buffer. It's sized for
+	// the whole line the first time it's needed. Unquoting never makes text
+	// longer, so only expanding a variable can make it run out.
+	if( scratch == NULL )
+	{
+		scratch = arena.allocateArray<char>( end - line );
+		scratchPos = scratch;
+		scratchEnd = scratch + ( end - line );
+	}
+	char *word = scratchPos;
+	memcpy( scratchPos, start, pos - start );
+	scratchPos += pos - start;
+	bool quoted = false;
+	bool expanded = false;
+	escapes = 0;
+	while( pos < end && !isDelimiter( *pos ) )
+	{
+		char c = *pos++;
+		if( c == '$' )
+		{
+			if( !expand( word ) )
+			{
+				token.type = TOKEN_ERROR;
+				return false;
+			}
+			expanded = true;
+		}
+		else if( c == '\\' )
+		{
+			// A backslash outside quotes takes the next character literally.
+			if( pos < end )
+			{
+				appendLiteral( word, pos++, 1, true );
+			}
+		}
+		else if( c == '\'' )
+		{
+			// Everything up to the closing single quote is literal.
+			const char *close = (const char *)memchr( pos, '\'', end - pos );
+			if( close == NULL )
+			{
+				errorMessage = "Error parsing input command: missing closing '.";
+				token.type = TOKEN_ERROR;
+				return false;
+			}
+			appendLiteral( word, pos, close - pos, true );
+			pos = close + 1;
+			quoted = true;
+		}
+		else if( c == '"' )
+		{
+			// Inside double quotes a backslash only escapes \ " $ and `.
+			while( pos < end && *pos != '"' )
+			{
+				if( *pos == '$' )
+				{
+					pos++;
+					if( !expand( word ) )
+					{
+						token.type = TOKEN_ERROR;
+						return false;
+					}
+					continue;
+				}
+				if( *pos == '\\' && pos + 1 < end &&
+					( pos[1] == '\\' || pos[1] == '"' || pos[1] == '$' || pos[1] == '`' ) )
+				{
+					pos++;
+				}
+				appendLiteral( word, pos++, 1, true );
+			}
+			if( pos == end )
+			{
+				errorMessage = "Error parsing input command: missing closing \".";
+				token.type = TOKEN_ERROR;
+				return false;
+			}
+			pos++;
+			quoted = true;
+		}
+		else
+		{
+			pattern = pattern || isGlobCharacter( c );
+			*scratchPos++ = c;
+		}
+	}
+
+	// Like $UNSET on its own: there's no word at all.
+	if( expanded && !quoted && scratchPos == word )
+	{
+		return next( token );
+	}
+
+	// The escapes are only wanted if the word is going to be matched.
+	if( escapes > 0 && !pattern )
+	{
+		scratchPos = word + unescapePattern( word, scratchPos - word, word );
+	}
+
+	token.begin = word;
+	token.length = scratchPos - word;
+	token.sourceEnd = pos;
+	token.pattern = pattern;
+	return true;
+}
+
+// True if token is written as NAME=..., i.e. a variable assignment.
+static bool isAssignment( const Token & token )
+{
+	const char *equals = (const char *)memchr( token.source, '=', token.sourceEnd - token.source );
+	return equals != NULL && Variables::validName( token.source, equals - token.source );
+}
+
+// True if token is the given keyword, written plainly (no quotes or escapes).
+static bool isKeyword( const Token & token, const char *keyword )
+{
+	size_t length = strlen( keyword );
+	return (size_t)( token.sourceEnd - token.source ) == length && memcmp( token.source, keyword, length ) == 0;
+}
+
+// Whether the token is an unquoted setting for a cgroup's controller file,
+// e.g. cpu.max=50000 or memory.max=1G.
+static bool isCgroupLimit( const Token & token )
+{
+	static const char *const controllers[] = { "cpu.", "memory.", "pids.", "io.", "cpuset." };
+	if( token.type != TOKEN_WORD )
+	{
+		return false;
+	}
+	const char *equals = (const char *)memchr( token.source, '=', token.sourceEnd - token.source );
+	for( unsigned int i = 0; equals != NULL && i < sizeof( controllers ) / sizeof( controllers[0] ); i++ )
+	{
+		size_t length = strlen( controllers[i] );
+		if( (size_t)( equals - token.source ) > length && memcmp( token.source, controllers[i], length ) == 0 )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copies a word into the arena as it is, without the escapes it has if it's
+// a pattern.
+static char *copyWord( Arena & arena, const Token & token )
+{
+	if( !token.pattern )
+	{
+		return arena.copy( token.begin, token.length );
+	}
+	char *copy = arena.allocateArray<char>( token.length + 1 );
+	copy[unescapePattern( token.begin, token.length, copy )] = '\0';
+	return copy;
+}
+
+// Parses one line into a list of commands, one per stage of the pipeline.
+bool parseLine( const char *line, size_t length, Arena & arena, vector<Command> & result, ostream & errors )
+{
+	result.clear();
+
+	Lexer lexer( line, length, arena );
+	Token token;
+	// Words of the command currently being parsed. Kept in the arena too, and
+	// doubled when it fills up.
+	size_t wordCount = 0;
+	size_t wordCapacity = 16;
+	Token *words = arena.allocateArray<Token>( wordCapacity );
+	const char *stageBegin = NULL;
+	const char *stageEnd = NULL;
+	// Whether any of the words are patterns, and the directories they've
+	// read, shared by every one on the line.
+	bool patterns = false;
+	DirectoryCache directories;
+	bool runInBackground = false;
+	// A line can start with keywords that apply to its whole pipeline: time
+	// has it timed, pipesize N sets the capacity of its pipes, timeout T
+	// limits how long it runs.
+	bool timed = false;
+	int pipeSize = 0;
+	double timeout = 0;
+	// A command can start with pin CPUS, nice [-n N] and cgroup GROUP
+	// [file=value...] to say where it runs. Before the line's first command
+	// they're for the whole pipeline, except where a later command says
+	// otherwise.
+	Placement placement;
+	Placement linePlacement;
+	// Tokens read ahead of a keyword that turned out to be the command's, or
+	// not to be a keyword at all, for the loop to look at again before it
+	// reads on. The last one is next.
+	Token heldTokens[2];
+	size_t heldCount = 0;
+	// Output files of the current command before its last one, which are only
+	// created and truncated.
+	size_t earlierCount = 0;
+	size_t earlierCapacity = 0;
+	const char **earlierOutputs = NULL;
+	// The command being filled in, always the last one in result.
+	Command *cmd = NULL;
+
+	for( ;; )
+	{
+		if( heldCount > 0 )
+		{
+			token = heldTokens[--heldCount];
+		}
+		else if( !lexer.next( token ) )
+		{
+			errors << lexer.error() << endl;
+			result.clear();
+			return false;
+		}
+
+		// Anything after a trailing '&' is a mistake.
+		if( runInBackground && token.type != TOKEN_END )
+		{
+			errors << "Error parsing input command: \"&\" must be at the end of the line." << endl;
+			result.clear();
+			return false;
+		}
+
+		if( token.type == TOKEN_WORD )
+		{
+			// Only plain keywords, not "time" or \time, and only at the start.
+			if( result.empty() && stageBegin == NULL && !timed && isKeyword( token, "time" ) )
+			{
+				timed = true;
+				continue;
+			}
+			if( result.empty() && stageBegin == NULL && pipeSize == 0 && isKeyword( token, "pipesize" ) )
+			{
+				Token size;
+				long bytes;
+				if( !lexer.next( size ) || size.type != TOKEN_WORD
+					|| !parseByteSize( string( size.begin, size.length ), bytes ) || bytes <= 0 || bytes > INT_MAX )
+				{
+					errors << "Error parsing input command: \"pipesize\" must be followed by a size, e.g. 1M." << endl;
+					result.clear();
+					return false;
+				}
+				pipeSize = bytes;
+				continue;
+			}
+			// timeout, pin, nice and cgroup are also the names of commands, so
+			// when what follows doesn't fit the keyword, e.g. timeout -s KILL 5
+			// or nice -5, the word is left to be the command instead.
+			if( result.empty() && stageBegin == NULL && timeout == 0 && isKeyword( token, "timeout" ) )
+			{
+				Token duration;
+				double seconds = 0;
+				if( !lexer.next( duration ) )
+				{
+					errors << lexer.error() << endl;
+					result.clear();
+					return false;
+				}
+				if( duration.type == TOKEN_WORD && parseDuration( string( duration.begin, duration.length ), seconds ) && seconds > 0 )
+				{
+					timeout = seconds;
+					continue;
+				}
+				heldTokens[heldCount++] = duration;
+			}
+			if( heldCount == 0 && stageBegin == NULL && isKeyword( token, "pin" ) )
+			{
+				Token cpus;
+				cpu_set_t *set = arena.allocateArray<cpu_set_t>( 1 );
+				if( !lexer.next( cpus ) )
+				{
+					errors << lexer.error() << endl;
+					result.clear();
+					return false;
+				}
+				if( cpus.type == TOKEN_WORD && parseCpuList( string( cpus.begin, cpus.length ), *set ) )
+				{
+					placement.cpus = set;
+					continue;
+				}
+				heldTokens[heldCount++] = cpus;
+			}
+			if( heldCount == 0 && stageBegin == NULL && isKeyword( token, "nice" ) )
+			{
+				Token option;
+				if( !lexer.next( option ) )
+				{
+					errors << lexer.error() << endl;
+					result.clear();
+					return false;
+				}
+				// Like nice(1): 10 unless -n says otherwise.
+				if( option.type == TOKEN_WORD && option.length > 0 && option.begin[0] != '-' )
+				{
+					placement.nice = 10;
+					heldTokens[heldCount++] = option;
+					continue;
+				}
+				Token amount;
+				char *end = NULL;
+				long value = 0;
+				if( option.type == TOKEN_WORD && isKeyword( option, "-n" ) )
+				{
+					if( !lexer.next( amount ) )
+					{
+						errors << lexer.error() << endl;
+						result.clear();
+						return false;
+					}
+					if( amount.type == TOKEN_WORD )
+					{
+						string number( amount.begin, amount.length );
+						value = strtol( number.c_str(), &end, 10 );
+						end = *end == '\0' && !number.empty() ? end : NULL;
+					}
+					if( end != NULL && value >= -40 && value <= 40 )
+					{
+						placement.nice = value;
+						continue;
+					}
+					heldTokens[heldCount++] = amount;
+				}
+				heldTokens[heldCount++] = option;
+			}
+			if( heldCount == 0 && stageBegin == NULL && isKeyword( token, "cgroup" ) )
+			{
+				Token group;
+				if( !lexer.next( group ) )
+				{
+					errors << lexer.error() << endl;
+					result.clear();
+					return false;
+				}
+				if( group.type == TOKEN_WORD )
+				{
+					placement.cgroup = copyWord( arena, group );
+
+					// Then any settings for it, up to the command.
+					vector<const char *> limits;
+					Token limit;
+					bool more;
+					while( ( more = lexer.next( limit ) ) && isCgroupLimit( limit ) )
+					{
+						limits.push_back( copyWord( arena, limit ) );
+					}
+					if( !more )
+					{
+						errors << lexer.error() << endl;
+						result.clear();
+						return false;
+					}
+					if( !limits.empty() )
+					{
+						limits.push_back( NULL );
+						placement.limits = arena.allocateArray<const char *>( limits.size() );
+						memcpy( (void *)placement.limits, limits.data(), limits.size() * sizeof( const char * ) );
+					}
+					heldTokens[heldCount++] = limit;
+					continue;
+				}
+				heldTokens[heldCount++] = group;
+			}
+			if( stageBegin == NULL )
+			{
+				stageBegin = token.source;
+				result.push_back( Command() );
+				cmd = &result.back();
+				cmd->placement = placement;
+				if( result.size() == 1 )
+				{
+					linePlacement = placement;
+				}
+			}
+			stageEnd = token.sourceEnd;
+			if( wordCount == wordCapacity )
+			{
+				Token *bigger = arena.allocateArray<Token>( wordCapacity * 2 );
+				memcpy( (void *)bigger, words, wordCount * sizeof( Token ) );
+				words = bigger;
+				wordCapacity *= 2;
+			}
+			words[wordCount++] = token;
+			patterns = patterns || token.pattern;
+			continue;
+		}
+
+		// Handle input and output redirection filenames.
+		if( token.type == TOKEN_LESS || token.type == TOKEN_GREATER )
+		{
+			Token filename;
+			if( !lexer.next( filename ) )
+			{
+				errors << lexer.error() << endl;
+				result.clear();
+				return false;
+			}
+			if( filename.type != TOKEN_WORD )
+			{
+				errors << "Error parsing input command: \"" << ( token.type == TOKEN_LESS ? '<' : '>' )
+					 << "\" must be followed by an " << ( token.type == TOKEN_LESS ? "input" : "output" )
+					 << " filename." << endl;
+				result.clear();
+				return false;
+			}
+			// A pattern is the file it matches, if it only matches one.
+			const char *path = NULL;
+			vector<string> matches;
+			if( filename.pattern && expandGlob( filename.begin, filename.length, directories, matches ) )
+			{
+				if( matches.size() > 1 )
+				{
+					errors << "Error parsing input command: \"" << string( filename.source, filename.sourceEnd - filename.source )
+						 << "\" matches more than one file." << endl;
+					result.clear();
+					return false;
+				}
+				path = arena.copy( matches[0].data(), matches[0].length() );
+			}
+			path = path != NULL ? path : copyWord( arena, filename );
+			if( stageBegin == NULL )
+			{
+				stageBegin = token.source;
+				result.push_back( Command() );
+				cmd = &result.back();
+				cmd->placement = placement;
+				if( result.size() == 1 )
+				{
+					linePlacement = placement;
+				}
+			}
+			stageEnd = filename.sourceEnd;
+			if( token.type == TOKEN_LESS )
+			{
+				cmd->inputFilename = path;
+			}
+			else
+			{
+				// More than one output file: the last one gets the output. Room
+				// is kept for the NULL at the end.
+				if( cmd->outputFilename[0] != '\0' )
+				{
+					if( earlierCount + 1 >= earlierCapacity )
+					{
+						earlierCapacity = earlierCapacity == 0 ? 4 : earlierCapacity * 2;
+						const char **bigger = arena.allocateArray<const char *>( earlierCapacity );
+						memcpy( (void *)bigger, earlierOutputs, earlierCount * sizeof( const char * ) );
+						earlierOutputs = bigger;
+					}
+					earlierOutputs[earlierCount++] = cmd->outputFilename;
+				}
+				cmd->outputFilename = path;
+			}
+			continue;
+		}
+
+		// A '&' puts the whole line in the background.
+		if( token.type == TOKEN_AMPERSAND )
+		{
+			runInBackground = true;
+			continue;
+		}
+
+		// Otherwise it's a '|' or the end of the line, either of which ends
+		// the current command.
+		if( wordCount == 0 )
+		{
+			// Nothing at all on the line is fine, an empty stage isn't.
+			if( token.type == TOKEN_END && result.empty() && !runInBackground && !timed && pipeSize == 0 && timeout == 0
+				&& !placement.any() )
+			{
+				return true;
+			}
+			if( token.type == TOKEN_PIPE || result.size() > 1 )
+			{
+				errors << "Error parsing input command: missing command around \"|\"." << endl;
+			}
+			else
+			{
+				errors << "Error parsing input command: missing command." << endl;
+			}
+			result.clear();
+			return false;
+		}
+
+		// A command of nothing but NAME=value words sets them, i.e. it's the
+		// set builtin.
+		bool assignments = true;
+		for( unsigned int i = 0; i < wordCount && assignments; i++ )
+		{
+			assignments = isAssignment( words[i] );
+		}
+
+		// Build the argv array straight from the words.
+		cmd->rawString = arena.copy( stageBegin, stageEnd - stageBegin );
+		if( patterns && !assignments )
+		{
+			// Patterns are replaced by their matches, so the count isn't
+			// known until they've all been expanded.
+			vector<char *> expanded;
+			vector<string> matches;
+			for( unsigned int i = 0; i < wordCount; i++ )
+			{
+				if( !words[i].pattern || !expandGlob( words[i].begin, words[i].length, directories, matches ) )
+				{
+					expanded.push_back( copyWord( arena, words[i] ) );
+					continue;
+				}
+				for( size_t j = 0; j < matches.size(); j++ )
+				{
+					expanded.push_back( arena.copy( matches[j].data(), matches[j].length() ) );
+				}
+				matches.clear();
+			}
+			expanded.push_back( NULL );
+			cmd->argv = arena.allocateArray<char *>( expanded.size() );
+			memcpy( (void *)cmd->argv, expanded.data(), expanded.size() * sizeof( char * ) );
+		}
+		else
+		{
+			cmd->argv = arena.allocateArray<char *>( wordCount + 2 );	// Need +1 for extra NULL for execve(), +1 for set
+			char **argv = cmd->argv;
+			if( assignments )
+			{
+				*argv++ = arena.copy( "set", 3 );
+			}
+			for( unsigned int i = 0; i < wordCount; i++ )
+			{
+				argv[i] = copyWord( arena, words[i] );
+			}
+			argv[wordCount] = NULL;
+		}
+
+		// cmd > a > b creates or truncates a, and writes to b.
+		if( earlierCount > 0 )
+		{
+			earlierOutputs[earlierCount] = NULL;
+			cmd->truncatedOutputs = earlierOutputs;
+			earlierOutputs = NULL;
+			earlierCount = 0;
+			earlierCapacity = 0;
+		}
+
+		wordCount = 0;
+		patterns = false;
+		stageBegin = NULL;
+		placement = Placement();
+
+		if( token.type == TOKEN_END )
+		{
+			break;
+		}
+	}
+
+	// '&' and the keywords apply to every command in the pipeline.
+	for( unsigned int i = 0; i < result.size(); i++ )
+	{
+		result[i].executeInBackground = runInBackground;
+		result[i].timed = timed;
+		result[i].pipeSize = pipeSize;
+		result[i].timeout = timeout;
+		Placement & own = result[i].placement;
+		own.cpus = own.cpus != NULL ? own.cpus : linePlacement.cpus;
+		own.nice = own.nice != 0 ? own.nice : linePlacement.nice;
+		if( own.cgroup[0] == '\0' )
+		{
+			own.cgroup = linePlacement.cgroup;
+			own.limits = linePlacement.limits;
+		}
+	}
+
+	return true;
+}
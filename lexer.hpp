@@ -0,0 +1,96 @@
+#ifndef _LEXER_HPP_
+#define _LEXER_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "Command.hpp"
+#include "Arena.hpp"
+#include "Variables.hpp"
+#include "substitution.hpp"
+
+// Kinds of tokens in a command line.
+enum TokenType
+{
+	TOKEN_WORD,			// Command name, argument or filename.
+	TOKEN_PIPE,			// |
+	TOKEN_LESS,			// <
+	TOKEN_GREATER,		// >
+	TOKEN_AMPERSAND,	// &
+	TOKEN_END,			// End of the line (or a # comment).
+	TOKEN_ERROR			// E.g. an unterminated quote.
+};
+
+// A token is a view, not a copy. Plain words point straight into the input
+// line; only words that had quotes, backslashes or variables to deal with
+// point into the lexer's scratch buffer in the arena instead.
+struct Token
+{
+	TokenType	type;
+	const char	*begin;		// The word's text, after quote removal.
+	size_t		length;
+	const char	*source;	// Where the token starts in the input line.
+	const char	*sourceEnd;	// Just past where it ends in the input line.
+	bool		pattern;	// Has an unquoted *, ? or [, and then a \ before each quoted * ? [ or \.
+};
+
+// Splits a command line into tokens in a single pass. Understands 'single'
+// and "double" quotes, backslash escapes, the | < > & operators and
+// # comments, and expands $NAME, ${NAME} and $? from shellVariables and
+// $(pipeline) to its output (see substitution.hpp) outside single quotes.
+// Expansions aren't split into words, but an unquoted word that expands to
+// nothing is left out. Words are only copied when quotes,
+// escapes or variables have to be dealt with. Words with unquoted wildcards
+// are marked as patterns, for parseLine() to expand.
+class Lexer
+{
+public:
+	Lexer( const char *line, size_t length, Arena & arena );
+
+	// Reads the next token. Returns false (and a TOKEN_ERROR token) if the
+	// line can't be tokenized, with the reason in error().
+	bool next( Token & token );
+	const std::string & error() const { return errorMessage; }
+
+private:
+	const char		*line;
+	const char		*pos;
+	const char		*end;
+	Arena			&arena;
+	char			*scratch;		// Unquoted copies of words that needed it, NULL until one does.
+	char			*scratchPos;
+	char			*scratchEnd;
+	std::string		errorMessage;
+	Substitutions	substitutions;	// Run when the first $(...) is reached.
+	size_t			escapes;		// \ escapes put in the current word, for a pattern.
+
+	// Makes room in the scratch buffer for extra more characters on top of
+	// what the rest of the line could need, moving the word being built
+	// (which starts at word) if it has to.
+	void reserve( char *& word, size_t extra );
+	// Appends the expansion of the variable named just after a $, or of the
+	// $(...) there, to word, or the $ itself if it isn't followed by a name.
+	// Returns false if it's malformed, e.g. ${NAME with no }.
+	bool expand( char *& word );
+	// Appends length characters of text to word to be taken literally, with
+	// a \ before any that a pattern would treat specially. fromLine says
+	// they're characters of the line, which the scratch buffer has room for.
+	void appendLiteral( char *& word, const char *text, size_t length, bool fromLine );
+};
+
+// Parses one line into a list of commands, one per stage of the pipeline,
+// filling in each Command directly from the tokens. Patterns among a
+// command's arguments are replaced by the paths they match (see glob.hpp).
+// Keywords at the start of the line aren't commands but apply to all of
+// them: time marks each one as timed, pipesize <size> sets their pipeSize,
+// timeout <time> their timeout, unless what follows doesn't fit, when the
+// word is left to be a command, like timeout -s KILL 5 cmd. A command with more than one output redirect
+// writes to the last, and only truncates the others. Every argv array and
+// string comes from arena, so the commands are only good until it's released.
+// Returns false after printing an error to errors if the line isn't valid. An
+// empty line (or just a comment) gives an empty list.
+bool parseLine( const char *line, size_t length, Arena & arena, std::vector<Command> & result,
+	std::ostream & errors = std::cerr );
+
+#endif
@@ -0,0 +1,305 @@
+#include "pipeline.hpp"
+#include "launch.hpp"
+#include "utils.hpp"
+#include "events.hpp"
+#include "JobTable.hpp"
+#include "trace.hpp"
+#include "utilities.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
+using namespace std;
+
+int pipeSize = 0;
+double backgroundDeadline = 0;
+
+void setPipeSize( int fd, int size )
+{
+	static bool warned = false;
+	if( fcntl( fd, F_SETPIPE_SZ, size ) < 0 && !warned )
+	{
+		cerr << "Couldn't set pipe size to " << size << ": " << strerror( errno ) << endl;
+		warned = true;
+	}
+}
+
+// True if quash owns the terminal, so a foreground pipeline can get its own
+// process group and be handed the terminal while it runs.
+static bool haveJobControl()
+{
+	return isatty( STDIN_FILENO ) && tcgetpgrp( STDIN_FILENO ) == getpgrp();
+}
+
+// What a line that's nothing but cat file... > out runs instead of cat.
+static const Builtin plainCopy = { "cat", copyBuiltin };
+
+void startPipeline( const vector<Command> & commandList, PipelineRun & run, bool ownProcessGroup,
+	bool builtinInShell, int inputfd, int outputfd )
+{
+	Stage notStarted;
+	notStarted.pid = -1;
+	notStarted.status = 127 << 8;
+	run.pgid = -1;
+	run.startTime = monotonicTime();
+	run.stages.assign( commandList.size(), notStarted );
+	run.shellCommand = NULL;
+	run.shellBuiltin = NULL;
+
+	// Start with input from inputfd, then each command reads the read end of
+	// the pipe the command before it writes to. The shell's ends of each pipe
+	// are closed as soon as the stages using them have been started.
+	FileDescriptor pipeInput;
+	for( unsigned int i = 0; i < commandList.size(); i++ )
+	{
+		// Every command but the last writes into a new pipe. Both ends are
+		// close-on-exec so no child keeps a stray copy; the child's dup2()
+		// onto STDIN/STDOUT clears that flag for the end it uses.
+		FileDescriptor pipeOutput;
+		FileDescriptor nextInput;
+		if( i + 1 < commandList.size() )
+		{
+			if( !makePipe( nextInput, pipeOutput ) )
+			{
+				cerr << "Could not open pipe." << endl;
+				return;
+			}
+			int size = commandList[i].pipeSize > 0 ? commandList[i].pipeSize : pipeSize;
+			if( size > 0 )
+			{
+				setPipeSize( pipeOutput.get(), size );
+			}
+		}
+		int input = pipeInput.valid() ? pipeInput.get() : inputfd;
+		int output = pipeOutput.valid() ? pipeOutput.get() : outputfd;
+
+		// A builtin on its own can be run by the shell itself.
+		long long start = tracing() ? traceTime() : 0;
+		const Builtin *builtin = findBuiltin( commandList[i].argv[0] );
+		if( builtin == NULL && builtinInShell && commandList.size() == 1 && isPlainCopy( commandList[i] ) )
+		{
+			builtin = &plainCopy;
+		}
+		traceSpan( "builtin detection", start, commandList[i].argv[0] );
+		// One that has to be placed somewhere is forked, or the shell would
+		// be placed instead.
+		if( builtin != NULL && builtinInShell && commandList.size() == 1 && !commandList[i].placement.any() )
+		{
+			run.shellCommand = &commandList[i];
+			run.shellBuiltin = builtin;
+			run.shellStage = i;
+			run.shellInput = input;
+			run.shellOutput = output;
+			run.stages[i].pid = 0;
+			continue;
+		}
+
+		pid_t pgid = -1;
+		if( ownProcessGroup )
+		{
+			pgid = run.pgid > 0 ? run.pgid : 0;
+		}
+		pid_t pid;
+		if( builtin != NULL )
+		{
+			pid = launchBuiltin( builtin, commandList[i], input, output, pgid );
+		}
+		else
+		{
+			// Find the executable here in the parent so the PATH cache remembers it.
+			string path = resolveExecutable( commandList[i].argv );
+			pid = launchCommand( commandList[i], path, input, output, pgid );
+		}
+		if( pid > 0 && ownProcessGroup )
+		{
+			// Same setpgid() as the child does, whichever runs first wins.
+			setpgid( pid, pgid == 0 ? pid : pgid );
+			if( run.pgid <= 0 )
+			{
+				run.pgid = pid;
+			}
+		}
+		run.stages[i].pid = pid;
+
+		// The child has its own copies of the pipe ends now, so the shell's
+		// go: pipeOutput here, pipeInput by being replaced.
+		pipeInput = move( nextInput );
+	}
+}
+
+int waitPipeline( PipelineRun & run )
+{
+	if( run.shellBuiltin != NULL )
+	{
+		struct rusage before, after;
+		getrusage( RUSAGE_SELF, &before );
+		int status = runBuiltin( run.shellBuiltin, *run.shellCommand, run.shellInput, run.shellOutput );
+		getrusage( RUSAGE_SELF, &after );
+		Stage & stage = run.stages[run.shellStage];
+		stage.status = ( status & 0xff ) << 8;
+		stage.usage.difference( before, after );
+		stage.usage.wallTime = monotonicTime() - run.startTime;
+		run.shellBuiltin = NULL;
+	}
+
+	for( unsigned int i = 0; i < run.stages.size(); i++ )
+	{
+		if( run.stages[i].pid <= 0 )
+		{
+			continue;
+		}
+		struct rusage usage;
+		double reaped;
+		long long start = tracing() ? traceTime() : 0;
+		bool waited = waitForChild( run.stages[i].pid, run.stages[i].status, &usage, &reaped );
+		if( tracing() )
+		{
+			char pid[32];
+			snprintf( pid, sizeof( pid ), "pid %d", (int)run.stages[i].pid );
+			traceSpan( "wait", start, pid );
+		}
+		if( waited )
+		{
+			run.stages[i].usage.add( usage );
+			run.stages[i].usage.wallTime = reaped - run.startTime;
+		}
+	}
+
+	return run.stages.size() > 0 ? exitStatus( run.stages.back().status ) : 0;
+}
+
+int exitStatus( int status )
+{
+	if( WIFEXITED( status ) )
+	{
+		return WEXITSTATUS( status );
+	}
+	if( WIFSIGNALED( status ) )
+	{
+		return 128 + WTERMSIG( status );
+	}
+	return 0;
+}
+
+const Job *startBackgroundJob( const vector<Command> & commandList, bool quiet, int outputfd )
+{
+	// Background jobs always get their own process group. A builtin among
+	// them is forked too, the shell can't wait around to run it.
+	PipelineRun run;
+	startPipeline( commandList, run, true, false, STDIN_FILENO, outputfd );
+
+	// The pid reported for a background job is that of the first child
+	// that was started, which is also its process group.
+	vector<pid_t> pids;
+	for( unsigned int i = 0; i < run.stages.size(); i++ )
+	{
+		if( run.stages[i].pid > 0 )
+		{
+			pids.push_back( run.stages[i].pid );
+		}
+	}
+	if( pids.size() == 0 )
+	{
+		return NULL;
+	}
+
+	// Put together all of the separate commands that were piped together.
+	string command = commandList[0].rawString;
+	for( unsigned int i = 1; i < commandList.size(); i++ )
+	{
+		command += " | ";
+		command += commandList[i].rawString;
+	}
+	return &backgroundJobs.add( command, pids, quiet );
+}
+
+// Prints what each stage of a timed pipeline used, then the whole pipeline's
+// total if there's more than one.
+static void printUsage( ostream & os, const vector<Command> & commandList, const PipelineRun & run )
+{
+	ResourceUsage total;
+	for( unsigned int i = 0; i < run.stages.size(); i++ )
+	{
+		const Stage & stage = run.stages[i];
+		stage.usage.print( os );
+		os << "\t" << commandList[i].rawString << ( stage.pid == 0 ? " (builtin)" : "" ) << endl;
+		total.add( stage.usage );
+		if( stage.usage.wallTime > total.wallTime )
+		{
+			total.wallTime = stage.usage.wallTime;
+		}
+	}
+	if( run.stages.size() > 1 )
+	{
+		total.print( os );
+		os << "\ttotal" << endl;
+	}
+}
+
+// Executes a list of commands, piping each to the next successively. Every
+// stage is started before any is waited for, so they all run concurrently.
+int executeCommandList( const vector<Command> & commandList )
+{
+	TraceSpan span( "pipeline", commandList[0].rawString );
+	bool background = commandList[commandList.size() - 1].executeInBackground;
+	bool jobControl = !background && haveJobControl();
+
+	double timeout = commandList[0].timeout;
+	if( background )
+	{
+		const Job *job = startBackgroundJob( commandList );
+		if( job != NULL )
+		{
+			double limit = timeout > 0 ? timeout : backgroundDeadline;
+			if( limit > 0 )
+			{
+				setDeadline( job->pid, limit );
+			}
+			cout << "[" << job->jobId << "] " << job->pid << " running in background." << endl;
+		}
+		return 0;
+	}
+
+	// Foreground pipelines get their own process group when there's a
+	// terminal to hand them. A builtin on its own runs inside the shell.
+	// With a timeout they always need a group for the deadline to signal,
+	// and no builtin in the shell, where it couldn't be stopped.
+	PipelineRun run;
+	startPipeline( commandList, run, jobControl || timeout > 0, timeout == 0 );
+	if( timeout > 0 && run.pgid > 0 )
+	{
+		setDeadline( run.pgid, timeout );
+	}
+	if( jobControl && run.pgid > 0 )
+	{
+		// A stage that read the terminal before it was handed over was
+		// stopped by SIGTTIN. Now it can carry on.
+		tcsetpgrp( STDIN_FILENO, run.pgid );
+		killpg( run.pgid, SIGCONT );
+	}
+	// Parent waits for every stage to finish.
+	int result = waitPipeline( run );
+	if( jobControl )
+	{
+		tcsetpgrp( STDIN_FILENO, getpgrp() );
+	}
+
+	if( timeout > 0 && run.pgid > 0 && clearDeadline( run.pgid ) )
+	{
+		result = 124;
+	}
+
+	if( commandList[0].timed )
+	{
+		printUsage( cerr, commandList, run );
+	}
+
+	return result;
+}
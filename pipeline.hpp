@@ -0,0 +1,81 @@
+#ifndef _PIPELINE_HPP_
+#define _PIPELINE_HPP_
+
+#include <vector>
+#include <sys/types.h>
+#include <unistd.h>
+#include "Command.hpp"
+#include "builtins.hpp"
+#include "JobTable.hpp"
+#include "ResourceUsage.hpp"
+#include "FileDescriptor.hpp"
+
+// One process of a pipeline that has been started.
+struct Stage
+{
+	pid_t			pid;		// -1 if the stage couldn't be started, 0 if it's a builtin run by the shell itself.
+	int				status;		// Status from waitpid(), valid once the stage was waited for.
+	ResourceUsage	usage;		// What it used, from wait4(). The wall time is until it was reaped.
+};
+
+// A pipeline whose stages are all running at the same time.
+struct PipelineRun
+{
+	pid_t				pgid;		// Process group shared by every stage, -1 if the shell's own.
+	std::vector<Stage>	stages;		// One per command, in pipeline order.
+	double				startTime;	// monotonicTime() when it was started.
+
+	// A builtin that's the whole pipeline runs inside the shell instead of a
+	// child, when waitPipeline() gets to it, with these fds.
+	const Command		*shellCommand;	// NULL if there is none.
+	const Builtin		*shellBuiltin;
+	unsigned int		shellStage;
+	int					shellInput;
+	int					shellOutput;
+};
+
+// Capacity in bytes to give every pipe between stages (set -o pipesize), or 0
+// to leave the kernel's default. A pipeline's pipesize prefix overrides it.
+// Bigger pipes mean fewer context switches when stages move lots of data.
+extern int pipeSize;
+// Time limit in seconds for background jobs without a timeout prefix (set -o
+// deadline), or 0 for none. See setDeadline() in events.hpp.
+extern double backgroundDeadline;
+// Gives a pipe the capacity, rounded up by the kernel to a power of two
+// pages. Says so once if the kernel won't (over /proc/sys/fs/pipe-max-size
+// for an unprivileged user), and carries on with the pipe as it is.
+void setPipeSize( int fd, int size );
+
+// Starts every command in the list at once, each one's STDOUT piped into the
+// next one's STDIN. The first command reads from inputfd and the last writes
+// to outputfd. If ownProcessGroup is set the stages share a new process group,
+// otherwise they stay in the shell's. Builtins get forked like any other
+// command, except that if builtinInShell is set a builtin that's the only
+// command is left for waitPipeline() to run inside the shell, so cd or exit
+// can change it. As a stage of a longer pipeline one is forked, the way sh
+// does, so cd / | cat leaves the shell where it was. Doesn't wait for
+// anything.
+void startPipeline( const std::vector<Command> & commandList, PipelineRun & run, bool ownProcessGroup,
+	bool builtinInShell, int inputfd = STDIN_FILENO, int outputfd = STDOUT_FILENO );
+// Runs the pipeline's in-shell builtin if it has one, or waits for each of
+// the stages with wait4(), filling in their statuses and usage. Returns the
+// exit status of the last stage, the way a shell reports it.
+int waitPipeline( PipelineRun & run );
+// Turns a waitpid() status into a shell exit status (128 + signal if killed).
+int exitStatus( int status );
+
+// Starts the command list as a background job, in its own process group, and
+// adds it to backgroundJobs. Returns the job, or NULL if nothing could be
+// started. Quiet jobs get no "finished" notice. The last command writes to
+// outputfd.
+const Job *startBackgroundJob( const std::vector<Command> & commandList, bool quiet = false,
+	int outputfd = STDOUT_FILENO );
+
+// Executes a list of commands, piping each to the next successively. Returns
+// the exit status of the last command, or 0 if it went to the background. A
+// timed foreground pipeline reports what each stage used on stderr. One with
+// a timeout runs in a process group of its own, and returns 124 if it's
+// still running when the time is up.
+int executeCommandList( const std::vector<Command> & commandList );
+
+#endif
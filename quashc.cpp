@@ -0,0 +1,207 @@
+// quashc: runs commands on a quash -d daemon, or puts load on one.
+//
+//   quashc [-s socket] [-c commands]
+//       Sends the commands (or stdin) as one batch, writes back each line's
+//       output and error output as it comes, and exits with the status of
+//       the last line.
+//   quashc [-s socket] -n requests [-j clients] commands
+//       Sends the commands requests times, from clients processes at once,
+//       and prints the requests per second and the median and 99th
+//       percentile latency in microseconds, separated by spaces.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "daemon.hpp"
+#include "FileDescriptor.hpp"
+using namespace std;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void usage()
+{
+	cerr << "Usage: quashc [-s socket] [-c commands]" << endl;
+	cerr << "       quashc [-s socket] -n requests [-j clients] commands" << endl;
+}
+
+// Sends batch to the daemon and reads back every frame, writing output to
+// out and error output to err, or dropping them if those are -1. Returns the
+// status of the last line, or -1 if the daemon can't be reached.
+static int request( const string & path, const string & batch, int out, int err )
+{
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, path.c_str(), sizeof( address.sun_path ) - 1 );
+	FileDescriptor fd( socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) );
+	if( connect( fd.get(), (struct sockaddr *)&address, sizeof( address ) ) < 0 )
+	{
+		return -1;
+	}
+
+	// The batch ends where the client stops writing.
+	for( size_t sent = 0; sent < batch.length(); )
+	{
+		ssize_t written = write( fd.get(), batch.data() + sent, batch.length() - sent );
+		if( written < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( written <= 0 )
+		{
+			return -1;
+		}
+		sent += written;
+	}
+	shutdown( fd.get(), SHUT_WR );
+
+	int status = 0;
+	FrameHeader header;
+	string payload;
+	while( readFrame( fd.get(), header, payload ) )
+	{
+		int target = header.type == FRAME_STDOUT ? out : header.type == FRAME_STDERR ? err : -1;
+		if( header.type == FRAME_STATUS && payload.length() == sizeof( uint32_t ) )
+		{
+			uint32_t code;
+			memcpy( &code, payload.data(), sizeof( code ) );
+			status = code;
+		}
+		for( size_t done = 0; target >= 0 && done < payload.length(); )
+		{
+			ssize_t written = write( target, payload.data() + done, payload.length() - done );
+			if( written <= 0 && errno != EINTR )
+			{
+				break;
+			}
+			done += written > 0 ? written : 0;
+		}
+	}
+	return status;
+}
+
+// Sends batch requests times from clients processes at once, and prints the
+// throughput and latency.
+static int load( const string & path, const string & batch, unsigned long requests, unsigned int clients )
+{
+	// Each client writes its own requests' latencies, in nanoseconds.
+	size_t size = requests * sizeof( double );
+	double *latencies = (double *)mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if( latencies == MAP_FAILED )
+	{
+		perror( "quashc: mmap" );
+		return 1;
+	}
+
+	double start = now();
+	for( unsigned int c = 0; c < clients; c++ )
+	{
+		if( fork() == 0 )
+		{
+			for( unsigned long i = c; i < requests; i += clients )
+			{
+				double sent = now();
+				if( request( path, batch, -1, -1 ) < 0 )
+				{
+					_exit( 1 );
+				}
+				latencies[i] = now() - sent;
+			}
+			_exit( 0 );
+		}
+	}
+	bool failed = false;
+	int status;
+	while( wait( &status ) > 0 )
+	{
+		failed = failed || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0;
+	}
+	double elapsed = now() - start;
+	if( failed )
+	{
+		cerr << "quashc: can't reach the daemon on " << path << endl;
+		return 1;
+	}
+
+	sort( latencies, latencies + requests );
+	printf( "%.1f %.1f %.1f\n", requests / ( elapsed / 1e9 ), latencies[requests / 2] / 1000,
+		latencies[min( requests - 1, requests * 99 / 100 )] / 1000 );
+	munmap( latencies, size );
+	return 0;
+}
+
+int main( int argc, char **argv )
+{
+	string path = defaultSocketPath();
+	string batch;
+	bool haveBatch = false;
+	unsigned long requests = 0;
+	unsigned int clients = 1;
+
+	int option;
+	while( ( option = getopt( argc, argv, "s:c:n:j:" ) ) != -1 )
+	{
+		switch( option )
+		{
+		case 's':
+			path = optarg;
+			break;
+		case 'c':
+			batch = optarg;
+			haveBatch = true;
+			break;
+		case 'n':
+			requests = strtoul( optarg, NULL, 10 );
+			break;
+		case 'j':
+			clients = max( 1ul, strtoul( optarg, NULL, 10 ) );
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+
+	if( requests > 0 )
+	{
+		if( optind != argc - 1 )
+		{
+			usage();
+			return 2;
+		}
+		return load( path, argv[optind], requests, clients );
+	}
+
+	if( !haveBatch )
+	{
+		char buffer[65536];
+		ssize_t got;
+		while( ( got = read( STDIN_FILENO, buffer, sizeof( buffer ) ) ) > 0 || ( got < 0 && errno == EINTR ) )
+		{
+			batch.append( buffer, got > 0 ? got : 0 );
+		}
+	}
+	int status = request( path, batch, STDOUT_FILENO, STDERR_FILENO );
+	if( status < 0 )
+	{
+		cerr << "quashc: can't reach the daemon on " << path << ": " << strerror( errno ) << endl;
+		return 127;
+	}
+	return status;
+}
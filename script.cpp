@@ -0,0 +1,238 @@
+#include "script.hpp"
+#include "utils.hpp"
+#include "lexer.hpp"
+#include "pipeline.hpp"
+#include "CompiledScript.hpp"
+#include "trace.hpp"
+#include "FileDescriptor.hpp"
+#include "Variables.hpp"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+// Runs a line that has been parsed. Reaps background jobs and prints their
+// notices first.
+static int runCommands( const vector<Command> & commandList )
+{
+	reapChildren();
+	backgroundJobs.printNotices( cout );
+	int status = executeCommandList( commandList );
+	if( fdCheck )
+	{
+		checkShellFds( commandList[0].rawString, strlen( commandList[0].rawString ) );
+	}
+	return status;
+}
+
+int runLine( const char *line, size_t length, int lastStatus )
+{
+	// Reused for every line, so its buffer is only allocated once.
+	static vector<Command> commandList;
+
+	// The last line's commands have all been launched by now, so everything
+	// they pointed to can go in one step.
+	commandList.clear();
+	lineArena.release();
+
+	shellVariables.setLastStatus( lastStatus );
+	nextTracePipeline();
+	bool parsed;
+	{
+		TraceSpan span( "parse" );
+		parsed = parseLine( line, length, lineArena, commandList );
+	}
+	if( !parsed )
+	{
+		return 2;
+	}
+	if( commandList.size() == 0 )
+	{
+		return lastStatus;
+	}
+	return runCommands( commandList );
+}
+
+// Runs each line of a compiled script in turn.
+static int runCompiled( const CompiledScript & script )
+{
+	vector<Command> commandList;
+	const char *raw;
+	size_t rawLength;
+	int status = 0;
+	for( size_t i = 0; i < script.lineCount(); i++ )
+	{
+		lineArena.release();
+		nextTracePipeline();
+		{
+			TraceSpan span( "load compiled line" );
+			script.getLine( i, lineArena, commandList, raw, rawLength );
+		}
+		// A line that didn't compile gets parsed now, to expand its variables
+		// or just to say why it's wrong.
+		if( commandList.size() == 0 )
+		{
+			status = runLine( raw, rawLength, status );
+			continue;
+		}
+		status = runCommands( commandList );
+	}
+	return status;
+}
+
+// The script being compiled as it runs, by this process, and what of it
+// hasn't been reached yet.
+static CompiledScript *compilingScript = NULL;
+static pid_t compilingProcess = -1;
+static const char *uncompiled = NULL;
+static const char *uncompiledEnd = NULL;
+
+// Compiles the rest of the script without running it, and caches it. Also
+// called on exit, so a script that ends with exit (or stops part way
+// through) is still cached whole. Not in a forked copy of the shell, though,
+// which has nothing to do with it.
+static void finishCompiling()
+{
+	if( compilingScript == NULL || compilingProcess != getpid() )
+	{
+		return;
+	}
+	TraceSpan span( "compile script" );
+	Arena arena;
+	vector<Command> commands;
+	while( uncompiled < uncompiledEnd )
+	{
+		const char *newline = (const char*)memchr( uncompiled, '\n', uncompiledEnd - uncompiled );
+		const char *lineEnd = newline ? newline : uncompiledEnd;
+		compilingScript->compileLine( uncompiled, lineEnd - uncompiled, arena, commands );
+		arena.release();
+		uncompiled = lineEnd + 1;
+	}
+	compilingScript->finishCompiling();
+	compilingScript = NULL;
+}
+
+// Runs each line between begin and end in turn, compiling it into script as
+// it's reached. A line that compiles is run from the commands that leaves,
+// so it's only parsed once.
+static int runCompiling( CompiledScript & script, const char *begin, const char *end )
+{
+	compilingScript = &script;
+	compilingProcess = getpid();
+	uncompiledEnd = end;
+	atexit( finishCompiling );
+
+	vector<Command> commandList;
+	int status = 0;
+	while( begin < end )
+	{
+		const char *newline = (const char*)memchr( begin, '\n', end - begin );
+		const char *lineEnd = newline ? newline : end;
+		uncompiled = lineEnd + 1;
+		lineArena.release();
+		nextTracePipeline();
+		{
+			TraceSpan span( "compile line" );
+			script.compileLine( begin, lineEnd - begin, lineArena, commandList );
+		}
+		// Anything else is parsed now, to expand its variables or just to
+		// say why it's wrong.
+		status = commandList.empty() ? runLine( begin, lineEnd - begin, status ) : runCommands( commandList );
+		begin = lineEnd + 1;
+	}
+	finishCompiling();
+	return status;
+}
+
+// Runs each line between begin and end in turn.
+static int runLines( const char *begin, const char *end )
+{
+	int status = 0;
+	while( begin < end )
+	{
+		const char *newline = (const char*)memchr( begin, '\n', end - begin );
+		const char *lineEnd = newline ? newline : end;
+		status = runLine( begin, lineEnd - begin, status );
+		begin = lineEnd + 1;
+	}
+	return status;
+}
+
+int runScriptFile( const char *path )
+{
+	FileDescriptor fd( open( path, O_RDONLY | O_CLOEXEC ) );
+	struct stat info;
+	if( !fd.valid() || fstat( fd.get(), &info ) < 0 )
+	{
+		cerr << "quash: " << path << ": " << strerror( errno ) << endl;
+		return 127;
+	}
+
+	// mmap() won't map nothing.
+	if( info.st_size == 0 )
+	{
+		return 0;
+	}
+
+	// The cache is keyed on the absolute path, so running the script from
+	// another directory still finds it.
+	char *absolutePath = realpath( path, NULL );
+	CompiledScript compiled;
+	bool loaded;
+	{
+		TraceSpan span( "load script cache", path );
+		loaded = absolutePath != NULL && compiled.load( absolutePath, info );
+	}
+	if( loaded )
+	{
+		// Not a single line needs lexing.
+		free( absolutePath );
+		fd.reset();
+		return runCompiled( compiled );
+	}
+
+	// The mapping outlives the fd, so children never see the script at all.
+	void *script = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0 );
+	fd.reset();
+	if( script == MAP_FAILED )
+	{
+		cerr << "quash: " << path << ": " << strerror( errno ) << endl;
+		free( absolutePath );
+		return 127;
+	}
+	// It's read once, front to back.
+	madvise( script, info.st_size, MADV_SEQUENTIAL );
+
+	// Run it straight from the mapping, compiling it for next time as it
+	// goes if there's somewhere to put it.
+	const char *begin = (const char*)script;
+	int status;
+	if( absolutePath != NULL && compiled.startCompiling( absolutePath, info ) )
+	{
+		// The compiled sections' files stay open while it runs, which isn't
+		// a leak.
+		if( fdCheck )
+		{
+			setFdCheck( true );
+		}
+		status = runCompiling( compiled, begin, begin + info.st_size );
+	}
+	else
+	{
+		status = runLines( begin, begin + info.st_size );
+	}
+	munmap( script, info.st_size );
+	free( absolutePath );
+	return status;
+}
+
+int runCommandString( const char *commands )
+{
+	return runLines( commands, commands + strlen( commands ) );
+}
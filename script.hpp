@@ -0,0 +1,21 @@
+#ifndef _SCRIPT_HPP_
+#define _SCRIPT_HPP_
+
+#include <cstddef>
+
+// Parses one line of input straight from memory (it doesn't need to be NUL
+// terminated) and runs it. Unless the line is empty, reaps background jobs
+// and prints their notices first, the same as before a prompt. Returns the exit status of the line:
+// 2 if it doesn't parse, lastStatus if there's nothing on it.
+int runLine( const char *line, size_t length, int lastStatus );
+// Runs every line of the script at path (quash script.sh). The file is mapped
+// into memory and parsed in place, never copied or read line by line, so even
+// a huge script starts right away. The parsed form is cached (see
+// CompiledScript.hpp), so running the same script again skips parsing
+// altogether. Commands get quash's own stdin, not the script. Returns the
+// exit status of the last line, or 127 if the script can't be opened.
+int runScriptFile( const char *path );
+// Runs a string of one or more lines, for quash -c "commands".
+int runCommandString( const char *commands );
+
+#endif
@@ -0,0 +1,316 @@
+#include "substitution.hpp"
+#include "lexer.hpp"
+#include "events.hpp"
+#include "trace.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+using namespace std;
+
+bool parallelSubstitutions = false;
+
+const char *findSubstitutionEnd( const char *begin, const char *end )
+{
+	const char *pos = begin;
+	int depth = 0;
+	while( pos < end )
+	{
+		char c = *pos++;
+		if( c == '\\' )
+		{
+			pos = pos < end ? pos + 1 : pos;
+		}
+		else if( c == '\'' )
+		{
+			const char *close = (const char *)memchr( pos, '\'', end - pos );
+			if( close == NULL )
+			{
+				return NULL;
+			}
+			pos = close + 1;
+		}
+		else if( c == '"' )
+		{
+			// A ) inside double quotes doesn't count, but one closing a
+			// substitution in them has to be found to know where they end.
+			while( pos < end && *pos != '"' )
+			{
+				if( *pos == '\\' && pos + 1 < end )
+				{
+					pos += 2;
+				}
+				else if( *pos == '$' && pos + 1 < end && pos[1] == '(' )
+				{
+					pos = findSubstitutionEnd( pos + 2, end );
+					if( pos == NULL )
+					{
+						return NULL;
+					}
+					pos++;
+				}
+				else
+				{
+					pos++;
+				}
+			}
+			if( pos == end )
+			{
+				return NULL;
+			}
+			pos++;
+		}
+		else if( c == '(' )
+		{
+			depth++;
+		}
+		else if( c == ')' )
+		{
+			if( depth == 0 )
+			{
+				return pos - 1;
+			}
+			depth--;
+		}
+	}
+	return NULL;
+}
+
+// Parses the substitution's text and starts it writing to outputfd. One
+// ending in & is started as a quiet background job, which the output is
+// still read from until it's done. Leaves run empty if there's nothing to
+// wait for, including when the text doesn't parse. Deadlines are set the way
+// executeCommandList() sets them, so a timeout prefix works here too.
+static void startText( const char *text, size_t length, Arena & arena, vector<Command> & commands,
+	PipelineRun & run, bool builtinInShell, int outputfd )
+{
+	run.pgid = -1;
+	run.stages.clear();
+	run.shellBuiltin = NULL;
+	if( !parseLine( text, length, arena, commands ) || commands.empty() )
+	{
+		return;
+	}
+	double timeout = commands[0].timeout;
+	if( commands.back().executeInBackground )
+	{
+		const Job *job = startBackgroundJob( commands, true, outputfd );
+		double limit = timeout > 0 ? timeout : backgroundDeadline;
+		if( job != NULL && limit > 0 )
+		{
+			setDeadline( job->pid, limit );
+		}
+		return;
+	}
+	startPipeline( commands, run, timeout > 0, builtinInShell && timeout == 0, STDIN_FILENO, outputfd );
+	if( timeout > 0 && run.pgid > 0 )
+	{
+		setDeadline( run.pgid, timeout );
+	}
+}
+
+Substitutions::Substitutions() :
+	collected( 0 ),
+	scanned( false )
+{
+}
+
+void Substitutions::start( const char *begin, const char *end )
+{
+	TraceSpan span( "substitution" );
+	substitutions.push_back( Substitution() );
+	Substitution & substitution = substitutions.back();
+	substitution.begin = begin;
+	substitution.end = end;
+	substitution.run.shellBuiltin = NULL;
+	substitution.subshell = -1;
+	substitution.length = 0;
+
+	FileDescriptor inputPipe;
+	if( !makePipe( substitution.outputPipe, inputPipe ) )
+	{
+		cerr << "Could not open pipe." << endl;
+		return;
+	}
+
+	// The commands only have to last until they're started.
+	Arena arena;
+	vector<Command> commands;
+	if( memmem( begin, end - begin, "$(", 2 ) == NULL )
+	{
+		startText( begin, end - begin, arena, commands, substitution.run, false, inputPipe.get() );
+		return;
+	}
+
+	// Nested substitutions are run by a copy of the shell, which can also
+	// run a builtin itself since it has no state worth keeping. Anything in
+	// cout now would be written twice.
+	cout.flush();
+	pid_t pid = fork();
+	if( pid < 0 )
+	{
+		cerr << "Fork failed." << endl;
+		return;
+	}
+	if( pid == 0 )
+	{
+		traceProcessName( "substitution" );
+		dup2( inputPipe.get(), STDOUT_FILENO );
+		inputPipe.reset();
+		substitution.outputPipe.reset();
+		PipelineRun run;
+		startText( begin, end - begin, arena, commands, run, true, STDOUT_FILENO );
+		int status = waitPipeline( run );
+		cout.flush();
+		_exit( status );
+	}
+	substitution.subshell = pid;
+}
+
+void Substitutions::collect()
+{
+	// Poll all of them at once: one that isn't read fills its pipe and stops,
+	// and may be what another is waiting for.
+	vector<struct pollfd> fds;
+	vector<size_t> owners;
+	for( size_t i = collected; i < substitutions.size(); i++ )
+	{
+		if( substitutions[i].outputPipe.valid() )
+		{
+			struct pollfd fd = { substitutions[i].outputPipe.get(), POLLIN, 0 };
+			fds.push_back( fd );
+			owners.push_back( i );
+		}
+	}
+	while( !fds.empty() )
+	{
+		// One with a timeout could take forever to close its pipe, so the
+		// deadline timer is polled too, last.
+		int timerFd = deadlineTimerFd();
+		struct pollfd timer = { timerFd, POLLIN, 0 };
+		fds.push_back( timer );
+		int ready = poll( &fds[0], fds.size(), -1 );
+		timer = fds.back();
+		fds.pop_back();
+		if( ready < 0 )
+		{
+			if( errno == EINTR )
+			{
+				continue;
+			}
+			break;
+		}
+		if( timer.revents & POLLIN )
+		{
+			enforceDeadlines();
+		}
+		for( size_t i = 0; i < fds.size(); )
+		{
+			if( fds[i].revents == 0 )
+			{
+				i++;
+				continue;
+			}
+			// Read straight into the buffer, doubling it when it's full.
+			Substitution & substitution = substitutions[owners[i]];
+			if( substitution.length == substitution.text.size() )
+			{
+				substitution.text.resize( max( substitution.text.size() * 2, (size_t)4096 ) );
+			}
+			ssize_t got = read( fds[i].fd, &substitution.text[substitution.length],
+				substitution.text.size() - substitution.length );
+			if( got > 0 || ( got < 0 && errno == EINTR ) )
+			{
+				substitution.length += got > 0 ? got : 0;
+				i++;
+				continue;
+			}
+			fds.erase( fds.begin() + i );
+			owners.erase( owners.begin() + i );
+		}
+	}
+
+	for( size_t i = collected; i < substitutions.size(); i++ )
+	{
+		// Closed first, so nothing still writing can wait forever to be read.
+		Substitution & substitution = substitutions[i];
+		substitution.outputPipe.reset();
+		if( substitution.subshell > 0 )
+		{
+			int status;
+			waitForChild( substitution.subshell, status );
+		}
+		else
+		{
+			waitPipeline( substitution.run );
+			if( substitution.run.pgid > 0 )
+			{
+				clearDeadline( substitution.run.pgid );
+			}
+		}
+		while( substitution.length > 0 && substitution.text[substitution.length - 1] == '\n' )
+		{
+			substitution.length--;
+		}
+		substitution.text.resize( substitution.length );
+	}
+	collected = substitutions.size();
+}
+
+const string & Substitutions::output( const char *line, const char *lineEnd, const char *begin, const char *close )
+{
+	if( parallelSubstitutions && !scanned )
+	{
+		// Start every substitution that the lexer will come to, with the
+		// same idea of quotes and comments, before reading any of them.
+		scanned = true;
+		bool quoted = false;
+		const char *pos = line;
+		while( pos < lineEnd )
+		{
+			char c = *pos++;
+			if( c == '\\' )
+			{
+				pos = pos < lineEnd ? pos + 1 : pos;
+			}
+			else if( c == '"' )
+			{
+				quoted = !quoted;
+			}
+			else if( c == '\'' && !quoted )
+			{
+				const char *quote = (const char *)memchr( pos, '\'', lineEnd - pos );
+				pos = quote != NULL ? quote + 1 : lineEnd;
+			}
+			else if( c == '#' && !quoted && ( pos - 1 == line || strchr( " \t\r\n|<>&", pos[-2] ) != NULL ) )
+			{
+				break;
+			}
+			else if( c == '$' && pos < lineEnd && *pos == '(' )
+			{
+				const char *end = findSubstitutionEnd( pos + 1, lineEnd );
+				if( end == NULL )
+				{
+					break;
+				}
+				start( pos + 1, end );
+				pos = end + 1;
+			}
+		}
+		collect();
+	}
+
+	for( size_t i = 0; i < substitutions.size(); i++ )
+	{
+		if( substitutions[i].begin == begin )
+		{
+			return substitutions[i].text;
+		}
+	}
+	// Run on its own, if they aren't run at once or the scan missed it.
+	start( begin, close );
+	collect();
+	return substitutions.back().text;
+}
@@ -0,0 +1,64 @@
+#ifndef _SUBSTITUTION_HPP_
+#define _SUBSTITUTION_HPP_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "pipeline.hpp"
+#include "FileDescriptor.hpp"
+
+// $(pipeline) is replaced by the pipeline's output, less its trailing
+// newlines. The pipeline runs the way a line does, except that its output
+// comes back through a pipe into a buffer in the shell, never a temporary
+// file, and builtins in it are forked, so cd, exit or x=1 inside can't change
+// the shell itself.
+//
+// The substitutions on a line run one after the other, left to right, since
+// one can depend on what another did, e.g. $(sort a > b) $(wc -l < b). With
+// parallelSubstitutions set (set -o substitutions=parallel) they're all
+// started before any of their output is read instead, so independent ones
+// run at the same time: echo $(slow a) $(slow b) takes as long as the slower
+// of the two. One with more substitutions nested in it is run by a forked
+// copy of quash, so that running the nested ones doesn't hold up its
+// siblings.
+extern bool parallelSubstitutions;
+
+// Finds the ) that closes a $( whose text starts at begin, skipping over
+// quotes and nested parentheses. Returns NULL if there isn't one.
+const char *findSubstitutionEnd( const char *begin, const char *end );
+
+// The substitutions of one line, for the lexer.
+class Substitutions
+{
+public:
+	Substitutions();
+
+	// Output of the substitution whose text is [begin, close) in line, run
+	// when it's asked for. With parallelSubstitutions, the first call runs
+	// every substitution on the line, all at once.
+	const std::string & output( const char *line, const char *lineEnd, const char *begin, const char *close );
+
+private:
+	struct Substitution
+	{
+		const char		*begin;		// Its text in the line.
+		const char		*end;
+		PipelineRun		run;		// The pipeline, when the shell runs it,
+		pid_t			subshell;	// otherwise the copy of quash that does, or -1.
+		FileDescriptor	outputPipe;	// Read end of its output.
+		std::string		text;		// Its output, grown as it's read.
+		size_t			length;		// How much of text has been read.
+	};
+
+	// Starts the substitution with text [begin, end), writing into a new pipe.
+	void start( const char *begin, const char *end );
+	// Reads the output of every substitution started since the last call,
+	// whichever has some, until they've all finished.
+	void collect();
+
+	std::vector<Substitution>	substitutions;
+	size_t						collected;	// How many have finished.
+	bool						scanned;	// Whether the line's have been started, all at once.
+};
+
+#endif
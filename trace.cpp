@@ -0,0 +1,180 @@
+#include "trace.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+static int traceFd = -1;
+static string traceFile;
+// Children inherit it, so their events line up with the shell's.
+static unsigned long pipelineId = 0;
+
+// Writes one whole event. O_APPEND makes a single write() atomic with respect
+// to the other processes writing the file.
+static void writeEvent( const string & event )
+{
+	while( write( traceFd, event.data(), event.length() ) < 0 && errno == EINTR );
+}
+
+// Appends str to event as a JSON string.
+static void appendJsonString( string & event, const char *str )
+{
+	event += '"';
+	for( ; *str != '\0'; str++ )
+	{
+		unsigned char c = *str;
+		if( c == '"' || c == '\\' )
+		{
+			event += '\\';
+			event += c;
+		}
+		else if( c < 0x20 )
+		{
+			char escaped[8];
+			snprintf( escaped, sizeof( escaped ), "\\u%04x", c );
+			event += escaped;
+		}
+		else
+		{
+			event += c;
+		}
+	}
+	event += '"';
+}
+
+// The start of an event, up to the phase and its timestamp.
+static void beginEvent( string & event, const char *name, char phase, long long timestamp )
+{
+	char fields[128];
+	snprintf( fields, sizeof( fields ), ",\"cat\":\"quash\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d", phase, timestamp,
+		(int)getpid(), (int)getpid() );
+	event = "{\"name\":";
+	appendJsonString( event, name );
+	event += fields;
+}
+
+// The args every event carries, and the end of the event.
+static void endEvent( string & event, const char *detail )
+{
+	char pipeline[64];
+	snprintf( pipeline, sizeof( pipeline ), ",\"args\":{\"pipeline\":%lu", pipelineId );
+	event += pipeline;
+	if( detail != NULL )
+	{
+		event += ",\"detail\":";
+		appendJsonString( event, detail );
+	}
+	event += "}},\n";
+}
+
+void initTrace()
+{
+	const char *file = getenv( "QUASH_TRACE" );
+	if( file != NULL && file[0] != '\0' && !setTraceFile( file ) )
+	{
+		cerr << "Couldn't open QUASH_TRACE file \"" << file << "\", not tracing." << endl;
+	}
+}
+
+bool setTraceFile( const string & file )
+{
+	if( traceFd >= 0 )
+	{
+		close( traceFd );
+		traceFd = -1;
+		traceFile.clear();
+	}
+	if( file.empty() )
+	{
+		return true;
+	}
+
+	int fd = open( file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666 );
+	if( fd < 0 )
+	{
+		return false;
+	}
+	traceFd = fd;
+	traceFile = file;
+
+	// A new file gets the array opened. The array is never closed, which the
+	// trace viewers allow for.
+	struct stat info;
+	if( fstat( fd, &info ) == 0 && info.st_size == 0 )
+	{
+		writeEvent( "[\n" );
+	}
+	traceProcessName( "quash" );
+	return true;
+}
+
+const string & traceFileName()
+{
+	return traceFile;
+}
+
+int traceFileDescriptor()
+{
+	return traceFd;
+}
+
+void nextTracePipeline()
+{
+	pipelineId++;
+}
+
+long long traceTime()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void traceSpan( const char *name, long long start, const char *detail )
+{
+	if( !tracing() )
+	{
+		return;
+	}
+	long long end = traceTime();
+	string event;
+	beginEvent( event, name, 'X', start );
+	char duration[32];
+	snprintf( duration, sizeof( duration ), ",\"dur\":%lld", end - start );
+	event += duration;
+	endEvent( event, detail );
+	writeEvent( event );
+}
+
+void traceInstant( const char *name, const char *detail )
+{
+	if( !tracing() )
+	{
+		return;
+	}
+	string event;
+	beginEvent( event, name, 'i', traceTime() );
+	event += ",\"s\":\"t\"";
+	endEvent( event, detail );
+	writeEvent( event );
+}
+
+void traceProcessName( const char *name )
+{
+	if( !tracing() )
+	{
+		return;
+	}
+	string event;
+	beginEvent( event, "process_name", 'M', traceTime() );
+	event += ",\"args\":{\"name\":";
+	appendJsonString( event, name );
+	event += "}},\n";
+	writeEvent( event );
+}
@@ -0,0 +1,72 @@
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <string>
+
+// Opt-in tracing of where the time between reading a line and its pipeline
+// finishing goes. Events are written in Chrome's trace event format (a JSON
+// array, left open so it survives quash being killed), which Perfetto and
+// chrome://tracing load as is. Turned on with QUASH_TRACE=<file> or
+// "set -o trace=<file>", off with "set -o trace=".
+//
+// The file is opened O_APPEND and every event is a single write(), so the
+// shell and its forked children can all log to it at once without their
+// events getting mixed up. Each event has the pid of the process it happened
+// in and the id of the pipeline it was part of.
+
+// Opens $QUASH_TRACE if it's set. Call at Quash startup.
+void initTrace();
+// Starts tracing to file, appending if it's already there, or stops tracing
+// if file is "". Returns false if file can't be opened.
+bool setTraceFile( const std::string & file );
+// The file being traced to, "" if tracing is off.
+const std::string & traceFileName();
+// The trace file's descriptor, -1 if tracing is off. Kept open in forked
+// children so they can trace too.
+int traceFileDescriptor();
+
+// Whether tracing is on. Everything below does nothing when it isn't.
+inline bool tracing()
+{
+	return traceFileDescriptor() >= 0;
+}
+
+// Moves on to the next pipeline id. Call once per line, before parsing it.
+void nextTracePipeline();
+// Microseconds on the monotonic clock, the same in every process.
+long long traceTime();
+// Logs a span of the current process from start (a traceTime()) until now.
+// detail, if given, shows up as its "detail" argument, e.g. the command.
+void traceSpan( const char *name, long long start, const char *detail = NULL );
+// Logs something that happened just now, e.g. an exec().
+void traceInstant( const char *name, const char *detail = NULL );
+// Names the current process in the trace, for children right after fork().
+void traceProcessName( const char *name );
+
+// Logs a span for the lifetime of the object, if tracing was on when it was
+// made. detail has to outlive it.
+class TraceSpan
+{
+public:
+	explicit TraceSpan( const char *name, const char *detail = NULL ) :
+		name( name ),
+		detail( detail ),
+		start( tracing() ? traceTime() : -1 )
+	{
+	}
+
+	~TraceSpan()
+	{
+		if( start >= 0 )
+		{
+			traceSpan( name, start, detail );
+		}
+	}
+
+private:
+	const char	*name;
+	const char	*detail;
+	long long	start;
+};
+
+#endif
@@ -0,0 +1,1163 @@
+#include "utilities.hpp"
+#include "FdStream.hpp"
+#include "FileDescriptor.hpp"
+#include "Variables.hpp"
+#include "utils.hpp"
+#include "events.hpp"
+#include "ResourceUsage.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <cctype>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+using namespace std;
+
+// Flushes out and turns a failed write (e.g. EPIPE) into a failing status.
+static int finish( FdOstream & out, const char *name, int status )
+{
+	out.flush();
+	if( out.fail() )
+	{
+		cerr << name << ": write error" << endl;
+		return EXIT_FAILURE;
+	}
+	return status;
+}
+
+// Appends what the backslash escape at p (just past the backslash) stands
+// for, returning how many characters of p it used. Octal escapes are \0NNN
+// for echo and printf's %b, \NNN in a printf format. \c sets stop.
+static size_t unescape( const char *p, string & out, bool zeroOctal, bool & stop )
+{
+	switch( *p )
+	{
+	case 'a':	out += '\a';	return 1;
+	case 'b':	out += '\b';	return 1;
+	case 'e':	out += '\033';	return 1;
+	case 'f':	out += '\f';	return 1;
+	case 'n':	out += '\n';	return 1;
+	case 'r':	out += '\r';	return 1;
+	case 't':	out += '\t';	return 1;
+	case 'v':	out += '\v';	return 1;
+	case '\\':	out += '\\';	return 1;
+	case 'c':	stop = true;	return 1;
+	case 'x':
+	{
+		// Up to two hex digits.
+		size_t used = 1;
+		int value = 0;
+		while( used < 3 && isxdigit( (unsigned char)p[used] ) )
+		{
+			value = value * 16 + ( isdigit( (unsigned char)p[used] ) ? p[used] - '0' : ( tolower( p[used] ) - 'a' + 10 ) );
+			used++;
+		}
+		if( used == 1 )
+		{
+			out += "\\x";
+			return 1;
+		}
+		out += (char)value;
+		return used;
+	}
+	default:
+		break;
+	}
+
+	if( ( zeroOctal && *p == '0' ) || ( !zeroOctal && *p >= '0' && *p <= '7' ) )
+	{
+		// Up to three octal digits, after the 0 if there has to be one.
+		size_t used = zeroOctal ? 1 : 0;
+		size_t last = used + 3;
+		int value = 0;
+		while( used < last && p[used] >= '0' && p[used] <= '7' )
+		{
+			value = value * 8 + ( p[used] - '0' );
+			used++;
+		}
+		out += (char)value;
+		return used;
+	}
+
+	// Not an escape, so it stays as it was.
+	out += '\\';
+	if( *p != '\0' )
+	{
+		out += *p;
+		return 1;
+	}
+	return 0;
+}
+
+// Appends str with its backslash escapes replaced.
+static void appendUnescaped( const char *str, string & out, bool zeroOctal, bool & stop )
+{
+	while( *str != '\0' && !stop )
+	{
+		if( *str == '\\' )
+		{
+			str++;
+			str += unescape( str, out, zeroOctal, stop );
+		}
+		else
+		{
+			out += *str++;
+		}
+	}
+}
+
+int echoBuiltin( char **argv, int infd, int outfd )
+{
+	bool newline = true;
+	bool escapes = false;
+
+	// Like coreutils: an argument is only an option if it's nothing but
+	// option letters.
+	unsigned int i = 1;
+	for( ; argv[i] && argv[i][0] == '-' && argv[i][1] != '\0' && strspn( &argv[i][1], "neE" ) == strlen( &argv[i][1] ); i++ )
+	{
+		for( const char *c = &argv[i][1]; *c != '\0'; c++ )
+		{
+			if( *c == 'n' )
+			{
+				newline = false;
+			}
+			else
+			{
+				escapes = *c == 'e';
+			}
+		}
+	}
+
+	string line;
+	bool stop = false;
+	for( unsigned int first = i; argv[i] && !stop; i++ )
+	{
+		if( i > first )
+		{
+			line += ' ';
+		}
+		if( escapes )
+		{
+			appendUnescaped( argv[i], line, true, stop );
+		}
+		else
+		{
+			line += argv[i];
+		}
+	}
+	if( newline && !stop )
+	{
+		line += '\n';
+	}
+
+	FdOstream out( outfd );
+	out << line;
+	return finish( out, "echo", EXIT_SUCCESS );
+}
+
+// printf's numeric arguments can be C constants (decimal, 0 octal, 0x hex),
+// or a quote followed by a character, meaning its code. Sets bad and says so
+// if the argument isn't entirely a number.
+static long long integerArgument( const char *arg, bool & bad )
+{
+	if( arg[0] == '\'' || arg[0] == '"' )
+	{
+		return (unsigned char)arg[1];
+	}
+	char *end;
+	errno = 0;
+	long long value = strtoll( arg, &end, 0 );
+	if( *arg == '\0' || *end != '\0' || errno != 0 )
+	{
+		cerr << "printf: \"" << arg << "\": expected a numeric value" << endl;
+		bad = true;
+	}
+	return value;
+}
+
+static double floatArgument( const char *arg, bool & bad )
+{
+	if( arg[0] == '\'' || arg[0] == '"' )
+	{
+		return (unsigned char)arg[1];
+	}
+	char *end;
+	errno = 0;
+	double value = strtod( arg, &end );
+	if( *arg == '\0' || *end != '\0' || errno != 0 )
+	{
+		cerr << "printf: \"" << arg << "\": expected a numeric value" << endl;
+		bad = true;
+	}
+	return value;
+}
+
+// snprintf()s one value with the given conversion spec onto out.
+template<typename T>
+static void appendFormatted( string & out, const string & spec, T value )
+{
+	char small[64];
+	int length = snprintf( small, sizeof( small ), spec.c_str(), value );
+	if( length < 0 )
+	{
+		return;
+	}
+	if( (size_t)length < sizeof( small ) )
+	{
+		out.append( small, length );
+		return;
+	}
+	string big( length + 1, '\0' );
+	snprintf( &big[0], big.size(), spec.c_str(), value );
+	out.append( big.data(), length );
+}
+
+int printfBuiltin( char **argv, int infd, int outfd )
+{
+	if( !argv[1] )
+	{
+		cerr << "printf: missing format" << endl;
+		return EXIT_FAILURE;
+	}
+	const char *format = argv[1];
+	char **args = &argv[2];
+	bool bad = false;
+	bool stop = false;
+	string output;
+
+	// The format is gone through again for as long as there are arguments
+	// left, but at least once. Missing arguments are "" or 0.
+	do
+	{
+		char **argsBefore = args;
+		for( const char *p = format; *p != '\0' && !stop; )
+		{
+			if( *p == '\\' )
+			{
+				p++;
+				p += unescape( p, output, false, stop );
+				continue;
+			}
+			if( *p != '%' )
+			{
+				output += *p++;
+				continue;
+			}
+			if( p[1] == '%' )
+			{
+				output += '%';
+				p += 2;
+				continue;
+			}
+
+			// Build up the conversion spec for snprintf(): flags, width,
+			// precision. A * takes the number from the arguments.
+			string spec = "%";
+			p++;
+			while( *p != '\0' && strchr( "-+ #0", *p ) != NULL )
+			{
+				spec += *p++;
+			}
+			for( int part = 0; part < 2; part++ )
+			{
+				if( part == 1 )
+				{
+					if( *p != '.' )
+					{
+						break;
+					}
+					spec += *p++;
+				}
+				if( *p == '*' )
+				{
+					p++;
+					char number[32];
+					snprintf( number, sizeof( number ), "%lld", *args ? integerArgument( *args++, bad ) : 0LL );
+					spec += number;
+				}
+				else
+				{
+					while( isdigit( (unsigned char)*p ) )
+					{
+						spec += *p++;
+					}
+				}
+			}
+
+			char conversion = *p;
+			if( conversion == '\0' )
+			{
+				cerr << "printf: missing conversion character in \"" << format << "\"" << endl;
+				return EXIT_FAILURE;
+			}
+			p++;
+			const char *arg = *args ? *args++ : NULL;
+			switch( conversion )
+			{
+			case 'd':
+			case 'i':
+				appendFormatted( output, spec + "ll" + conversion, arg ? integerArgument( arg, bad ) : 0LL );
+				break;
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X':
+				appendFormatted( output, spec + "ll" + conversion, (unsigned long long)( arg ? integerArgument( arg, bad ) : 0LL ) );
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				appendFormatted( output, spec + conversion, arg ? floatArgument( arg, bad ) : 0.0 );
+				break;
+			case 'c':
+				if( arg && arg[0] != '\0' )
+				{
+					appendFormatted( output, spec + 'c', (int)(unsigned char)arg[0] );
+				}
+				break;
+			case 's':
+				appendFormatted( output, spec + 's', arg ? arg : "" );
+				break;
+			case 'b':
+			{
+				string unescaped;
+				appendUnescaped( arg ? arg : "", unescaped, true, stop );
+				appendFormatted( output, spec + 's', unescaped.c_str() );
+				break;
+			}
+			default:
+				cerr << "printf: %" << conversion << ": invalid conversion" << endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		// A format with no conversions in it only goes once.
+		if( args == argsBefore )
+		{
+			break;
+		}
+	}
+	while( *args && !stop );
+
+	FdOstream out( outfd );
+	out << output;
+	return finish( out, "printf", bad ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+// Evaluates a test expression, by recursive descent over its arguments:
+//   or      := and ( -o and )*
+//   and     := not ( -a not )*
+//   not     := ! not | primary
+//   primary := ( or ) | unary-op arg | arg binary-op arg | arg
+// As POSIX asks, a binary operator in the middle wins over everything else,
+// so e.g. test ! = ! compares two strings.
+class TestExpression
+{
+public:
+	TestExpression( char **args, int count ) :
+		args( args ),
+		count( count ),
+		pos( 0 ),
+		failed( false )
+	{
+	}
+
+	// 0, 1, or 2 if the expression is malformed.
+	int evaluate()
+	{
+		// No expression at all is false.
+		if( count == 0 )
+		{
+			return 1;
+		}
+		bool result = parseOr();
+		if( !failed && pos < count )
+		{
+			error( string( "unexpected argument \"" ) + args[pos] + "\"" );
+		}
+		return failed ? 2 : ( result ? 0 : 1 );
+	}
+
+private:
+	bool parseOr()
+	{
+		bool result = parseAnd();
+		while( !failed && pos < count && strcmp( args[pos], "-o" ) == 0 )
+		{
+			pos++;
+			// Both sides get parsed either way, only the value short-circuits.
+			bool right = parseAnd();
+			result = result || right;
+		}
+		return result;
+	}
+
+	bool parseAnd()
+	{
+		bool result = parseNot();
+		while( !failed && pos < count && strcmp( args[pos], "-a" ) == 0 )
+		{
+			pos++;
+			bool right = parseNot();
+			result = result && right;
+		}
+		return result;
+	}
+
+	bool parseNot()
+	{
+		if( pos < count && strcmp( args[pos], "!" ) == 0 && !binaryNext() )
+		{
+			pos++;
+			return !parseNot();
+		}
+		return parsePrimary();
+	}
+
+	bool parsePrimary()
+	{
+		if( pos >= count )
+		{
+			error( "argument expected" );
+			return false;
+		}
+		if( binaryNext() )
+		{
+			const char *left = args[pos];
+			const char *op = args[pos + 1];
+			const char *right = args[pos + 2];
+			pos += 3;
+			return binary( left, op, right );
+		}
+		if( strcmp( args[pos], "(" ) == 0 && pos + 1 < count )
+		{
+			pos++;
+			bool result = parseOr();
+			if( pos >= count || strcmp( args[pos], ")" ) != 0 )
+			{
+				error( "missing \")\"" );
+				return false;
+			}
+			pos++;
+			return result;
+		}
+		if( isUnary( args[pos] ) && pos + 1 < count )
+		{
+			const char *op = args[pos];
+			const char *operand = args[pos + 1];
+			pos += 2;
+			return unary( op[1], operand );
+		}
+		// Just a string: true unless it's empty.
+		return args[pos++][0] != '\0';
+	}
+
+	bool binaryNext() const
+	{
+		return pos + 2 < count && isBinary( args[pos + 1] );
+	}
+
+	static bool isUnary( const char *op )
+	{
+		return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr( "bcdefghknprstuwxzLOGS", op[1] ) != NULL;
+	}
+
+	static bool isBinary( const char *op )
+	{
+		static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", "-a", "-o", NULL };
+		for( unsigned int i = 0; ops[i] != NULL; i++ )
+		{
+			if( strcmp( op, ops[i] ) == 0 )
+			{
+				// -a and -o only join expressions, they aren't comparisons.
+				return op[1] != 'a' && op[1] != 'o';
+			}
+		}
+		return false;
+	}
+
+	bool unary( char op, const char *operand )
+	{
+		if( op == 'z' )
+		{
+			return operand[0] == '\0';
+		}
+		if( op == 'n' )
+		{
+			return operand[0] != '\0';
+		}
+		if( op == 't' )
+		{
+			return isatty( integer( operand ) ) == 1;
+		}
+		if( op == 'r' || op == 'w' || op == 'x' )
+		{
+			return access( operand, op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK ) == 0;
+		}
+
+		struct stat info;
+		bool link = op == 'h' || op == 'L';
+		if( ( link ? lstat( operand, &info ) : stat( operand, &info ) ) != 0 )
+		{
+			return false;
+		}
+		switch( op )
+		{
+		case 'e':	return true;
+		case 'f':	return S_ISREG( info.st_mode );
+		case 'd':	return S_ISDIR( info.st_mode );
+		case 'b':	return S_ISBLK( info.st_mode );
+		case 'c':	return S_ISCHR( info.st_mode );
+		case 'p':	return S_ISFIFO( info.st_mode );
+		case 'S':	return S_ISSOCK( info.st_mode );
+		case 'h':
+		case 'L':	return S_ISLNK( info.st_mode );
+		case 's':	return info.st_size > 0;
+		case 'g':	return ( info.st_mode & S_ISGID ) != 0;
+		case 'u':	return ( info.st_mode & S_ISUID ) != 0;
+		case 'k':	return ( info.st_mode & S_ISVTX ) != 0;
+		case 'O':	return info.st_uid == geteuid();
+		case 'G':	return info.st_gid == getegid();
+		}
+		return false;
+	}
+
+	bool binary( const char *left, const char *op, const char *right )
+	{
+		if( strcmp( op, "=" ) == 0 || strcmp( op, "==" ) == 0 )
+		{
+			return strcmp( left, right ) == 0;
+		}
+		if( strcmp( op, "!=" ) == 0 )
+		{
+			return strcmp( left, right ) != 0;
+		}
+		if( strcmp( op, "<" ) == 0 )
+		{
+			return strcmp( left, right ) < 0;
+		}
+		if( strcmp( op, ">" ) == 0 )
+		{
+			return strcmp( left, right ) > 0;
+		}
+
+		if( strcmp( op, "-nt" ) == 0 || strcmp( op, "-ot" ) == 0 || strcmp( op, "-ef" ) == 0 )
+		{
+			struct stat a, b;
+			bool haveA = stat( left, &a ) == 0;
+			bool haveB = stat( right, &b ) == 0;
+			if( op[1] == 'e' )
+			{
+				return haveA && haveB && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+			}
+			// A file that exists is newer than one that doesn't.
+			if( !haveA || !haveB )
+			{
+				return op[1] == 'n' ? haveA : haveB;
+			}
+			bool newer = a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec > b.st_mtim.tv_sec
+				: a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+			bool older = a.st_mtim.tv_sec != b.st_mtim.tv_sec ? a.st_mtim.tv_sec < b.st_mtim.tv_sec
+				: a.st_mtim.tv_nsec < b.st_mtim.tv_nsec;
+			return op[1] == 'n' ? newer : older;
+		}
+
+		long long a = integer( left );
+		long long b = integer( right );
+		if( strcmp( op, "-eq" ) == 0 )	return a == b;
+		if( strcmp( op, "-ne" ) == 0 )	return a != b;
+		if( strcmp( op, "-lt" ) == 0 )	return a < b;
+		if( strcmp( op, "-le" ) == 0 )	return a <= b;
+		if( strcmp( op, "-gt" ) == 0 )	return a > b;
+		return a >= b;
+	}
+
+	long long integer( const char *str )
+	{
+		// Surrounding blanks are allowed, nothing else.
+		char *end;
+		errno = 0;
+		long long value = strtoll( str, &end, 10 );
+		while( *end == ' ' || *end == '\t' )
+		{
+			end++;
+		}
+		if( *str == '\0' || *end != '\0' || errno != 0 )
+		{
+			error( string( "integer expression expected: \"" ) + str + "\"" );
+		}
+		return value;
+	}
+
+	void error( const string & message )
+	{
+		if( !failed )
+		{
+			cerr << "test: " << message << endl;
+			failed = true;
+		}
+	}
+
+	char	**args;
+	int		count;
+	int		pos;
+	bool	failed;
+};
+
+int testBuiltin( char **argv, int infd, int outfd )
+{
+	int count = 0;
+	while( argv[count + 1] )
+	{
+		count++;
+	}
+	return TestExpression( &argv[1], count ).evaluate();
+}
+
+int bracketBuiltin( char **argv, int infd, int outfd )
+{
+	int count = 0;
+	while( argv[count + 1] )
+	{
+		count++;
+	}
+	if( count == 0 || strcmp( argv[count], "]" ) != 0 )
+	{
+		cerr << "[: missing \"]\"" << endl;
+		return 2;
+	}
+	return TestExpression( &argv[1], count - 1 ).evaluate();
+}
+
+int trueBuiltin( char **argv, int infd, int outfd )
+{
+	return EXIT_SUCCESS;
+}
+
+int falseBuiltin( char **argv, int infd, int outfd )
+{
+	return EXIT_FAILURE;
+}
+
+int pwdBuiltin( char **argv, int infd, int outfd )
+{
+	bool physical = false;
+	for( unsigned int i = 1; argv[i]; i++ )
+	{
+		if( strcmp( argv[i], "-P" ) == 0 )
+		{
+			physical = true;
+		}
+		else if( strcmp( argv[i], "-L" ) == 0 )
+		{
+			physical = false;
+		}
+		else
+		{
+			cerr << "pwd: invalid option \"" << argv[i] << "\"" << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	char *cwd = get_current_dir_name();
+	if( cwd == NULL )
+	{
+		cerr << "pwd: " << strerror( errno ) << endl;
+		return EXIT_FAILURE;
+	}
+	string dir = cwd;
+	free( cwd );
+
+	// The logical path keeps symlinks, if $PWD is still where we are.
+	const char *pwd = shellVariables.get( "PWD" );
+	struct stat here, there;
+	if( !physical && pwd != NULL && pwd[0] == '/' && stat( ".", &here ) == 0 && stat( pwd, &there ) == 0
+		&& here.st_dev == there.st_dev && here.st_ino == there.st_ino )
+	{
+		dir = pwd;
+	}
+
+	FdOstream out( outfd );
+	out << dir << '\n';
+	return finish( out, "pwd", EXIT_SUCCESS );
+}
+
+int sleepBuiltin( char **argv, int infd, int outfd )
+{
+	if( !argv[1] )
+	{
+		cerr << "sleep: missing operand" << endl;
+		return EXIT_FAILURE;
+	}
+
+	double seconds = 0;
+	for( unsigned int i = 1; argv[i]; i++ )
+	{
+		double interval;
+		if( !parseDuration( argv[i], interval ) )
+		{
+			cerr << "sleep: invalid time interval \"" << argv[i] << "\"" << endl;
+			return EXIT_FAILURE;
+		}
+		seconds += interval;
+	}
+
+	// Sleeping inside the shell mustn't hold up background jobs' deadlines,
+	// or their reaping, so it waits in the event loop rather than nanosleep().
+	// In an interactive shell Ctrl-C ends it, as it would a sleep of its own,
+	// but not one pressed before it started.
+	takeInterrupt();
+	double until = monotonicTime() + seconds;
+	double left;
+	while( ( left = until - monotonicTime() ) > 0 )
+	{
+		if( waitForInput( interruptFd(), left ) && takeInterrupt() )
+		{
+			return 128 + SIGINT;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// One of tee's outputs. Files other than the last (standard output) get a
+// pipe of their own for tee(2) to copy the input into.
+struct TeeOutput
+{
+	string	name;
+	int		fd;			// -1 once writing to it has failed.
+	bool	owned;		// Whether tee opened fd, and so closes it.
+	bool	canSplice;	// Cleared when splice() won't write to it (O_APPEND, a terminal, ...).
+	int		copy[2];	// Pipe holding its copy of the input, { -1, -1 } if none.
+};
+
+// write() all of data to fd. Returns false on an error.
+static bool writeAll( int fd, const char *data, size_t length )
+{
+	while( length > 0 )
+	{
+		ssize_t written = write( fd, data, length );
+		if( written < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( written <= 0 )
+		{
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+// Gives up on an output after a write to it failed.
+static void dropOutput( TeeOutput & output, int & status )
+{
+	cerr << "tee: " << output.name << ": " << strerror( errno ) << endl;
+	if( output.owned )
+	{
+		close( output.fd );
+	}
+	output.fd = -1;
+	status = EXIT_FAILURE;
+}
+
+// Moves up to max bytes from the pipe from to output, with splice() if it
+// can, otherwise through buffer. Bytes for a dropped output are read and
+// thrown away. Returns how many were moved, 0 at the end of the input.
+static ssize_t transfer( int from, TeeOutput & output, size_t max, vector<char> & buffer, int & status )
+{
+	while( true )
+	{
+		if( output.fd >= 0 && output.canSplice )
+		{
+			ssize_t moved = splice( from, NULL, output.fd, NULL, max, SPLICE_F_MOVE );
+			if( moved >= 0 )
+			{
+				return moved;
+			}
+			if( errno == EINVAL )
+			{
+				output.canSplice = false;
+			}
+			else if( errno != EINTR )
+			{
+				dropOutput( output, status );
+			}
+			continue;
+		}
+
+		ssize_t got = read( from, buffer.data(), min( max, buffer.size() ) );
+		if( got < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( got > 0 && output.fd >= 0 && !writeAll( output.fd, buffer.data(), got ) )
+		{
+			dropOutput( output, status );
+		}
+		return got;
+	}
+}
+
+// Moves exactly length bytes from the pipe from to output.
+static void transferAll( int from, TeeOutput & output, size_t length, vector<char> & buffer, int & status )
+{
+	while( length > 0 )
+	{
+		ssize_t moved = transfer( from, output, length, buffer, status );
+		if( moved <= 0 )
+		{
+			return;
+		}
+		length -= moved;
+	}
+}
+
+// Copies a pipe to every output without the data passing through user
+// space: tee(2) duplicates what's in the input pipe into each file's own pipe
+// without using it up, splice(2) moves those to the files and, last, the
+// input itself to standard output. Returns false, having used none of the
+// input, if the input can't be teed from after all.
+static bool teeFromPipe( int infd, vector<TeeOutput> & outputs, vector<char> & buffer, int & status )
+{
+	TeeOutput & last = outputs.back();
+	int capacity = fcntl( infd, F_GETPIPE_SZ );
+	if( capacity <= 0 )
+	{
+		return false;
+	}
+	if( buffer.size() < (size_t)capacity )
+	{
+		buffer.resize( capacity );
+	}
+	// Each copy pipe holds all the input pipe can, so one tee() call fits
+	// everything there is to copy.
+	for( unsigned int i = 0; i + 1 < outputs.size(); i++ )
+	{
+		if( pipe2( outputs[i].copy, O_CLOEXEC ) < 0 )
+		{
+			return false;
+		}
+		fcntl( outputs[i].copy[1], F_SETPIPE_SZ, capacity );
+	}
+
+	vector<ssize_t> copied( outputs.size() );
+	bool started = false;
+	while( true )
+	{
+		// Copy whatever's in the input pipe into each file's pipe: the first
+		// tee() waits for it, the rest copy the same bytes.
+		ssize_t length = -1;
+		bool shortCopy = false;
+		for( unsigned int i = 0; i + 1 < outputs.size(); i++ )
+		{
+			copied[i] = 0;
+			if( outputs[i].fd < 0 )
+			{
+				continue;
+			}
+			ssize_t teed;
+			do
+			{
+				teed = tee( infd, outputs[i].copy[1], length < 0 ? capacity : length, 0 );
+			} while( teed < 0 && errno == EINTR );
+			if( teed < 0 )
+			{
+				if( !started )
+				{
+					return false;
+				}
+				teed = 0;
+			}
+			if( length < 0 )
+			{
+				length = teed;
+			}
+			copied[i] = teed;
+			shortCopy = shortCopy || teed < length;
+		}
+		started = true;
+
+		// No files left, so the input just goes to standard output.
+		if( length < 0 )
+		{
+			if( last.fd < 0 || transfer( infd, last, capacity, buffer, status ) <= 0 )
+			{
+				return true;
+			}
+			continue;
+		}
+		if( length == 0 )
+		{
+			return true;
+		}
+
+		for( unsigned int i = 0; i + 1 < outputs.size(); i++ )
+		{
+			if( outputs[i].copy[0] >= 0 )
+			{
+				transferAll( outputs[i].copy[0], outputs[i], copied[i], buffer, status );
+			}
+		}
+		if( !shortCopy )
+		{
+			transferAll( infd, last, length, buffer, status );
+			continue;
+		}
+
+		// A copy pipe took less than the rest (it shouldn't, they're all as
+		// big as the input), so finish this lot the ordinary way.
+		size_t got = 0;
+		while( got < (size_t)length )
+		{
+			ssize_t n = read( infd, buffer.data() + got, length - got );
+			if( n < 0 && errno == EINTR )
+			{
+				continue;
+			}
+			if( n <= 0 )
+			{
+				break;
+			}
+			got += n;
+		}
+		for( unsigned int i = 0; i < outputs.size(); i++ )
+		{
+			size_t done = i + 1 < outputs.size() ? copied[i] : 0;
+			if( outputs[i].fd >= 0 && got > done && !writeAll( outputs[i].fd, buffer.data() + done, got - done ) )
+			{
+				dropOutput( outputs[i], status );
+			}
+		}
+	}
+}
+
+int teeBuiltin( char **argv, int infd, int outfd )
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	unsigned int i = 1;
+	for( ; argv[i] && argv[i][0] == '-' && argv[i][1] != '\0'; i++ )
+	{
+		if( strcmp( argv[i], "--" ) == 0 )
+		{
+			i++;
+			break;
+		}
+		if( strcmp( argv[i], "-a" ) != 0 )
+		{
+			cerr << "tee: invalid option \"" << argv[i] << "\"" << endl;
+			return EXIT_FAILURE;
+		}
+		flags = ( flags & ~O_TRUNC ) | O_APPEND;
+	}
+
+	int status = EXIT_SUCCESS;
+	vector<TeeOutput> outputs;
+	for( ; argv[i]; i++ )
+	{
+		TeeOutput output = { argv[i], open( argv[i], flags, 0666 ), true, true, { -1, -1 } };
+		if( output.fd < 0 )
+		{
+			cerr << "tee: " << argv[i] << ": " << strerror( errno ) << endl;
+			status = EXIT_FAILURE;
+			continue;
+		}
+		outputs.push_back( output );
+	}
+	TeeOutput standardOutput = { "standard output", outfd, false, true, { -1, -1 } };
+	outputs.push_back( standardOutput );
+
+	vector<char> buffer( 65536 );
+	struct stat info;
+	bool done = fstat( infd, &info ) == 0 && S_ISFIFO( info.st_mode ) && teeFromPipe( infd, outputs, buffer, status );
+	while( !done )
+	{
+		ssize_t got = read( infd, buffer.data(), buffer.size() );
+		if( got < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( got < 0 )
+		{
+			cerr << "tee: read error: " << strerror( errno ) << endl;
+			status = EXIT_FAILURE;
+		}
+		if( got <= 0 )
+		{
+			break;
+		}
+		bool anyLeft = false;
+		for( unsigned int o = 0; o < outputs.size(); o++ )
+		{
+			if( outputs[o].fd >= 0 && !writeAll( outputs[o].fd, buffer.data(), got ) )
+			{
+				dropOutput( outputs[o], status );
+			}
+			anyLeft = anyLeft || outputs[o].fd >= 0;
+		}
+		done = !anyLeft;
+	}
+
+	for( unsigned int o = 0; o < outputs.size(); o++ )
+	{
+		if( outputs[o].owned && outputs[o].fd >= 0 )
+		{
+			close( outputs[o].fd );
+		}
+		for( int end = 0; end < 2; end++ )
+		{
+			if( outputs[o].copy[end] >= 0 )
+			{
+				close( outputs[o].copy[end] );
+			}
+		}
+	}
+	return status;
+}
+
+bool isPlainCopy( const Command & command )
+{
+	if( strcmp( command.argv[0], "cat" ) != 0 || command.outputFilename[0] == '\0' || command.truncatedOutputs != NULL )
+	{
+		return false;
+	}
+	// Files only, no options and no - for STDIN.
+	for( unsigned int i = 1; command.argv[i]; i++ )
+	{
+		if( command.argv[i][0] == '\0' || command.argv[i][0] == '-' )
+		{
+			return false;
+		}
+	}
+	return command.argv[1] != NULL || command.inputFilename[0] != '\0';
+}
+
+// Copies all of infd to outfd, in the kernel if it can: copy_file_range()
+// between regular files (which can share blocks on a filesystem that
+// supports it), sendfile() from a regular file to anything, read() and
+// write() otherwise. Says what went wrong and returns false on an error.
+static bool copyAll( int infd, int outfd, const char *name, const struct stat & input, const struct stat & output )
+{
+	const size_t CHUNK = 1 << 30;
+	bool copyRange = S_ISREG( input.st_mode ) && S_ISREG( output.st_mode );
+	bool sendFile = S_ISREG( input.st_mode );
+	while( copyRange )
+	{
+		ssize_t copied = copy_file_range( infd, NULL, outfd, NULL, CHUNK, 0 );
+		if( copied == 0 )
+		{
+			return true;
+		}
+		if( copied < 0 && errno != EINTR )
+		{
+			if( errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP )
+			{
+				cerr << "cat: " << name << ": " << strerror( errno ) << endl;
+				return false;
+			}
+			copyRange = false;
+		}
+	}
+	while( sendFile )
+	{
+		ssize_t sent = sendfile( outfd, infd, NULL, CHUNK );
+		if( sent == 0 )
+		{
+			return true;
+		}
+		if( sent < 0 && errno != EINTR )
+		{
+			if( errno != EINVAL && errno != ENOSYS )
+			{
+				cerr << "cat: " << name << ": " << strerror( errno ) << endl;
+				return false;
+			}
+			sendFile = false;
+		}
+	}
+
+	static char buffer[65536];
+	while( true )
+	{
+		ssize_t got = read( infd, buffer, sizeof( buffer ) );
+		if( got < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( got < 0 )
+		{
+			cerr << "cat: " << name << ": " << strerror( errno ) << endl;
+			return false;
+		}
+		if( got == 0 )
+		{
+			return true;
+		}
+		if( !writeAll( outfd, buffer, got ) )
+		{
+			cerr << "cat: write error: " << strerror( errno ) << endl;
+			return false;
+		}
+	}
+}
+
+int copyBuiltin( char **argv, int infd, int outfd )
+{
+	struct stat output;
+	if( fstat( outfd, &output ) < 0 )
+	{
+		cerr << "cat: write error: " << strerror( errno ) << endl;
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for( unsigned int i = 1; i == 1 || argv[i]; i++ )
+	{
+		const char *name = argv[i] ? argv[i] : "standard input";
+		FileDescriptor file;
+		int fd = infd;
+		if( argv[i] )
+		{
+			file.reset( open( argv[i], O_RDONLY | O_CLOEXEC ) );
+			fd = file.get();
+		}
+		struct stat input;
+		if( fd < 0 || fstat( fd, &input ) < 0 )
+		{
+			cerr << "cat: " << name << ": " << strerror( errno ) << endl;
+			status = EXIT_FAILURE;
+		}
+		// Copying a file onto itself would never finish, or lose it.
+		else if( S_ISREG( output.st_mode ) && input.st_dev == output.st_dev && input.st_ino == output.st_ino )
+		{
+			cerr << "cat: " << name << ": input file is output file" << endl;
+			status = EXIT_FAILURE;
+		}
+		else if( !copyAll( fd, outfd, name, input, output ) )
+		{
+			status = EXIT_FAILURE;
+		}
+		if( !argv[i] )
+		{
+			break;
+		}
+	}
+	return status;
+}
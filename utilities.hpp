@@ -0,0 +1,41 @@
+#ifndef _UTILITIES_HPP_
+#define _UTILITIES_HPP_
+
+#include "Command.hpp"
+
+// Standard utilities that scripts run so often that fork() and exec() cost far
+// more than the work itself. They're registered as builtins (see
+// builtins.cpp), so the first one in a foreground pipeline runs inside the
+// shell, and they behave like their POSIX (and, where POSIX leaves it open,
+// GNU coreutils) namesakes did when quash ran those instead.
+
+// echo [-neE] [string...]: -n drops the newline, -e turns on backslash
+// escapes, -E turns them off again.
+int echoBuiltin( char **argv, int infd, int outfd );
+// printf format [argument...]: the format is reused until every argument has
+// been used.
+int printfBuiltin( char **argv, int infd, int outfd );
+// test expression, and [ expression ]: 0 if true, 1 if false, 2 on an error.
+int testBuiltin( char **argv, int infd, int outfd );
+int bracketBuiltin( char **argv, int infd, int outfd );
+int trueBuiltin( char **argv, int infd, int outfd );
+int falseBuiltin( char **argv, int infd, int outfd );
+// pwd [-L|-P]
+int pwdBuiltin( char **argv, int infd, int outfd );
+// sleep number[smhd]...: the total of all the intervals, fractions allowed.
+int sleepBuiltin( char **argv, int infd, int outfd );
+// tee [-a] [file...]: copies the input to each file and the output, with
+// tee(2) and splice(2) when the input is a pipe. -a appends to the files.
+// It's how to send a command's output to more than one file: cmd > a > b
+// only truncates a, as in sh.
+int teeBuiltin( char **argv, int infd, int outfd );
+
+// cat isn't a builtin, but a line that only uses it to copy files to a file,
+// e.g. cat a b > out or cat < in > out, is run inside the shell with
+// copyBuiltin() instead, the data never leaving the kernel. Anything more,
+// like an option, - for STDIN or a pipe, gets the real cat.
+bool isPlainCopy( const Command & command );
+// cat [file...] with no options.
+int copyBuiltin( char **argv, int infd, int outfd );
+
+#endif
@@ -1,5 +1,15 @@
 #include "utils.hpp"
 #include "Command.hpp"
+#include "PathCache.hpp"
+#include "launch.hpp"
+#include "lexer.hpp"
+#include "FdStream.hpp"
+#include "trace.hpp"
+#include "pipeline.hpp"
+#include "events.hpp"
+#include "FileDescriptor.hpp"
+#include "Variables.hpp"
+#include "substitution.hpp"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
@@ -7,13 +17,17 @@
 #include <cstring>
 #include <cstdio>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstdlib>
+#include <climits>
+#include <cctype>
+#include <strings.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <errno.h>
 using namespace std;
 
-vector<Job> backgroundJobs;
+Arena lineArena;
 
 // Helper for access() system call. Returns -1 if file not found, 1 if not an
 // executable, and 0 if the file was found and is an executable.
@@ -33,46 +47,9 @@ int executableExists( const std::string & filename )
 	return 0;
 }
 
-// SIGCHLD signal handler to reap zombie processes.
-void sigchldHandler( int signal )
-{
-	pid_t pid;
-	while( ( pid = waitpid( -1, NULL, WNOHANG ) ) > 0 )
-	{
-		// Remove background job that just finished from the list.
-		// Note that backgroundJobs is an extern global.
-		for( unsigned int i = 0; i < backgroundJobs.size(); i++ )
-		{
-			if( backgroundJobs[i].pid == pid )
-			{
-				Job job = backgroundJobs[i];
-				cout << endl << "[" << job.jobId << "] " << job.pid << " finished " << job.command << endl;
-				backgroundJobs.erase( backgroundJobs.begin() + i );
-				break;
-			}
-		}
-	}
-}
-
-// Set up the above SIGCHLD handler so it will go into action.
-// This should be called at Quash startup.
-void initZombieReaping()
-{
-	struct sigaction sa;
-
-	sa.sa_handler = sigchldHandler;
-	sigemptyset( &sa.sa_mask );
-	sa.sa_flags = SA_RESTART;
-
-	if( sigaction( SIGCHLD, &sa, NULL ) == -1 )
-	{
-		cerr << "Failure in sigaction() call." << endl;
-		exit( 1 );
-	}
-}
-
-// Run execve() on the given command, searching through $PATH if needed. 
-int execute( char **argv )
+// Run execve() on the given command. For commands found through PATH, the
+// parent has already looked up path in the PATH cache before forking.
+int execute( char **argv, const std::string & path, char **envp )
 {
 	// If it's an absolute path, just give that to exec().
 	if( argv[0][0] == '/' )
@@ -82,7 +59,8 @@ int execute( char **argv )
 		{
 			return EXIT_FAILURE;
 		}
-		if( execve( argv[0], argv, environ ) < 0 )
+		traceInstant( "exec", argv[0] );
+		if( execve( argv[0], argv, envp ) < 0 )
 		{
 			cerr << "Error executing \"" << argv[0] << "\", errno = " << errno << "." << endl;
 			return EXIT_FAILURE;
@@ -97,63 +75,67 @@ int execute( char **argv )
 		{
 			return EXIT_FAILURE;
 		}
-		if( execve( &argv[0][2], argv, environ ) < 0 )
+		traceInstant( "exec", &argv[0][2] );
+		if( execve( &argv[0][2], argv, envp ) < 0 )
 		{
 			cerr << "Error executing \"" << &argv[0][2] << "\", errno = " << errno << "." << endl;
 			return EXIT_FAILURE;
 		}
 	}
-	// Try to find the executable in one of the paths given by the PATH
-	// environment variable.
-	else
+	// The executable was found in one of the directories in PATH.
+	else if( path.length() > 0 )
 	{
-		vector<string> PATH = split( getenv( "PATH" ), ':' );
-		for( unsigned int i = 0; i < PATH.size(); i++ )
+		// If it's found, but not an executable, we can't run it!
+		if( access( path.c_str(), X_OK ) != 0 )
 		{
-			// Next place to look.
-			string cmd = PATH[i] + "/" + argv[0];
-			// See if the file exists, if not, try the next PATH directory.
-			if( access( cmd.c_str(), F_OK ) != 0 )
-			{
-				continue;
-			}
-			// If it's found, but not an executable, we can't run it!
-			if( access( cmd.c_str(), X_OK ) != 0 )
-			{
-				cerr << "File found at \"" << cmd << "\" using PATH is not an executable." << endl;
-				return EXIT_FAILURE;
-			}
-			// If it's found and it's an executable, throw it exec()'s way.
-			if( execve( cmd.c_str(), argv, environ ) < 0 )
-			{
-				cerr << "Error executing \"" << cmd << "\", errno = " << errno << "." << endl;
-				return EXIT_FAILURE;
-			}
+			cerr << "File found at \"" << path << "\" using PATH is not an executable." << endl;
+			return EXIT_FAILURE;
+		}
+		// If it's found and it's an executable, throw it exec()'s way.
+		traceInstant( "exec", path.c_str() );
+		if( execve( path.c_str(), argv, envp ) < 0 )
+		{
+			cerr << "Error executing \"" << path << "\", errno = " << errno << "." << endl;
+			return EXIT_FAILURE;
 		}
 	}
 
 	// If all else above failed, say so.
+	traceInstant( "PATH search failed", argv[0] );
 	cerr << "Executable named \"" << argv[0] << "\" does not exist in any of the directories in PATH." << endl;
 	return EXIT_FAILURE;
 }
 
+// Looks up where the command will be exec()'d from, using the PATH cache for
+// anything that isn't an absolute or "./" path. Called in the parent so the
+// lookup is remembered across commands.
+string resolveExecutable( char **argv )
+{
+	if( argv[0] == NULL || argv[0][0] == '/' || strncmp( argv[0], "./", 2 ) == 0 )
+	{
+		return "";
+	}
+	TraceSpan span( "path lookup", argv[0] );
+	return pathCache.lookup( argv[0] );
+}
+
 // Redirects STDIN to read from the given filename, if it exists.
 // Only redirects if filename is a non-empty string.
-int redirectStdIn( const string & filename )
+int redirectStdIn( const char *filename )
 {
-	if( filename.length() > 0 )
+	if( filename[0] != '\0' )
 	{
 		// Open and error check.
-		FILE *ifile = fopen( filename.c_str(), "r" );
-		if( ifile == NULL )
+		int fd = open( filename, O_RDONLY | O_CLOEXEC );
+		if( fd < 0 )
 		{
 			cerr << "Couldn't open \"" << filename << "\"." << endl;
 			return -1;
 		}
 
-		// Rename STDIN.
-		dup2( fileno( ifile ), STDIN_FILENO );
-		fclose( ifile );
+		// Rename STDIN. The dup2()'d copy doesn't inherit O_CLOEXEC.
+		dup2( fd, STDIN_FILENO );
+		close( fd );
 	}
 
 	return 0;
@@ -161,26 +143,41 @@ int redirectStdIn( const string & filename )
 
 // Redirect STDOUT to write to given filename. File will be created if it
 // doesn't exist. Only redirects if filename is a non-empty string.
-int redirectStdOut( const string & filename )
-{	
-	if( filename.length() > 0 )
+int redirectStdOut( const char *filename )
+{
+	if( filename[0] != '\0' )
 	{
 		// Open and error check.
-		FILE *ofile = fopen( filename.c_str(), "w" );
-		if( ofile == NULL )
+		int fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+		if( fd < 0 )
 		{
 			cerr << "Couldn't open \"" << filename << "\"." << endl;
 			return -1;
 		}
 
 		// Rename STDOUT.
-		dup2( fileno( ofile ), STDOUT_FILENO );
-		fclose( ofile );
+		dup2( fd, STDOUT_FILENO );
+		close( fd );
 	}
 
 	return 0;
 }
 
+int truncateOutputs( const char **filenames )
+{
+	for( ; filenames != NULL && *filenames != NULL; filenames++ )
+	{
+		int fd = open( *filenames, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+		if( fd < 0 )
+		{
+			cerr << "Couldn't open \"" << *filenames << "\"." << endl;
+			return -1;
+		}
+		close( fd );
+	}
+	return 0;
+}
+
 // Creates an argument list that can be passed to execve()
 char **createArgv( const string & commandAndArgs )
 {
@@ -202,94 +199,18 @@ char **createArgv( const string & commandAndArgs )
 }
 
 // Gets a command from the given input stream and turns it into an argv array.
-vector<Command> getInput( std::istream & is )
+void getInput( std::istream & is, vector<Command> & result )
 {
-	vector<Command> result;
-	vector<Command> emptyVector;	// For error returns;
-
-	// Get a line from the input stream.
-	string rawInput;
+	// Get a line from the input stream. The string is kept between calls so
+	// its buffer gets reused instead of allocated for every line.
+	static string rawInput;
 	getline( is, rawInput );
 
-	// If the input was empty, nothing to do.
-	if( rawInput.length() == 0 )
-	{
-		return emptyVector;
-	}
-
-	// If a '&' character is found in the command, remember that we want to run
-	// this in the background, and remove the '&' from the string.
-	bool runInBackground = false;
-	if( rawInput.find( "&" ) != string::npos )
-	{
-		runInBackground = true;
-		rawInput.erase( rawInput.find( "&" ), 1 );
-	}
-
-	// Put spaces around file redirect so tokenizer doesn't get confused.
-	// "|" and "&" are not an issue as the code is.
-	rawInput = replaceAll( rawInput, "<", " < " );
-	rawInput = replaceAll( rawInput, ">", " > " );
-
-	// Split into separate commands for handling multiple pipes.
-	vector<string> subCommands = split( rawInput, '|' );
-	for( unsigned int i = 0; i < subCommands.size(); i++ )
-	{
-		Command cmd;
-		cmd.rawString = trim( subCommands[i] );
-
-		// Now, for each string in the chain of piped commands, tokenize using
-		// space as the delimiter, and parse the tokens into a Command struct.
-		vector<string> tokens = split( subCommands[i], ' ' );
-		// String to pass to createArgv(), doesn't have redirects because exec()
-		// doesn't understand those.
-		string argvString;
-		for( unsigned int j = 0; j < tokens.size(); j++ )
-		{
-			// Handle input redirection filename.
-			if( tokens[j] == "<" )
-			{
-				if( j + 1 < tokens.size() )
-				{
-					cmd.inputFilename = tokens[++j];
-				}
-				else
-				{
-					cerr << "Error parsing input command: \"<\" must be followed by an input filename." << endl;
-					return emptyVector;
-				}
-			}
-			// Handle output redirection filename.
-			else if( tokens[j] == ">" )
-			{
-				if( j + 1 < tokens.size() )
-				{
-					cmd.outputFilename = tokens[++j];
-				}
-				else
-				{
-					cerr << "Error parsing input command: \">\" must be followed by an output filename." << endl;
-					return emptyVector;
-				}
-			}
-			// If it's not an I/O redirect, tack it on to what we'll turn into
-			// an argv array for exec().
-			else
-			{
-				argvString += ( " " + tokens[j] );
-			}
-		}
-
-		// Create the argv array, and mark the command to execute in the
-		// background or not based on whether '&' was found at the beginning of
-		// this function.
-		cmd.argv = createArgv( trim( argvString ) );
-		cmd.executeInBackground = runInBackground;
-
-		result.push_back( cmd );
-	}
-
-	return result;
+	// The lexer fills in the commands straight from the line, with everything
+	// they point to in lineArena. On a parse error it says why and leaves the
+	// list empty.
+	TraceSpan span( "parse" );
+	parseLine( rawInput.data(), rawInput.length(), lineArena, result );
 }
 
 // Split str into tokens based on delimiter, like split in Perl or Python
@@ -343,7 +264,99 @@ std::string replaceAll( const string & str, const string & before, const string
 	return result;
 }
 
-void cd( char **argv )
+bool parseByteSize( const string & str, long & bytes )
+{
+	if( str.empty() || !isdigit( (unsigned char)str[0] ) )
+	{
+		return false;
+	}
+	errno = 0;
+	char *end;
+	long value = strtol( str.c_str(), &end, 10 );
+	int shift = 0;
+	switch( *end )
+	{
+	case 'k':
+	case 'K':	shift = 10;	end++;	break;
+	case 'm':
+	case 'M':	shift = 20;	end++;	break;
+	case 'g':
+	case 'G':	shift = 30;	end++;	break;
+	}
+	if( *end != '\0' || errno != 0 || value > ( LONG_MAX >> shift ) )
+	{
+		return false;
+	}
+	bytes = value << shift;
+	return true;
+}
+
+bool parseDuration( const string & str, double & seconds )
+{
+	if( str.empty() || !( isdigit( (unsigned char)str[0] ) || str[0] == '.' ) )
+	{
+		return false;
+	}
+	char *end;
+	double value = strtod( str.c_str(), &end );
+	double unit = 1;
+	if( strcmp( end, "ms" ) == 0 )
+	{
+		unit = 0.001;
+		end += 2;
+	}
+	else if( *end != '\0' && end[1] == '\0' )
+	{
+		switch( *end )
+		{
+		case 's':	unit = 1;		end++;	break;
+		case 'm':	unit = 60;		end++;	break;
+		case 'h':	unit = 3600;	end++;	break;
+		case 'd':	unit = 86400;	end++;	break;
+		}
+	}
+	if( *end != '\0' || !( value >= 0 ) )
+	{
+		return false;
+	}
+	seconds = value * unit;
+	return true;
+}
+
+bool parseCpuList( const string & str, cpu_set_t & cpus )
+{
+	CPU_ZERO( &cpus );
+	const char *p = str.c_str();
+	while( true )
+	{
+		if( !isdigit( (unsigned char)*p ) )
+		{
+			return false;
+		}
+		char *end;
+		unsigned long first = strtoul( p, &end, 10 );
+		unsigned long last = first;
+		if( *end == '-' && isdigit( (unsigned char)end[1] ) )
+		{
+			last = strtoul( end + 1, &end, 10 );
+		}
+		if( last < first || last >= CPU_SETSIZE || ( *end != ',' && *end != '\0' ) )
+		{
+			return false;
+		}
+		for( unsigned long cpu = first; cpu <= last; cpu++ )
+		{
+			CPU_SET( cpu, &cpus );
+		}
+		if( *end == '\0' )
+		{
+			return true;
+		}
+		p = end + 1;
+	}
+}
+
+int cd( char **argv, int infd, int outfd )
 {
 	// If there's a directory given to change to
 	if( argv[1] )
@@ -354,6 +367,7 @@ void cd( char **argv )
 			if( chdir( argv[1] ) != 0 )
 			{
 				cerr << "Couldn't change directory to \"" << argv[1] << "\", ERROR #" << errno << "." << endl;
+				return EXIT_FAILURE;
 			}
 		}
 		// Otherwise, look for the given directory in the current working
@@ -364,133 +378,699 @@ void cd( char **argv )
 			if( chdir( ( pwd + "/" + argv[1] ).c_str() ) != 0 )
 			{
 				cerr << "Couldn't change directory to \"" << pwd + "/" + argv[1] << "\", ERROR #" << errno << "." << endl;
+				return EXIT_FAILURE;
 			}
 		}
 	}
 	// Otherwise, it's just the string 'cd', so change to HOME
 	else
 	{
-		if( chdir( getenv( "HOME" ) ) != 0 )
+		const char *home = shellVariables.get( "HOME" );
+		if( home == NULL || chdir( home ) != 0 )
 		{
-			cerr << "Couldn't change directory to \"" << getenv( "HOME" ) << "\", ERROR #" << errno << "." << endl;
+			cerr << "Couldn't change directory to \"" << ( home ? home : "" ) << "\", ERROR #" << errno << "." << endl;
+			return EXIT_FAILURE;
 		}
 	}
+
+	return EXIT_SUCCESS;
+}
+
+// Sets the variable in a NAME=value argument, and exports it if asked, in
+// which case the argument can be just a NAME. Returns false (after saying
+// why) if the name isn't valid.
+static bool assign( const char *builtin, const char *assignment, bool exportIt )
+{
+	const char *equals = strchr( assignment, '=' );
+	string name = equals ? string( assignment, equals - assignment ) : assignment;
+	bool valid = equals ? shellVariables.set( name, equals + 1 ) : Variables::validName( name.data(), name.length() );
+	if( valid && exportIt )
+	{
+		valid = shellVariables.exportVariable( name );
+	}
+	if( !valid )
+	{
+		cerr << builtin << ": \"" << assignment << "\" isn't a valid variable name." << endl;
+		return false;
+	}
+	return true;
 }
 
-void set( char **argv )
+int set( char **argv, int infd, int outfd )
 {
-	// If no environment variable specified, tell user what quash
-	// expects and do nothing.
+	// On its own, list the variables.
 	if( !argv[1] )
 	{
-		cerr << "Need to specifiy PATH=... or HOME=..." << endl;
-		return;
+		FdOstream out( outfd );
+		shellVariables.print( out, false );
+		return EXIT_SUCCESS;
 	}
 
-	// Set HOME with system call.
-	if( strncmp( argv[1], "HOME=", 5 ) == 0 )
+	// Shell options, e.g. "set -o launch=spawn". Just "set -o" lists them.
+	if( strcmp( argv[1], "-o" ) == 0 )
 	{
-		if( setenv( "HOME", &argv[1][5], 1 ) == -1 )
+		if( !argv[2] )
 		{
-			cerr << "Error setting HOME, ERROR #" << errno << "." << endl;
+			FdOstream out( outfd );
+			printOptions( out );
+		}
+		for( unsigned int i = 2; argv[i]; i++ )
+		{
+			if( !setOption( argv[i] ) )
+			{
+				return EXIT_FAILURE;
+			}
 		}
 	}
-	// Set PATH with system call.
-	else if( strncmp( argv[1], "PATH=", 5 ) == 0 )
+	// Otherwise they're all NAME=value. PATH and HOME are already exported,
+	// so changing them changes them for children too. The PATH cache notices
+	// PATH changing by itself.
+	else
 	{
-		if( setenv( "PATH", &argv[1][5], 1 ) == -1 )
+		for( unsigned int i = 1; argv[i]; i++ )
 		{
-			cerr << "Error setting PATH, ERROR #" << errno << "." << endl;
+			if( strchr( argv[i], '=' ) == NULL )
+			{
+				cerr << "set: expected NAME=value, not \"" << argv[i] << "\"." << endl;
+				return EXIT_FAILURE;
+			}
+			if( !assign( "set", argv[i], false ) )
+			{
+				return EXIT_FAILURE;
+			}
 		}
 	}
+
+	return EXIT_SUCCESS;
 }
 
-void jobs()
+int exportBuiltin( char **argv, int infd, int outfd )
 {
-	// Output a table heading above the list to make it look nice.
-	if( backgroundJobs.size() > 0 )
+	if( !argv[1] )
 	{
-		cout << "[JOBID]\tPID\tCOMMAND" << endl;
+		FdOstream out( outfd );
+		shellVariables.print( out, true );
+		return EXIT_SUCCESS;
 	}
-	// Output the jobs.
-	for( unsigned int i = 0; i < backgroundJobs.size(); i++ )
+	int status = EXIT_SUCCESS;
+	for( unsigned int i = 1; argv[i]; i++ )
 	{
-		cout << "[" << backgroundJobs[i].jobId << "]\t" << backgroundJobs[i].pid << "\t" << backgroundJobs[i].command << endl;
+		if( !assign( "export", argv[i], true ) )
+		{
+			status = EXIT_FAILURE;
+		}
 	}
+	return status;
 }
 
-void kill( char **argv )
+int unset( char **argv, int infd, int outfd )
 {
+	for( unsigned int i = 1; argv[i]; i++ )
+	{
+		shellVariables.unset( argv[i] );
+	}
+	return EXIT_SUCCESS;
+}
+
+// Sets a shell option given as "name=value". Returns false (after saying why)
+// if the option or its value isn't recognized.
+bool setOption( const string & assignment )
+{
+	string::size_type equals = assignment.find( '=' );
+	string name = assignment.substr( 0, equals );
+	string value = equals == string::npos ? "" : assignment.substr( equals + 1 );
+
+	if( name == "trace" )
+	{
+		if( !setTraceFile( value ) )
+		{
+			cerr << "Couldn't open trace file \"" << value << "\"." << endl;
+			return false;
+		}
+		return true;
+	}
+	if( name == "fdcheck" )
+	{
+		if( value != "on" && value != "off" )
+		{
+			cerr << "fdcheck must be on or off." << endl;
+			return false;
+		}
+		setFdCheck( value == "on" );
+		return true;
+	}
+	if( name == "pipesize" )
+	{
+		long bytes;
+		if( !parseByteSize( value, bytes ) || bytes > INT_MAX )
+		{
+			cerr << "pipesize must be a number of bytes, e.g. 1M, or 0 for the default." << endl;
+			return false;
+		}
+		pipeSize = bytes;
+		return true;
+	}
+	if( name == "deadline" )
+	{
+		if( !parseDuration( value, backgroundDeadline ) )
+		{
+			cerr << "deadline must be a time, e.g. 10m, or 0 for none." << endl;
+			return false;
+		}
+		return true;
+	}
+	if( name == "substitutions" )
+	{
+		if( value != "serial" && value != "parallel" )
+		{
+			cerr << "substitutions must be serial or parallel." << endl;
+			return false;
+		}
+		parallelSubstitutions = value == "parallel";
+		return true;
+	}
+	if( name == "launch" )
+	{
+		if( !parseLaunchBackend( value, launchBackend ) )
+		{
+			cerr << "launch must be fork or spawn." << endl;
+			return false;
+		}
+		return true;
+	}
+
+	cerr << "Unknown option \"" << name << "\". Type set -o for the list of options." << endl;
+	return false;
+}
+
+// Lists the shell options and their current values.
+void printOptions( ostream & os )
+{
+	os << "launch=" << launchBackendName( launchBackend ) << endl;
+	os << "trace=" << traceFileName() << endl;
+	os << "pipesize=" << pipeSize << endl;
+	os << "deadline=" << backgroundDeadline << endl;
+	os << "fdcheck=" << ( fdCheck ? "on" : "off" ) << endl;
+	os << "substitutions=" << ( parallelSubstitutions ? "parallel" : "serial" ) << endl;
+}
+
+int jobs( char **argv, int infd, int outfd )
+{
+	FdOstream out( outfd );
+	backgroundJobs.print( out, argv[1] && strcmp( argv[1], "-l" ) == 0 );
+	return EXIT_SUCCESS;
+}
+
+// The signals kill knows by name.
+static const struct
+{
+	const char	*name;
+	int			number;
+} signalNames[] =
+{
+	{ "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+	{ "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE }, { "ALRM", SIGALRM },
+	{ "TERM", SIGTERM }, { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+};
+
+// A signal by number or name, with or without the SIG. -1 if it's neither.
+static int parseSignal( const char *str )
+{
+	if( isdigit( (unsigned char)str[0] ) )
+	{
+		char *end;
+		long number = strtol( str, &end, 10 );
+		return *end == '\0' && number < NSIG ? number : -1;
+	}
+	if( strncasecmp( str, "SIG", 3 ) == 0 )
+	{
+		str += 3;
+	}
+	for( unsigned int i = 0; i < sizeof( signalNames ) / sizeof( signalNames[0] ); i++ )
+	{
+		if( strcasecmp( str, signalNames[i].name ) == 0 )
+		{
+			return signalNames[i].number;
+		}
+	}
+	return -1;
+}
+
+// A pid or job id: nothing but digits, and not too big. Unlike atoi(), which
+// would make kill junk signal process group 0, the shell's own.
+static bool parseId( const char *str, long & id )
+{
+	if( !isdigit( (unsigned char)str[0] ) )
+	{
+		return false;
+	}
+	errno = 0;
+	char *end;
+	id = strtol( str, &end, 10 );
+	return *end == '\0' && errno == 0 && id <= INT_MAX;
+}
+
+int kill( char **argv, int infd, int outfd )
+{
+	// Send SIGINT by default to be nice, letting the process clean up before
+	// terminating.
+	int signal = SIGINT;
+	unsigned int i = 1;
+	if( argv[i] && argv[i][0] == '-' && argv[i][1] != '\0' )
+	{
+		const char *name = argv[i] + 1;
+		if( strcmp( argv[i], "-s" ) == 0 )
+		{
+			name = argv[++i];
+		}
+		signal = name != NULL ? parseSignal( name ) : -1;
+		if( signal < 0 )
+		{
+			cerr << "Unknown signal " << ( name != NULL ? name : "" ) << "." << endl;
+			return EXIT_FAILURE;
+		}
+		i++;
+	}
+
 	// If no PID specified, tell user what quash expects and do nothing.
+	if( !argv[i] )
+	{
+		cerr << "Must specify process ID or %job of process to kill." << endl;
+		return EXIT_FAILURE;
+	}
+
+	// A %job means every process in it, which share its process group.
+	int result = EXIT_SUCCESS;
+	for( ; argv[i]; i++ )
+	{
+		int sent;
+		long id;
+		if( argv[i][0] == '%' )
+		{
+			const Job *job = parseId( &argv[i][1], id ) ? backgroundJobs.find( id ) : NULL;
+			if( job == NULL )
+			{
+				cerr << "No such job " << argv[i] << "." << endl;
+				result = EXIT_FAILURE;
+				continue;
+			}
+			sent = killpg( job->pid, signal );
+		}
+		else
+		{
+			if( !parseId( argv[i], id ) || id <= 0 )
+			{
+				cerr << "Not a process ID: " << argv[i] << "." << endl;
+				result = EXIT_FAILURE;
+				continue;
+			}
+			sent = kill( id, signal );
+		}
+		if( sent != 0 )
+		{
+			cerr << "Couldn't kill process " << argv[i] << ", ERROR #" << errno << "." << endl;
+			result = EXIT_FAILURE;
+		}
+	}
+
+	return result;
+}
+
+// Lists the PATH cache with "hash", forgets it with "hash -r", and looks up and
+// remembers the given names otherwise.
+int hash( char **argv, int infd, int outfd )
+{
 	if( !argv[1] )
 	{
-		cerr << "Must specify process ID of process to kill." << endl;
-		return;
+		FdOstream out( outfd );
+		pathCache.print( out );
+		return EXIT_SUCCESS;
 	}
 
-	// Send SIGINT to be nice, letting the process clean up before terminating.
-	if( kill( atoi( argv[1] ), SIGINT ) != 0 )
+	int status = EXIT_SUCCESS;
+	for( unsigned int i = 1; argv[i]; i++ )
 	{
-		cerr << "Couldn't kill process " << argv[1] << ", ERROR #" << errno << "." << endl;
+		if( strcmp( argv[i], "-r" ) == 0 )
+		{
+			pathCache.clear();
+		}
+		else if( pathCache.lookup( argv[i] ).length() == 0 )
+		{
+			cerr << "hash: \"" << argv[i] << "\" not found in PATH." << endl;
+			status = EXIT_FAILURE;
+		}
 	}
+
+	return status;
 }
 
-// Pretty self-explanatory.
-void help()
-{
-	cout << "################################################" << endl;
-	cout << "#                  Quash 1.0                   #" << endl;
-	cout << "#                Quite A Shell!                #" << endl;
-	cout << "#            (KU EECS 678 Project 1)           #" << endl;
-	cout << "#                                              #" << endl;
-	cout << "#                   Authors:                   #" << endl;
-	cout << "#                Keeler Russell                #" << endl;
-	cout << "#                Jeff Cailteux                 #" << endl;
-	cout << "################################################" << endl << endl;
-
-	cout << "USAGE" << endl;
-	cout << "-----" << endl;
-	cout << "Interactive Mode: simply run the executable with no arguments." << endl;
-	cout << "Script Mode: run the executable, and pipe your script to it with" << endl;
-	cout << "             stdin. E.g. quash < scriptname.sh." << endl << endl;
-
-	cout << "SHELL BUILTINS" << endl;
-	cout << "--------------" << endl;
-	cout << "1) cd <directory>" << endl;
-	cout << "    - If no argument given, changes to $HOME." << endl;
-	cout << "2) exit" << endl;
-	cout << "3) quit" << endl;
-	cout << "4) jobs" << endl;
-	cout << "    - Prints list of jobs currently running in the background." << endl;
-	cout << "5) kill <process id>" << endl;
-	cout << "    - Sends SIGKILL signal to process with the given process ID." << endl;
-	cout << "6) set <evironment variable>" << endl;
-	cout << "    - Only two environment variables recognized: HOME and PATH." << endl;
-	cout << "    - E.g. set HOME=/home/johndoe" << endl;
-	cout << "    - E.g. set PATH=/bin:/usr/bin" << endl;
-	cout << "    - Directories for PATH must be separated by colons." << endl;
-}
-
-// Returns true if any one of the commands in the command list is a shell
-// builtin like "cd" or "set", false if none of the commands in the list
-// are shell builtins.
-bool containsShellBuiltin( const std::vector<Command> & commandList )
-{
-	for( unsigned int i = 0; i < commandList.size(); i++ )
-	{
-		Command cmd = commandList[i];
-		if( strcmp( cmd.argv[0], "exit" ) == 0 ||
-			strcmp( cmd.argv[0], "quit" ) == 0 ||
-			strcmp( cmd.argv[0], "cd" ) == 0 ||
-			strcmp( cmd.argv[0], "jobs" ) == 0 ||
-			strcmp( cmd.argv[0], "kill" ) == 0 ||
-			strcmp( cmd.argv[0], "set" ) == 0 ||
-			strcmp( cmd.argv[0], "help" ) == 0 )
+// Leaves quash, with the given exit status if there is one.
+int exitBuiltin( char **argv, int infd, int outfd )
+{
+	cout.flush();
+	exit( argv[1] ? atoi( argv[1] ) : EXIT_SUCCESS );
+}
+
+// Waits for background jobs. With no arguments waits for all of them and
+// returns 0, with job ids waits for those and returns the last one's status,
+// and with -n returns the status of the next job to finish.
+int wait( char **argv, int infd, int outfd )
+{
+	unsigned int jobId;
+	int status;
+
+	if( argv[1] && strcmp( argv[1], "-n" ) == 0 )
+	{
+		for( ;; )
 		{
+			if( backgroundJobs.takeAnyCompletion( jobId, status ) )
+			{
+				return exitStatus( status );
+			}
+			if( backgroundJobs.size() == 0 )
+			{
+				cerr << "wait: no background jobs to wait for." << endl;
+				return 127;
+			}
+			waitForChildEvent();
+		}
+	}
+
+	if( !argv[1] )
+	{
+		while( backgroundJobs.size() > 0 )
+		{
+			waitForChildEvent();
+		}
+		backgroundJobs.clearCompletions();
+		return EXIT_SUCCESS;
+	}
+
+	int result = EXIT_SUCCESS;
+	for( unsigned int i = 1; argv[i]; i++ )
+	{
+		// Job ids may be written as %N too.
+		jobId = atoi( argv[i][0] == '%' ? &argv[i][1] : argv[i] );
+		while( backgroundJobs.find( jobId ) != NULL )
+		{
+			waitForChildEvent();
+		}
+		if( backgroundJobs.takeCompletion( jobId, status ) )
+		{
+			result = exitStatus( status );
+		}
+		else
+		{
+			cerr << "wait: no job with id " << argv[i] << "." << endl;
+			result = 127;
+		}
+	}
+	return result;
+}
+
+// Reads the next line from fd into line, without the newline. pending holds
+// what has been read past the end of the line between calls. Returns false at
+// the end of the input.
+static bool readLine( int fd, string & pending, string & line )
+{
+	for( ;; )
+	{
+		string::size_type newline = pending.find( '\n' );
+		if( newline != string::npos )
+		{
+			line.assign( pending, 0, newline );
+			pending.erase( 0, newline + 1 );
 			return true;
 		}
+
+		char buffer[65536];
+		ssize_t bytes = read( fd, buffer, sizeof( buffer ) );
+		if( bytes < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( bytes <= 0 )
+		{
+			// Last line without a newline at the end.
+			line.swap( pending );
+			pending.clear();
+			return line.length() > 0;
+		}
+		pending.append( buffer, bytes );
 	}
+}
 
-	return false;
+// Checks which of the given jobs have finished, removing them from the list.
+// Returns how many of them failed.
+static unsigned int collectFinishedJobs( vector<unsigned int> & running )
+{
+	unsigned int failed = 0;
+	for( unsigned int i = 0; i < running.size(); )
+	{
+		if( backgroundJobs.find( running[i] ) != NULL )
+		{
+			i++;
+			continue;
+		}
+		int status;
+		if( backgroundJobs.takeCompletion( running[i], status ) && exitStatus( status ) != 0 )
+		{
+			failed++;
+		}
+		running[i] = running.back();
+		running.pop_back();
+	}
+	return failed;
 }
 
+// Runs the command template once for every line of input, as background jobs,
+// keeping exactly N of them running at a time until the input runs out. Each
+// {} in the template is replaced by the line; without one, the line is added
+// as the last argument. Returns the number of jobs that failed (at most 101,
+// like GNU parallel).
+int parallel( char **argv, int infd, int outfd )
+{
+	long jobLimit = sysconf( _SC_NPROCESSORS_ONLN );
+	unsigned int first = 1;
+	if( argv[first] && strcmp( argv[first], "-j" ) == 0 && argv[first + 1] )
+	{
+		jobLimit = atol( argv[first + 1] );
+		first += 2;
+	}
+	else if( argv[first] && strncmp( argv[first], "-j", 2 ) == 0 )
+	{
+		jobLimit = atol( &argv[first][2] );
+		first++;
+	}
+	if( jobLimit < 1 || !argv[first] )
+	{
+		cerr << "Usage: parallel [-j N] command [args...] (with {} where each input line goes)" << endl;
+		return EXIT_FAILURE;
+	}
+
+	vector<unsigned int> running;
+	unsigned int failed = 0;
+	string pending, arg, line;
+	// Each job's commands only live until it has been started.
+	Arena jobArena;
+	vector<Command> commandList;
+
+	while( readLine( infd, pending, arg ) )
+	{
+		if( arg.length() == 0 )
+		{
+			continue;
+		}
+
+		// Every word goes back in single quoted, so the argument and the
+		// template's own words come out of parseLine() exactly as they are.
+		string escaped = replaceAll( arg, "'", "'\\''" );
+		line.clear();
+		bool substituted = false;
+		for( unsigned int i = first; argv[i]; i++ )
+		{
+			string word = replaceAll( argv[i], "'", "'\\''" );
+			substituted = substituted || word.find( "{}" ) != string::npos;
+			line += "'" + replaceAll( word, "{}", escaped ) + "' ";
+		}
+		if( !substituted )
+		{
+			line += "'" + escaped + "'";
+		}
+
+		// Make room before starting another one.
+		while( running.size() >= (unsigned long)jobLimit )
+		{
+			waitForChildEvent();
+			failed += collectFinishedJobs( running );
+		}
+
+		if( !parseLine( line.data(), line.length(), jobArena, commandList ) || commandList.empty() )
+		{
+			failed++;
+		}
+		else
+		{
+			const Job *job = startBackgroundJob( commandList, true, outfd );
+			if( job != NULL )
+			{
+				running.push_back( job->jobId );
+			}
+			else
+			{
+				failed++;
+			}
+		}
+		commandList.clear();
+		jobArena.release();
+	}
+
+	// Then wait for the stragglers.
+	failed += collectFinishedJobs( running );
+	while( running.size() > 0 )
+	{
+		waitForChildEvent();
+		failed += collectFinishedJobs( running );
+	}
+
+	return failed > 101 ? 101 : failed;
+}
+
+// Pretty self-explanatory.
+int help( char **argv, int infd, int outfd )
+{
+	FdOstream out( outfd );
+
+	out << "################################################" << endl;
+	out << "#                  Quash 1.0                   #" << endl;
+	out << "#                Quite A Shell!                #" << endl;
+	out << "#            (KU EECS 678 Project 1)           #" << endl;
+	out << "#                                              #" << endl;
+	out << "#                   Authors:                   #" << endl;
+	out << "#                Keeler Russell                #" << endl;
+	out << "#                Jeff Cailteux                 #" << endl;
+	out << "################################################" << endl << endl;
+
+	out << "USAGE" << endl;
+	out << "-----" << endl;
+	out << "Interactive Mode: simply run the executable with no arguments." << endl;
+	out << "Script Mode: run the executable with your script as its argument," << endl;
+	out << "             e.g. quash scriptname.sh, or pipe the script to it with" << endl;
+	out << "             stdin, e.g. quash < scriptname.sh." << endl;
+	out << "Command Mode: quash -c \"commands\" runs the commands and exits." << endl;
+	out << "Daemon Mode: quash -d [socket] serves commands on a Unix socket" << endl;
+	out << "             ($QUASHD_SOCKET by default) until it's stopped. Send" << endl;
+	out << "             them with quashc [-s socket] [-c commands], which prints" << endl;
+	out << "             each line's output and exits with the last one's status." << endl << endl;
+
+	out << "SHELL BUILTINS" << endl;
+	out << "--------------" << endl;
+	out << "1) cd <directory>" << endl;
+	out << "    - If no argument given, changes to $HOME." << endl;
+	out << "2) exit [status]" << endl;
+	out << "3) quit [status]" << endl;
+	out << "4) jobs [-l]" << endl;
+	out << "    - Prints list of jobs currently running in the background." << endl;
+	out << "    - -l adds how long each has run and the CPU time, peak memory and" << endl;
+	out << "      context switches of its stages that have finished." << endl;
+	out << "5) kill [-SIGNAL | -s SIGNAL] <process id | %job id>..." << endl;
+	out << "    - Sends SIGINT, or the given signal (e.g. -TERM, -9), to each" << endl;
+	out << "      process, or to every process of a background job." << endl;
+	out << "6) set [NAME=value...]" << endl;
+	out << "    - Sets shell variables, or lists them all. NAME=value on its own" << endl;
+	out << "      does the same. Variables from the environment, like HOME and" << endl;
+	out << "      PATH, stay exported, so children see the change." << endl;
+	out << "    - E.g. set PATH=/bin:/usr/bin (directories separated by colons)" << endl;
+	out << "    - $NAME or ${NAME} in a command is replaced by the variable's" << endl;
+	out << "      value, except inside single quotes. $? is the last exit status." << endl;
+	out << "    - $(pipeline) is replaced by the pipeline's output, without its" << endl;
+	out << "      trailing newlines, e.g. echo \"$(date)\". Those on one line run" << endl;
+	out << "      in order, and can't change the shell (cd, exit, x=1)." << endl;
+	out << "    - export [NAME[=value]...] passes variables on to commands, or" << endl;
+	out << "      lists the exported ones. unset NAME... removes them." << endl;
+	out << "    - set -o lists shell options, set -o <option>=<value> changes one:" << endl;
+	out << "      launch=fork|spawn   How child processes are started." << endl;
+	out << "      trace=<file>        Log Chrome trace events of each line's parse," << endl;
+	out << "                          fork, exec, redirects and waits to the file" << endl;
+	out << "                          (open it in Perfetto). trace= stops." << endl;
+	out << "      pipesize=<bytes>    Capacity of the pipes between commands, e.g." << endl;
+	out << "                          1M (0 for the kernel's default). Starting a" << endl;
+	out << "                          line with pipesize <bytes> does it for one." << endl;
+	out << "      deadline=<time>     How long background jobs may run, e.g. 10m" << endl;
+	out << "                          (0 for no limit). See timeout below." << endl;
+	out << "      fdcheck=on|off      Report fds leaked into commands, or left" << endl;
+	out << "                          open by the shell after a line. Also turned" << endl;
+	out << "                          on by QUASH_FDCHECK=1." << endl;
+	out << "      substitutions=serial|parallel" << endl;
+	out << "                          Run a line's $(...) one after another, or" << endl;
+	out << "                          all at once, for ones that don't depend on" << endl;
+	out << "                          each other." << endl;
+	out << "7) hash [-r] [command...]" << endl;
+	out << "    - Lists where commands were found in PATH, with hit/miss counts." << endl;
+	out << "    - -r forgets every remembered location." << endl;
+	out << "8) wait [-n] [job id...]" << endl;
+	out << "    - Waits for all background jobs, the given ones, or (-n) the next" << endl;
+	out << "      one to finish, and returns the exit status of the last waited for." << endl;
+	out << "9) parallel [-j N] <command> [args...]" << endl;
+	out << "    - Runs the command once per line of input, N at a time (default: one" << endl;
+	out << "      per CPU). {} in the arguments is replaced by the line, otherwise" << endl;
+	out << "      it's added at the end. E.g. ls *.log | parallel -j 4 gzip -9 {}" << endl;
+	out << "10) time <pipeline>" << endl;
+	out << "    - Runs the pipeline, then reports the wall, user and system time," << endl;
+	out << "      peak memory and context switches of each stage on stderr." << endl;
+	out << "11) echo, printf, test and [, true, false, pwd, sleep" << endl;
+	out << "    - The standard utilities, built in so they don't need a fork() and" << endl;
+	out << "      exec(). Use the full path, e.g. /bin/echo, to run the real one." << endl;
+	out << "    - A line that only copies files with cat, e.g. cat a b > out or" << endl;
+	out << "      cat < in > out, is done inside the shell too, in the kernel." << endl;
+	out << "12) tee [-a] [file...]" << endl;
+	out << "    - Copies its input to each file and its output, with the kernel's" << endl;
+	out << "      tee() and splice() when reading a pipe, e.g. cmd | tee a > b" << endl;
+	out << "      writes cmd's output to both a and b." << endl;
+	out << "13) pin <cpus>, nice [-n N], cgroup <group> [file=value...] before a" << endl;
+	out << "    command" << endl;
+	out << "    - Run that stage on the given CPUs (e.g. 0-3,8), at a lower priority" << endl;
+	out << "      (default 10), or in a cgroup v2 group, relative to the cgroup" << endl;
+	out << "      mount unless it starts with / and made if it doesn't exist." << endl;
+	out << "      E.g. pin 2-3 sort big | pin 4 gzip > big.gz" << endl;
+	out << "    - The group's cpu.*, memory.*, pids.*, io.* and cpuset.* files can" << endl;
+	out << "      be set after it, e.g." << endl;
+	out << "      cgroup batch cpu.max=\"50000 100000\" memory.max=1G. The command" << endl;
+	out << "      doesn't run if they can't be set. Only for a group quash makes" << endl;
+	out << "      does it enable their controllers, in the parent group." << endl;
+	out << "    - Before the first stage they apply to every stage without its" << endl;
+	out << "      own, so cgroup batch memory.max=1G make -j8 & caps the whole job." << endl;
+	out << "14) timeout <time> <pipeline>" << endl;
+	out << "    - Runs the pipeline for at most the time (e.g. 30s, 500ms, 2m)," << endl;
+	out << "      then sends its process group SIGTERM, and SIGKILL " << KILL_GRACE << "s later if" << endl;
+	out << "      it's still going. Its status is then 124. Works on background" << endl;
+	out << "      jobs too. Use the full path, /usr/bin/timeout, for coreutils'." << endl;
+	out << "    - When what follows one of these doesn't fit, e.g. nice -5 make or" << endl;
+	out << "      timeout -s KILL 5 cmd, the word is run as a command instead." << endl << endl;
+
+	out << "Builtins can be piped and redirected like any other command, e.g." << endl;
+	out << "help | grep cd or jobs > jobs.txt." << endl << endl;
+
+	out << "WILDCARDS" << endl;
+	out << "---------" << endl;
+	out << "An unquoted *, ? or [...] makes a word a pattern, which is replaced" << endl;
+	out << "by the paths it matches, sorted, or kept as it is if there are none." << endl;
+	out << "* matches any characters, ? any one, [a-z] or [!a-z] one in or out" << endl;
+	out << "of the set, which can use classes, e.g. [[:digit:]], but none of them" << endl;
+	out << "a / or a leading dot. ** between slashes matches any number of" << endl;
+	out << "directories, e.g. src/**/*.cpp, leaving out hidden ones. A redirect" << endl;
+	out << "can use a pattern that matches one file." << endl << endl;
+
+	out << "LINE EDITING" << endl;
+	out << "------------" << endl;
+	out << "At a terminal, lines can be edited the way readline does by default:" << endl;
+	out << "arrows, Home/End, Ctrl-A/E/B/F, Ctrl-K/U/W to delete, Ctrl-L to clear." << endl;
+	out << "Up and Down (Ctrl-P/N) go through the history, which is kept in" << endl;
+	out << "$HISTFILE (~/.quash_history by default) and shared by every quash" << endl;
+	out << "using it. Ctrl-R searches it as you type: Ctrl-R again for an older" << endl;
+	out << "match, Enter to run it, Ctrl-G or Escape to give up. Tab completes" << endl;
+	out << "command names (builtins and everything in PATH) and file names, and" << endl;
+	out << "lists the choices when pressed twice." << endl;
+
+	return EXIT_SUCCESS;
+}
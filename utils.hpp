@@ -5,18 +5,13 @@
 #include <vector>
 #include <string>
 #include "Command.hpp"
+#include "Arena.hpp"
+#include "JobTable.hpp"
+#include "events.hpp"
 
-// A job that will go in the list of background jobs.
-struct Job
-{
-	std::string		command;	// E.g. du /home/username | grep eecs | sort --numeric --reverse | head
-	unsigned int	jobId;		// Unique, assigned by quash.
-	pid_t			pid;		// Pid of first child process forked when running the job.
-};
-
-// Make the list of running background jobs an extern global so it can be used
-// in multiple source files.
-extern std::vector<Job> backgroundJobs;
+// Where the argv arrays and strings of the line being run come from. Released
+// in one step once the line's commands have been launched.
+extern Arena lineArena;
 
 ///////////////////////////////
 // Wrappers for system calls //
@@ -24,19 +19,22 @@ extern std::vector<Job> backgroundJobs;
 
 // Helper for multiple sequential access() system calls.
 int executableExists( const std::string & filename );
-// SIGCHLD signal handler to reap zombie processes.
-void sigchldHandler( int signal );
-// Set up the above SIGCHLD handler so it will go into action.
-void initZombieReaping();
-// Run execve() for the given command, searching through $PATH if needed.
-int execute( char **argv );
+// Run execve() for the given command. path is where resolveExecutable() found
+// it in $PATH, or empty for absolute and "./" commands.
+int execute( char **argv, const std::string & path, char **envp );
+// Look up a command through the PATH cache, in the parent, before forking.
+std::string resolveExecutable( char **argv );
 // Redirects STDIN to read from given filename, if it exists.
 // Only redirects for non-empty string.
-int redirectStdIn( const std::string & filename );
+int redirectStdIn( const char *filename );
 // Redirects STDOUT to output to given filename. File will be
 // created if it does not exist. Only redirects for non-empty
 // string.
-int redirectStdOut( const std::string & filename );
+int redirectStdOut( const char *filename );
+// Creates or truncates each of the NULL-terminated filenames, the way sh does
+// for all but the last > of a command. Does nothing if filenames is NULL.
+// Returns -1 (after saying why) if one can't be opened.
+int truncateOutputs( const char **filenames );
 
 ///////////////////////////
 // Argument manipulation //
@@ -44,13 +42,9 @@ int redirectStdOut( const std::string & filename );
 
 // Creates an argument list that can be passed to execve()
 char **createArgv( const std::string & commandAndArgs );
-// Gets a command from the given input stream and turns
-// it into an argv array.
-std::vector<Command> getInput( std::istream & is );
-// Runs the command if there is at least one shell builtin function (e.g. "cd"
-// or "set", type help for all) among the series of piped commands. Returns
-// true if it ran, false if it didn't.
-bool runIfShellBuiltin( const std::vector<Command> & commandList );
+// Gets a command from the given input stream and turns it into a list of
+// Commands in result, allocated from lineArena.
+void getInput( std::istream & is, std::vector<Command> & result );
 
 ////////////////////////////
 // Text-munging utilities //
@@ -62,18 +56,37 @@ std::vector<std::string> split( const std::string & str, char delimiter );
 std::string trim( const std::string & str, const std::string & whitespace = " \t\n" );
 // Replace all occurrences of before with after in the string str.
 std::string replaceAll( const std::string & str, const std::string & before, const std::string & after  );
+// Parse a number of bytes with an optional K, M or G suffix (powers of 1024),
+// e.g. 64K. Returns false if str isn't one.
+bool parseByteSize( const std::string & str, long & bytes );
+// Parse a length of time in seconds, with an optional ms, s, m, h or d
+// suffix, e.g. 1.5s or 10m. Returns false if str isn't one.
+bool parseDuration( const std::string & str, double & seconds );
+// Parse a list of CPUs the way taskset -c and cpuset files write them, e.g.
+// 0-3,8. Returns false if str isn't one.
+bool parseCpuList( const std::string & str, cpu_set_t & cpus );
 
 ////////////////////
 // Shell builtins //
 ////////////////////
 
-void cd( char **argv );
-void set( char **argv );
-void jobs();
-void kill( char **argv );
-void help();
+// Each one reads infd and writes outfd in place of STDIN and STDOUT, and
+// returns an exit status. See builtins.cpp for the registry of names.
+int cd( char **argv, int infd, int outfd );
+int set( char **argv, int infd, int outfd );
+int exportBuiltin( char **argv, int infd, int outfd );
+int unset( char **argv, int infd, int outfd );
+int jobs( char **argv, int infd, int outfd );
+int kill( char **argv, int infd, int outfd );
+int hash( char **argv, int infd, int outfd );
+int help( char **argv, int infd, int outfd );
+int exitBuiltin( char **argv, int infd, int outfd );
+int wait( char **argv, int infd, int outfd );
+int parallel( char **argv, int infd, int outfd );
 
-bool containsShellBuiltin( const std::vector<Command> & commandList );
+// Shell options, changed with "set -o name=value".
+bool setOption( const std::string & assignment );
+void printOptions( std::ostream & os );
 
 #endif
 